@@ -0,0 +1,107 @@
+struct DrawCommand {
+
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+//see MeshLod, absolute index range in the pool
+struct DrawLod {
+
+	uint firstIndex;
+	uint indexCount;
+	float error;
+};
+
+//see GPUDrawData, one per gpu scene object id
+struct DrawData {
+
+	uint batchIndex; //NOT_DRAWN for free ids and surfaces drawn on the cpu
+	uint lodCount;
+	uint meshletCount; //culled per meshlet by the cluster pass at lod 0 when above 1
+	uint indexBase; //meshlet index ranges are relative to it
+	DrawLod lods[5];
+};
+
+const uint NOT_DRAWN = 0xffffffffu;
+
+struct DrawBatch {
+
+	uint drawOffset;
+	uint drawCount;
+};
+
+//meshlets handled by one cluster workgroup
+const uint MESHLETS_PER_ITEM = 32;
+
+layout(buffer_reference, std430) readonly buffer CullData{ 
+	vec4 frustum[6];
+	mat4 viewproj;
+	vec4 pyramidSize; //xy for size in texels, z for mip count
+	vec4 uvScale;
+	vec4 cameraPosition;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawListBuffer{ 
+	DrawData drawList[];
+};
+
+layout(buffer_reference, std430) readonly buffer BatchBuffer{ 
+	DrawBatch batches[];
+};
+
+layout(buffer_reference, std430) writeonly buffer DrawBuffer{ 
+	DrawCommand draws[];
+};
+
+layout(buffer_reference, std430) buffer CountBuffer{ 
+	uint drawn;
+	uint culled;
+	uint triangles;
+	uint occluded;
+	uint clustersCulled;
+	uint counts[];
+};
+
+//indirect dispatch arguments followed by the work items, x is bumped by the cull pass
+layout(buffer_reference, std430) buffer ClusterWorkBuffer{ 
+	uint groupCountX;
+	uint groupCountY;
+	uint groupCountZ;
+	uint padding;
+	uvec2 items[]; //object id and first meshlet
+};
+
+float MaxScale(mat3x4 transform)
+{
+	mat4 model = ToMatrix(transform);
+	return max(max(length(model[0].xyz), length(model[1].xyz)), length(model[2].xyz));
+}
+
+bool IsMeshletVisible(CullData cullData, ObjectData object, Meshlet meshlet)
+{
+	vec3 center = vec4(meshlet.sphere.xyz, 1.f) * object.transform;
+	mat4 model = ToMatrix(object.transform);
+	vec3 scales = vec3(length(model[0].xyz), length(model[1].xyz), length(model[2].xyz));
+	float maxScale = max(max(scales.x, scales.y), scales.z);
+	float radius = meshlet.sphere.w * maxScale;
+
+	for (int i = 0; i < 6; i++)
+	{
+		vec4 plane = cullData.frustum[i];
+		if (dot(plane.xyz, center) + plane.w < -radius)
+			return false;
+	}
+
+	//non uniform scales skew the normals, so the cone no longer bounds them
+	float minScale = min(min(scales.x, scales.y), scales.z);
+	if (maxScale > minScale * 1.01f)
+		return true;
+
+	//every triangle faces away when the camera sits in the cone behind the meshlet
+	vec3 axis = normalize(vec4(meshlet.cone.xyz, 0.f) * object.transform);
+	vec3 toCenter = center - cullData.cameraPosition.xyz;
+	return dot(toCenter, axis) < meshlet.cone.w * length(toCenter) + radius;
+}
@@ -8,12 +8,27 @@ layout(set = 0, binding = 0) uniform  SceneData{
 	vec4 sunlightColor;
 } sceneData;
 
-layout(set = 1, binding = 0) uniform MaterialData{
+struct MaterialData {
 
 	vec4 colorFactors;
-	vec4 metal_rough_factors;
+	vec3 emissiveFactors;
+	float alphaCutoff;
+	float metallicFactor;
+	float roughnessFactor;
+	float normalScale;
+	float occlusionStrength;
+	// texture index in the low 16 bits, sampler index in the high 16 bits
+	uint colorTexture;
+	uint metalRoughTexture;
+	uint normalTexture;
+	uint occlusionTexture;
+	uint emissiveTexture;
+};
 
-} materialData;
+// bindless set, shared by every draw
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+layout(set = 1, binding = 2) readonly buffer MaterialBuffer{
 
-layout(set = 1, binding = 1) uniform sampler2D colorTex;
-layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
\ No newline at end of file
+	MaterialData materials[];
+} materialBuffer;
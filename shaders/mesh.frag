@@ -1,20 +1,39 @@
 #version 450
 
 #extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
 #include "input_structures.glsl"
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
+layout (location = 3) flat in uint inMaterialIndex;
 
 layout (location = 0) out vec4 outFragColor;
 
+vec4 SampleMaterialTexture(uint packedTexture, vec2 uv)
+{
+	// indirect draws can mix materials within a subgroup
+	uint textureIndex = packedTexture & 0xffffu;
+	uint samplerIndex = packedTexture >> 16u;
+	return texture(sampler2D(textures[nonuniformEXT(textureIndex)], samplers[nonuniformEXT(samplerIndex)]), uv);
+}
+
 void main() 
 {
 	float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
 
-	vec3 color = inColor * texture(colorTex,inUV).xyz;
-	vec3 ambient = color *  sceneData.ambientColor.xyz;
+	MaterialData material = materialBuffer.materials[inMaterialIndex];
+	vec4 texColor = SampleMaterialTexture(material.colorTexture, inUV);
+	// alpha masked materials, the cutoff is 0 for everything else
+	if (material.colorFactors.w * texColor.a < material.alphaCutoff)
+		discard;
+
+	float occlusion = mix(1.f, SampleMaterialTexture(material.occlusionTexture, inUV).r, material.occlusionStrength);
+
+	vec3 color = inColor * material.colorFactors.xyz * texColor.xyz;
+	vec3 ambient = color *  sceneData.ambientColor.xyz * occlusion;
+	vec3 emissive = material.emissiveFactors * SampleMaterialTexture(material.emissiveTexture, inUV).xyz;
 
-	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + ambient ,1.0f);
+	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + ambient + emissive ,1.0f);
 }
\ No newline at end of file
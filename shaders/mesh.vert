@@ -2,43 +2,35 @@
 
 #extension GL_GOOGLE_include_directive : require
 #extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
 
 #include "input_structures.glsl"
+#include "object_structures.glsl"
 
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
-
-struct Vertex {
-
-	vec3 position;
-	float uv_x;
-	vec3 normal;
-	float uv_y;
-	vec4 color;
-}; 
-
-layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
-	Vertex vertices[];
-};
+layout (location = 3) flat out uint outMaterialIndex;
 
 //push constants block
 layout( push_constant ) uniform constants
 {
-	mat4 render_matrix;
-	VertexBuffer vertexBuffer;
+	ObjectBuffer objectBuffer;
+	InstanceBuffer instanceBuffer;
 } PushConstants;
 
 void main() 
 {
-	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	ObjectData object = PushConstants.objectBuffer.objects[PushConstants.instanceBuffer.ids[gl_InstanceIndex]];
+	Vertex v = DecodeVertex(object, gl_VertexIndex);
 	
 	vec4 position = vec4(v.position, 1.0f);
 
-	gl_Position =  sceneData.viewproj * PushConstants.render_matrix *position;	
+	gl_Position =  sceneData.viewproj * vec4(position * object.transform, 1.f);	
 
-	outNormal = (PushConstants.render_matrix * vec4(v.normal, 0.f)).xyz;
-	outColor = v.color.xyz * materialData.colorFactors.xyz;	
+	outNormal = vec4(v.normal, 0.f) * object.transform;
+	outColor = v.color.xyz;
 	outUV.x = v.uv_x;
 	outUV.y = v.uv_y;
+	outMaterialIndex = object.materialIndex;
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "input_structures.glsl"
+#include "object_structures.glsl"
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec3 outColor;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterialIndex;
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+	ObjectBuffer objectBuffer;
+} PushConstants;
+
+void main() 
+{
+	// the cull shader stores the scene object id in firstInstance
+	ObjectData object = PushConstants.objectBuffer.objects[gl_InstanceIndex];
+	Vertex v = DecodeVertex(object, gl_VertexIndex);
+	
+	vec4 position = vec4(v.position, 1.0f);
+
+	gl_Position =  sceneData.viewproj * vec4(position * object.transform, 1.f);	
+
+	outNormal = vec4(v.normal, 0.f) * object.transform;
+	outColor = v.color.xyz;
+	outUV.x = v.uv_x;
+	outUV.y = v.uv_y;
+	outMaterialIndex = object.materialIndex;
+}
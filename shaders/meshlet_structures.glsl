@@ -0,0 +1,16 @@
+//handed from the task shader to its mesh workgroups, one per visible meshlet
+struct TaskPayload {
+
+	uint objectId;
+	uint meshlets[MESHLETS_PER_ITEM];
+};
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+	CullData cullData;
+	ObjectBuffer sceneBuffer;
+	DrawListBuffer drawListBuffer;
+	ClusterWorkBuffer clusterWorkBuffer;
+	CountBuffer countBuffer;
+} PushConstants;
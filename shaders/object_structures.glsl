@@ -0,0 +1,89 @@
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+//unorm16 position inside the mesh bounds, octahedral snorm16 normal, half float uv, rgba8 color
+struct PackedVertex {
+
+	uint positionXY;
+	uint positionZ;
+	uint normal;
+	uint uv;
+	uint color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	PackedVertex vertices[];
+};
+
+// scene object ids of the cpu recorded draws, indexed with gl_InstanceIndex
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	uint ids[];
+};
+
+//see GPUMeshlet
+struct Meshlet {
+
+	vec4 sphere; //xyz for local center, w for radius
+	vec4 cone; //xyz for axis, w for cutoff
+	uint firstIndex;
+	uint vertexOffset;
+	uint triangleOffset;
+	uint counts; //vertex count in the low 16 bits, triangle count in the high 16 bits
+};
+
+layout(buffer_reference, std430) readonly buffer MeshletBuffer{ 
+	Meshlet meshlets[];
+};
+
+struct ObjectData {
+
+	mat3x4 transform; //first three rows of the affine model matrix, transform points with vec4(p, 1) * transform
+	vec4 sphereBounds; //xyz for local origin, w for radius
+	vec3 positionOffset;
+	uint firstIndex;
+	vec3 positionScale;
+	uint indexCount;
+	VertexBuffer vertexBuffer;
+	uint materialIndex;
+	uint meshletCount;
+	MeshletBuffer meshletBuffer;
+	uint firstMeshlet;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{ 
+	ObjectData objects[];
+};
+
+mat4 ToMatrix(mat3x4 affine)
+{
+	return transpose(mat4(affine[0], affine[1], affine[2], vec4(0.f, 0.f, 0.f, 1.f)));
+}
+
+Vertex DecodeVertex(ObjectData object, uint index)
+{
+	PackedVertex packed = object.vertexBuffer.vertices[index];
+	Vertex v;
+
+	vec2 positionXY = unpackUnorm2x16(packed.positionXY);
+	v.position = object.positionOffset + vec3(positionXY, unpackUnorm2x16(packed.positionZ).x) * object.positionScale;
+
+	//unfold the octahedron, the lower hemisphere was mirrored over the diagonals
+	vec2 e = unpackSnorm2x16(packed.normal);
+	vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.f);
+	n.x += n.x >= 0.f ? -t : t;
+	n.y += n.y >= 0.f ? -t : t;
+	v.normal = normalize(n);
+
+	vec2 uv = unpackHalf2x16(packed.uv);
+	v.uv_x = uv.x;
+	v.uv_y = uv.y;
+	v.color = unpackUnorm4x8(packed.color);
+	return v;
+}
@@ -0,0 +1,357 @@
+#include "AssetCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::filesystem::path& path, bool copyOnWrite)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = (const uint8_t*)data;
+	_size = (size_t)size.QuadPart;
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	size_t pageSize = systemInfo.dwPageSize;
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		close(file);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)info.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file, 0);
+	// the mapping keeps the file alive on its own
+	close(file);
+	if (data == MAP_FAILED)
+		return false;
+
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+	_data = (const uint8_t*)data;
+	_size = (size_t)info.st_size;
+
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	_capacity = (_size + pageSize - 1) / pageSize * pageSize;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!_data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+	_file = nullptr;
+	_mapping = nullptr;
+#else
+	munmap((void*)_data, _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+	_capacity = 0;
+}
+
+void MappedFile::Discard(size_t offset, size_t size)
+{
+	if (!_data || offset >= _size)
+		return;
+	size = std::min(size, _size - offset);
+#ifdef _WIN32
+	// unlocking pages that aren't locked drops them from the working set
+	VirtualUnlock((void*)(_data + offset), size);
+#else
+	// whole pages only, the partial ones at the ends stay
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t first = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t last = (offset + size) / pageSize * pageSize;
+	if (last > first)
+		madvise((void*)(_data + first), last - first, MADV_DONTNEED);
+#endif
+}
+
+size_t GetPeakResidentMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	// kilobytes on linux
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// the full 128 bit product of a and b, folded
+static uint64_t HashMix(uint64_t a, uint64_t b)
+{
+#ifdef _MSC_VER
+	uint64_t high;
+	uint64_t low = _umul128(a, b, &high);
+	return low ^ high;
+#else
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+#endif
+}
+
+static uint64_t Read64(const uint8_t* bytes) { uint64_t value; memcpy(&value, bytes, sizeof(value)); return value; }
+static uint64_t Read32(const uint8_t* bytes) { uint32_t value; memcpy(&value, bytes, sizeof(value)); return value; }
+
+uint64_t Cooked::HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	constexpr uint64_t Secret[] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+	const uint8_t* bytes = (const uint8_t*)data;
+	hash ^= HashMix(hash ^ Secret[0], Secret[1]);
+
+	uint64_t a, b;
+	if (size <= 16) {
+		if (size >= 4) {
+			// two overlapping reads from each end cover everything from 4 to 16 bytes
+			size_t middle = (size >> 3) << 2;
+			a = (Read32(bytes) << 32) | Read32(bytes + middle);
+			b = (Read32(bytes + size - 4) << 32) | Read32(bytes + size - 4 - middle);
+		}
+		else if (size > 0) {
+			a = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[size >> 1] << 8) | bytes[size - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t remaining = size;
+		if (remaining > 48) {
+			// three lanes that don't wait on each other's multiplies
+			uint64_t lane1 = hash, lane2 = hash;
+			do {
+				hash = HashMix(Read64(bytes) ^ Secret[1], Read64(bytes + 8) ^ hash);
+				lane1 = HashMix(Read64(bytes + 16) ^ Secret[2], Read64(bytes + 24) ^ lane1);
+				lane2 = HashMix(Read64(bytes + 32) ^ Secret[3], Read64(bytes + 40) ^ lane2);
+				bytes += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+			hash ^= lane1 ^ lane2;
+		}
+		while (remaining > 16) {
+			hash = HashMix(Read64(bytes) ^ Secret[1], Read64(bytes + 8) ^ hash);
+			bytes += 16;
+			remaining -= 16;
+		}
+		// the last 16 bytes, overlapping what came before when the tail is shorter
+		a = Read64(bytes + remaining - 16);
+		b = Read64(bytes + remaining - 8);
+	}
+
+	a ^= Secret[1];
+	b ^= hash;
+#ifdef _MSC_VER
+	uint64_t high;
+	a = _umul128(a, b, &high);
+	b = high;
+#else
+	unsigned __int128 product = (unsigned __int128)a * b;
+	a = (uint64_t)product;
+	b = (uint64_t)(product >> 64);
+#endif
+	return HashMix(a ^ Secret[0] ^ size, b ^ Secret[1]);
+}
+
+uint64_t Cooked::GetSourceKey(MappedFile& source, const GLTFLoadOptions& options)
+{
+	// in chunks, each dropped once hashed. a miss reads the file again for the parser
+	constexpr size_t ChunkSize = 64 * 1024 * 1024;
+	uint64_t hash = HashSeed;
+	for (size_t offset = 0; offset < source.GetSize(); offset += ChunkSize) {
+		size_t size = std::min(ChunkSize, source.GetSize() - offset);
+		hash = HashBytes(hash, source.GetData() + offset, size);
+		source.Discard(offset, size);
+	}
+
+	uint32_t version = ImporterVersion;
+	uint8_t flags[] = { options.optimizeMeshes, options.generateLods, options.buildMeshlets, options.mergeStaticGeometry };
+	hash = HashBytes(hash, &version, sizeof(version));
+	return HashBytes(hash, flags, sizeof(flags));
+}
+
+std::filesystem::path Cooked::GetCachePath(const std::filesystem::path& sourcePath)
+{
+	// the key is checked on open, so two sources with the same name only cost each other a cook
+	return std::filesystem::path(CacheDirectory) / (sourcePath.stem().string() + ".cooked");
+}
+
+Cooked::String CookedWriter::AddString(std::string_view string)
+{
+	Cooked::String result{ (uint32_t)_strings.size(), (uint32_t)string.size() };
+	_strings.insert(_strings.end(), string.begin(), string.end());
+	return result;
+}
+
+Cooked::Range CookedWriter::AddData(const void* data, size_t size)
+{
+	if (size == 0)
+		return Cooked::Range{ 0, 0 };
+
+	// aligned so the blobs can be read in place
+	_data.resize((_data.size() + 15) & ~size_t(15));
+	Cooked::Range range{ _data.size(), size };
+	_data.insert(_data.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	return range;
+}
+
+bool CookedWriter::Write(const std::filesystem::path& path, uint64_t sourceKey)
+{
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	// written under a temporary name, so a cook that fails halfway never looks valid
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		fmt::println("Failed to write cooked file: {}", path.string());
+		return false;
+	}
+
+	Cooked::Header header{};
+	header.magic = Cooked::Magic;
+	header.version = Cooked::ImporterVersion;
+	header.sourceKey = sourceKey;
+	header.fileNodeCount = fileNodeCount;
+
+	uint64_t offset = sizeof(Cooked::Header);
+	auto place = [&](Cooked::Range& range, size_t size) {
+		offset = (offset + 15) & ~uint64_t(15);
+		range = Cooked::Range{ offset, size };
+		offset += size;
+	};
+	place(header.strings, _strings.size());
+	place(header.samplers, samplers.size() * sizeof(Cooked::Sampler));
+	place(header.images, images.size() * sizeof(Cooked::Image));
+	place(header.materials, materials.size() * sizeof(Cooked::Material));
+	place(header.meshes, meshes.size() * sizeof(Cooked::Mesh));
+	place(header.surfaces, surfaces.size() * sizeof(Cooked::Surface));
+	place(header.lods, lods.size() * sizeof(MeshLod));
+	place(header.nodes, nodes.size() * sizeof(Cooked::Node));
+	place(header.children, children.size() * sizeof(uint32_t));
+	place(header.data, _data.size());
+
+	uint64_t written = 0;
+	auto write = [&](const Cooked::Range& range, const void* data) {
+		static const char zeros[16] = {};
+		file.write(zeros, range.offset - written);
+		file.write((const char*)data, range.size);
+		written = range.offset + range.size;
+	};
+	file.write((const char*)&header, sizeof(header));
+	written = sizeof(header);
+	write(header.strings, _strings.data());
+	write(header.samplers, samplers.data());
+	write(header.images, images.data());
+	write(header.materials, materials.data());
+	write(header.meshes, meshes.data());
+	write(header.surfaces, surfaces.data());
+	write(header.lods, lods.data());
+	write(header.nodes, nodes.data());
+	write(header.children, children.data());
+	write(header.data, _data.data());
+	file.close();
+
+	if (file.fail()) {
+		fmt::println("Failed to write cooked file: {}", path.string());
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		fmt::println("Failed to write cooked file: {}", path.string());
+		return false;
+	}
+	fmt::println("Cooked {} bytes into {}", offset, path.string());
+	return true;
+}
+
+bool CookedReader::Open(const std::filesystem::path& path, uint64_t sourceKey)
+{
+	if (!_file.Open(path))
+		return false;
+
+	_header = (const Cooked::Header*)_file.GetData();
+	if (_file.GetSize() < sizeof(Cooked::Header) || _header->magic != Cooked::Magic
+		|| _header->version != Cooked::ImporterVersion || _header->sourceKey != sourceKey) {
+		_file.Close();
+		return false;
+	}
+
+	// a truncated or damaged file is treated like a miss
+	const Cooked::Range* ranges = &_header->strings;
+	for (const Cooked::Range* range = ranges; range <= &_header->data; range++) {
+		if (range->offset % 16 != 0 || range->offset + range->size > _file.GetSize()) {
+			_file.Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string_view CookedReader::GetString(Cooked::String string)
+{
+	if ((uint64_t)string.offset + string.length > _header->strings.size)
+		return {};
+	return std::string_view((const char*)_file.GetData() + _header->strings.offset + string.offset, string.length);
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include "Render.h"
+
+#include <filesystem>
+
+// view of a whole file, the os pages it in as it gets touched
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); };
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// copy on write maps the pages writable, changes stay private to the process and never reach the file
+	bool Open(const std::filesystem::path& path, bool copyOnWrite = false);
+	void Close();
+
+	const uint8_t* GetData() { return _data; };
+	size_t GetSize() { return _size; };
+	// the mapping covers whole pages, the bytes after the end of the file read as zero
+	size_t GetCapacity() { return _capacity; };
+	std::span<const uint8_t> GetSpan() { return std::span<const uint8_t>(_data, _size); };
+	// takes the pages out of the resident set, they are read from the file again when touched.
+	// only for pages nothing was written to through a copy on write mapping
+	void Discard(size_t offset, size_t size);
+
+private:
+	const uint8_t* _data{ nullptr };
+	size_t _size{ 0 };
+	size_t _capacity{ 0 };
+#ifdef _WIN32
+	void* _file{ nullptr };
+	void* _mapping{ nullptr };
+#endif
+};
+
+// peak resident memory of the process so far, zero where the platform doesn't report it
+size_t GetPeakResidentMemory();
+
+// cooked scenes hold what the gltf importer produces, already in the layout it is uploaded in.
+// a cache hit skips parsing, image decoding, mip generation, texture compression and vertex conversion
+namespace Cooked
+{
+	constexpr uint32_t Magic = 0x4b4f4f43; // "COOK"
+	// bump whenever the importer output changes, caches written by older versions are ignored until cooked again
+	constexpr uint32_t ImporterVersion = 5;
+	constexpr const char* CacheDirectory = "cache";
+
+	// blob ranges are relative to the data section and 16 byte aligned, table ranges to the start of the file
+	struct Range {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// into the string section
+	struct String {
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceKey;
+		Range strings;
+		Range samplers;
+		Range images;
+		Range materials;
+		Range meshes;
+		Range surfaces;
+		Range lods;
+		Range nodes;
+		Range children;
+		Range data;
+		// the nodes of the gltf file, the static chunks follow them
+		uint32_t fileNodeCount;
+	};
+
+	struct Sampler {
+		VkFilter magFilter;
+		VkFilter minFilter;
+		VkSamplerMipmapMode mipmapMode;
+	};
+
+	struct Image {
+		String name;
+		VkExtent3D size;
+		uint32_t mipLevels; // 0 when decoding failed, the error image takes the slot
+		VkFormat format;
+		VkComponentMapping swizzle;
+		Range pixels; // every level, block compressed unless the source format had no encoder
+		uint64_t contentKey; // what the image is shared across scenes by, zero when it can't be
+	};
+
+	struct Material {
+		String name;
+		// textures are packed with the file image and sampler index plus one, zero for the default slot
+		MetallicRougness::MaterialConstants constants;
+		MaterialPass passType;
+	};
+
+	struct Mesh {
+		String name;
+		glm::vec3 positionOffset;
+		glm::vec3 positionScale;
+		Range indices;
+		Range vertices;
+		Range meshlets; // descriptors followed by the lists, offsets already final
+		Range meshletData;
+		uint32_t firstSurface;
+		uint32_t surfaceCount; // zero for meshes merged into static chunks
+		uint64_t contentKey;
+	};
+
+	struct Surface {
+		uint32_t startIndex;
+		uint32_t count;
+		Bounds bounds;
+		uint32_t material;
+		uint32_t firstLod; // into the lod table
+		uint32_t lodCount;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		// empty unless the surface is a software occluder
+		Range occluderPositions;
+		Range occluderIndices;
+	};
+
+	struct Node {
+		String name;
+		glm::mat4 transform;
+		uint32_t mesh; // UINT32_MAX for nodes without geometry
+		uint32_t firstChild; // into the child table
+		uint32_t childCount;
+	};
+
+	// wyhash, eight bytes at a time in three independent lanes. continues from a previous hash
+	uint64_t HashBytes(uint64_t hash, const void* data, size_t size);
+	constexpr uint64_t HashSeed = 14695981039346656037ull;
+	// the source bytes, the importer version and every option that changes the output.
+	// drops the pages it has hashed, so a hit leaves nothing of the source resident
+	uint64_t GetSourceKey(MappedFile& source, const GLTFLoadOptions& options);
+	std::filesystem::path GetCachePath(const std::filesystem::path& sourcePath);
+}
+
+// collects the importer output and writes it as one cooked file
+class CookedWriter
+{
+public:
+	Cooked::String AddString(std::string_view string);
+	Cooked::Range AddData(const void* data, size_t size);
+	template<typename T>
+	Cooked::Range AddData(std::span<const T> values) { return AddData(values.data(), values.size_bytes()); };
+
+	bool Write(const std::filesystem::path& path, uint64_t sourceKey);
+
+	std::vector<Cooked::Sampler> samplers;
+	std::vector<Cooked::Image> images;
+	std::vector<Cooked::Material> materials;
+	std::vector<Cooked::Mesh> meshes;
+	std::vector<Cooked::Surface> surfaces;
+	std::vector<MeshLod> lods;
+	std::vector<Cooked::Node> nodes;
+	std::vector<uint32_t> children;
+	uint32_t fileNodeCount{ 0 };
+
+private:
+	std::vector<char> _strings;
+	std::vector<uint8_t> _data;
+};
+
+// a cooked file that matched its key, every table and blob points straight into the mapping
+class CookedReader
+{
+public:
+	bool Open(const std::filesystem::path& path, uint64_t sourceKey);
+
+	const Cooked::Header& GetHeader() { return *_header; };
+	std::string_view GetString(Cooked::String string);
+	// empty when the range falls outside the data section
+	template<typename T>
+	std::span<const T> GetData(Cooked::Range range)
+	{
+		if (range.offset + range.size > _header->data.size || range.size % sizeof(T) != 0)
+			return {};
+		return std::span<const T>((const T*)(_file.GetData() + _header->data.offset + range.offset), range.size / sizeof(T));
+	};
+
+	std::span<const Cooked::Sampler> GetSamplers() { return GetTable<Cooked::Sampler>(_header->samplers); };
+	std::span<const Cooked::Image> GetImages() { return GetTable<Cooked::Image>(_header->images); };
+	std::span<const Cooked::Material> GetMaterials() { return GetTable<Cooked::Material>(_header->materials); };
+	std::span<const Cooked::Mesh> GetMeshes() { return GetTable<Cooked::Mesh>(_header->meshes); };
+	std::span<const Cooked::Surface> GetSurfaces() { return GetTable<Cooked::Surface>(_header->surfaces); };
+	std::span<const MeshLod> GetLods() { return GetTable<MeshLod>(_header->lods); };
+	std::span<const Cooked::Node> GetNodes() { return GetTable<Cooked::Node>(_header->nodes); };
+	std::span<const uint32_t> GetChildren() { return GetTable<uint32_t>(_header->children); };
+
+private:
+	template<typename T>
+	std::span<const T> GetTable(Cooked::Range range)
+	{
+		return std::span<const T>((const T*)(_file.GetData() + range.offset), range.size / sizeof(T));
+	};
+
+	MappedFile _file;
+	const Cooked::Header* _header{ nullptr };
+};
@@ -0,0 +1,137 @@
+#include "AssetRegistry.h"
+#include "Engine.h"
+#include "AssetCache.h"
+
+template<typename T>
+std::shared_ptr<T> AssetRegistry::Find(std::unordered_map<uint64_t, std::weak_ptr<T>>& entries, uint64_t key)
+{
+	if (key == 0)
+		return nullptr;
+	auto it = entries.find(key);
+	return it != entries.end() ? it->second.lock() : nullptr;
+}
+
+template<typename T>
+void AssetRegistry::Forget(std::unordered_map<uint64_t, std::weak_ptr<T>>& entries, uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = entries.find(key);
+	if (it != entries.end() && it->second.expired())
+		entries.erase(it);
+}
+
+void AssetRegistry::ForgetAll()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_images.clear();
+	_meshes.clear();
+	_samplers.clear();
+}
+
+std::shared_ptr<AssetRegistry::Sampler> AssetRegistry::GetSampler(const Cooked::Sampler& filters)
+{
+	uint64_t key = Cooked::HashBytes(Cooked::HashSeed, &filters, sizeof(Cooked::Sampler));
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (std::shared_ptr<Sampler> sampler = Find(_samplers, key)) {
+		_samplerStats.shared++;
+		return sampler;
+	}
+
+	VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr };
+	sampl.maxLod = VK_LOD_CLAMP_NONE;
+	sampl.minLod = 0;
+
+	sampl.magFilter = filters.magFilter;
+	sampl.minFilter = filters.minFilter;
+	sampl.mipmapMode = filters.mipmapMode;
+
+	Engine* engine = Engine::Get();
+	Sampler* newSampler = new Sampler{};
+	vkCreateSampler(engine->GetDevice(), &sampl, nullptr, &newSampler->sampler);
+	newSampler->index = engine->GetBindless().AddSampler(newSampler->sampler);
+
+	std::shared_ptr<Sampler> sampler(newSampler, [this, key](Sampler* sampler) {
+		Engine* engine = Engine::Get();
+		engine->GetBindless().RemoveSampler(sampler->index);
+		vkDestroySampler(engine->GetDevice(), sampler->sampler, nullptr);
+		delete sampler;
+		Forget(_samplers, key);
+		});
+	_samplers[key] = sampler;
+	_samplerStats.created++;
+	return sampler;
+}
+
+std::shared_ptr<AssetRegistry::Image> AssetRegistry::FindImage(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::shared_ptr<Image> image = Find(_images, key);
+	if (image) {
+		_imageStats.shared++;
+		_imageStats.savedBytes += image->byteSize;
+	}
+	return image;
+}
+
+std::shared_ptr<AssetRegistry::Image> AssetRegistry::AddImage(uint64_t key, uint32_t index)
+{
+	Image* newImage = new Image{};
+	newImage->index = index;
+	std::shared_ptr<Image> image(newImage, [this, key](Image* image) {
+		Engine* engine = Engine::Get();
+		if (image->streamedTexture != UINT32_MAX)
+			engine->GetTextureStreamer().RemoveTexture(image->streamedTexture);
+		// images that failed to load sit on the shared error image
+		else if (image->image.image != VK_NULL_HANDLE && image->image.image != engine->GetErrorImage().image)
+			engine->DestroyImage(image->image);
+		engine->GetBindless().RemoveTexture(image->index);
+		delete image;
+		if (key != 0)
+			Forget(_images, key);
+		});
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (key != 0)
+		_images[key] = image;
+	_imageStats.created++;
+	return image;
+}
+
+std::shared_ptr<AssetRegistry::Mesh> AssetRegistry::FindMesh(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::shared_ptr<Mesh> mesh = Find(_meshes, key);
+	if (mesh) {
+		_meshStats.shared++;
+		_meshStats.savedBytes += mesh->byteSize;
+	}
+	return mesh;
+}
+
+std::shared_ptr<AssetRegistry::Mesh> AssetRegistry::AddMesh(uint64_t key, const MeshBuffers& buffers)
+{
+	Mesh* newMesh = new Mesh{};
+	newMesh->buffers = buffers;
+	newMesh->byteSize = buffers.indices.indexCount * IndexPool::GetIndexSize(buffers.indices.indexType);
+	if (buffers.vertexBufferAddress != 0)
+		newMesh->byteSize += buffers.vertexBuffer.info.size;
+	if (buffers.meshletBufferAddress != 0)
+		newMesh->byteSize += buffers.meshletBuffer.info.size;
+	std::shared_ptr<Mesh> mesh(newMesh, [this, key](Mesh* mesh) {
+		Engine* engine = Engine::Get();
+		engine->GetIndexPool().Free(mesh->buffers.indices);
+		if (mesh->buffers.vertexBufferAddress != 0)
+			engine->DestroyBuffer(mesh->buffers.vertexBuffer);
+		if (mesh->buffers.meshletBufferAddress != 0)
+			engine->DestroyBuffer(mesh->buffers.meshletBuffer);
+		delete mesh;
+		if (key != 0)
+			Forget(_meshes, key);
+		});
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (key != 0)
+		_meshes[key] = mesh;
+	_meshStats.created++;
+	return mesh;
+}
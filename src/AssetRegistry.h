@@ -0,0 +1,74 @@
+#pragma once
+#include "Mesh.h"
+
+#include <mutex>
+
+namespace Cooked { struct Sampler; }
+
+// gpu copies of images, meshes and samplers keyed by their content, so scenes that load the same data
+// share one copy. the scenes hold the handles, the last one to go destroys what it points at
+class AssetRegistry
+{
+public:
+	struct Image {
+		AllocatedImage image{};
+		// bindless slot, every scene sharing the image packs the same one into its materials
+		uint32_t index{ 0 };
+		// UINT32_MAX unless the texture streamer owns the image
+		uint32_t streamedTexture{ UINT32_MAX };
+		size_t byteSize{ 0 };
+	};
+
+	struct Mesh {
+		MeshBuffers buffers{};
+		size_t byteSize{ 0 };
+	};
+
+	struct Sampler {
+		VkSampler sampler;
+		uint32_t index;
+	};
+
+	// entries created against handles given out for one that was already alive
+	struct Stats {
+		uint32_t created{ 0 };
+		uint32_t shared{ 0 };
+		// what the shared handles would have taken up as copies of their own
+		size_t savedBytes{ 0 };
+	};
+
+	// samplers are keyed by their create info, equal filters always get the same one
+	std::shared_ptr<Sampler> GetSampler(const Cooked::Sampler& filters);
+
+	// null when nothing with the key is alive, the loader then uploads it and adds it
+	std::shared_ptr<Image> FindImage(uint64_t key);
+	// the entry takes over the bindless slot, the loader fills in the image once it landed.
+	// a zero key is never shared
+	std::shared_ptr<Image> AddImage(uint64_t key, uint32_t index);
+	std::shared_ptr<Mesh> FindMesh(uint64_t key);
+	std::shared_ptr<Mesh> AddMesh(uint64_t key, const MeshBuffers& buffers);
+
+	// drops every entry, so later loads upload copies of their own even of what is still alive.
+	// the load benchmark would otherwise time nothing but lookups
+	void ForgetAll();
+
+	Stats GetImageStats() { std::lock_guard<std::mutex> lock(_mutex); return _imageStats; };
+	Stats GetMeshStats() { std::lock_guard<std::mutex> lock(_mutex); return _meshStats; };
+	Stats GetSamplerStats() { std::lock_guard<std::mutex> lock(_mutex); return _samplerStats; };
+
+private:
+	template<typename T>
+	static std::shared_ptr<T> Find(std::unordered_map<uint64_t, std::weak_ptr<T>>& entries, uint64_t key);
+	// drops the map entry unless the key was taken over by a newer one in the meantime
+	template<typename T>
+	void Forget(std::unordered_map<uint64_t, std::weak_ptr<T>>& entries, uint64_t key);
+
+	// scenes loading in the background share from the loader thread, the render thread drops them
+	std::mutex _mutex;
+	std::unordered_map<uint64_t, std::weak_ptr<Image>> _images;
+	std::unordered_map<uint64_t, std::weak_ptr<Mesh>> _meshes;
+	std::unordered_map<uint64_t, std::weak_ptr<Sampler>> _samplers;
+	Stats _imageStats;
+	Stats _meshStats;
+	Stats _samplerStats;
+};
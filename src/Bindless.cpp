@@ -0,0 +1,234 @@
+#include "Bindless.h"
+#include "Engine.h"
+
+#include <algorithm>
+
+void BindlessResources::Init()
+{
+	Engine* engine = Engine::Get();
+	VkDevice device = engine->GetDevice();
+
+	DescriptorLayoutBuilder builder;
+	builder.AddBinding(TextureBinding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MaxTextures);
+	builder.AddBinding(SamplerBinding, VK_DESCRIPTOR_TYPE_SAMPLER, MaxSamplers);
+	builder.AddBinding(MaterialBinding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+	// unused slots stay empty. update after bind only lifts the descriptor limits, the copies are never
+	// written while a frame that binds them is pending
+	VkDescriptorBindingFlags tableFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+	VkDescriptorBindingFlags bindingFlags[] = { tableFlags, tableFlags, 0 };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+	flagsInfo.bindingCount = 3;
+	flagsInfo.pBindingFlags = bindingFlags;
+
+	layout = builder.Build(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, &flagsInfo, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+
+	VkDescriptorPoolSize poolSizes[] = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MaxTextures * FRAME_OVERLAP },
+		{ VK_DESCRIPTOR_TYPE_SAMPLER, MaxSamplers * FRAME_OVERLAP },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, FRAME_OVERLAP }
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = FRAME_OVERLAP;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+
+	VkDescriptorSetLayout layouts[FRAME_OVERLAP];
+	std::fill_n(layouts, FRAME_OVERLAP, layout);
+	VkDescriptorSetAllocateInfo allocInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = pool;
+	allocInfo.descriptorSetCount = FRAME_OVERLAP;
+	allocInfo.pSetLayouts = layouts;
+	VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, sets));
+
+	materialBuffer = engine->CreateBuffer(sizeof(MetallicRougness::MaterialConstants) * MaxMaterials,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	// nothing is in flight yet, so every copy can be written right away
+	for (VkDescriptorSet set : sets) {
+		DescriptorWriter writer;
+		writer.WriteBuffer(MaterialBinding, materialBuffer.buffer, VK_WHOLE_SIZE, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		writer.UpdateSet(set);
+	}
+
+	_materials.resize(MaxMaterials);
+}
+
+void BindlessResources::CleanResources()
+{
+	VkDevice device = Engine::GetMainDevice();
+	Engine::Get()->DestroyBuffer(materialBuffer);
+	vkDestroyDescriptorPool(device, pool, nullptr);
+	vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+void BindlessResources::Update(uint64_t frameNumber)
+{
+	std::vector<SlotWrite> writes;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_frameNumber = frameNumber;
+		writes.swap(_pendingWrites[frameNumber % FRAME_OVERLAP]);
+		ReleaseSlots(_retiredTextures, _freeTextures, frameNumber);
+		ReleaseSlots(_retiredSamplers, _freeSamplers, frameNumber);
+		ReleaseSlots(_retiredMaterials, _freeMaterials, frameNumber);
+	}
+	if (writes.empty())
+		return;
+
+	// in queue order, a slot written twice ends up with the last one
+	DescriptorWriter writer;
+	for (const SlotWrite& write : writes) {
+		if (write.binding == TextureBinding)
+			writer.WriteImage(TextureBinding, write.view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, write.index);
+		else
+			writer.WriteImage(SamplerBinding, VK_NULL_HANDLE, write.sampler, VK_IMAGE_LAYOUT_UNDEFINED, VK_DESCRIPTOR_TYPE_SAMPLER, write.index);
+	}
+	writer.UpdateSet(sets[frameNumber % FRAME_OVERLAP]);
+}
+
+void BindlessResources::QueueWrite(const SlotWrite& write)
+{
+	for (std::vector<SlotWrite>& writes : _pendingWrites) {
+		writes.push_back(write);
+	}
+}
+
+void BindlessResources::RetireSlot(std::vector<RetiredSlot>& retired, uint32_t index)
+{
+	retired.push_back(RetiredSlot{ index, _frameNumber });
+}
+
+void BindlessResources::ReleaseSlots(std::vector<RetiredSlot>& retired, std::vector<uint32_t>& freeSlots, uint64_t frameNumber)
+{
+	// the frames that could still index a slot have passed their fence once frameNumber got this far
+	std::erase_if(retired, [&](const RetiredSlot& slot) {
+		if (slot.frameNumber + FRAME_OVERLAP > frameNumber)
+			return false;
+		freeSlots.push_back(slot.index);
+		return true;
+		});
+}
+
+bool BindlessResources::AllocateSlot(std::vector<uint32_t>& freeSlots, uint32_t& slotCount, uint32_t maxSlots, const char* name, uint32_t& slot)
+{
+	if (!freeSlots.empty()) {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+		return true;
+	}
+
+	if (slotCount == maxSlots) {
+		fmt::println("Bindless {} table is full ({} slots)", name, maxSlots);
+		return false;
+	}
+	slot = slotCount++;
+	return true;
+}
+
+uint32_t BindlessResources::AddTexture(VkImageView view)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	uint32_t index;
+	// the caller falls back to the default in slot 0, which stays as it is
+	if (!AllocateSlot(_freeTextures, _textureCount, MaxTextures, "texture", index))
+		return 0;
+	QueueWrite(SlotWrite{ TextureBinding, index, view, VK_NULL_HANDLE });
+	return index;
+}
+
+void BindlessResources::SetTexture(uint32_t index, VkImageView view)
+{
+	// textures that fell back to the default don't get to replace it
+	if (index == 0)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	QueueWrite(SlotWrite{ TextureBinding, index, view, VK_NULL_HANDLE });
+}
+
+void BindlessResources::RemoveTexture(uint32_t index)
+{
+	// slot 0 holds the defaults and is never handed out twice
+	if (index == 0)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	RetireSlot(_retiredTextures, index);
+}
+
+uint32_t BindlessResources::AddSampler(VkSampler sampler)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	uint32_t index;
+	if (!AllocateSlot(_freeSamplers, _samplerCount, MaxSamplers, "sampler", index))
+		return 0;
+	QueueWrite(SlotWrite{ SamplerBinding, index, VK_NULL_HANDLE, sampler });
+	return index;
+}
+
+void BindlessResources::RemoveSampler(uint32_t index)
+{
+	if (index == 0)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	RetireSlot(_retiredSamplers, index);
+}
+
+uint32_t BindlessResources::AddMaterial(const MetallicRougness::MaterialConstants& constants)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	uint32_t index;
+	if (!AllocateSlot(_freeMaterials, _materialCount, MaxMaterials, "material", index))
+		return 0;
+	_materials[index] = constants;
+
+	_dirtyBegin = std::min(_dirtyBegin, index);
+	_dirtyEnd = std::max(_dirtyEnd, index + 1);
+	return index;
+}
+
+void BindlessResources::RemoveMaterial(uint32_t index)
+{
+	if (index == 0)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	RetireSlot(_retiredMaterials, index);
+}
+
+void BindlessResources::UploadMaterials(VkCommandBuffer cmd)
+{
+	// the changed range is copied out, so recording doesn't hold up other threads adding textures
+	const size_t stride = sizeof(MetallicRougness::MaterialConstants);
+	std::vector<MetallicRougness::MaterialConstants> dirty;
+	size_t offset;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_dirtyBegin >= _dirtyEnd)
+			return;
+		dirty.assign(_materials.begin() + _dirtyBegin, _materials.begin() + _dirtyEnd);
+		offset = _dirtyBegin * stride;
+		_dirtyBegin = UINT32_MAX;
+		_dirtyEnd = 0;
+	}
+
+	// new materials sit in slots no frame in flight can reach, but the range may span live ones
+	// that earlier frames are still reading
+	Util::BufferBarrier(cmd, materialBuffer.buffer, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+	// vkCmdUpdateBuffer takes at most 64kb per call, which is plenty for material tables
+	constexpr size_t maxUpdate = 65536;
+	size_t written = 0;
+	size_t size = dirty.size() * stride;
+	while (written < size) {
+		size_t update = std::min(maxUpdate, size - written);
+		vkCmdUpdateBuffer(cmd, materialBuffer.buffer, offset + written, update, (const uint8_t*)dirty.data() + written);
+		written += update;
+	}
+
+	Util::BufferBarrier(cmd, materialBuffer.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "Materials.h"
+
+#include <mutex>
+
+// one descriptor set for every draw: all textures, all samplers and the material constants,
+// materials refer to them by index so nothing has to be rebound when the material changes.
+// every frame in flight binds a copy of its own, which is only written after the fence of its frame,
+// so a descriptor never changes under a pending command buffer
+struct BindlessResources {
+	static constexpr uint32_t MaxTextures = 4096;
+	static constexpr uint32_t MaxSamplers = 64;
+	static constexpr uint32_t MaxMaterials = 4096;
+
+	static constexpr uint32_t TextureBinding = 0;
+	static constexpr uint32_t SamplerBinding = 1;
+	static constexpr uint32_t MaterialBinding = 2;
+
+	VkDescriptorSetLayout layout;
+	VkDescriptorPool pool;
+	VkDescriptorSet sets[FRAME_OVERLAP];
+
+	AllocatedBuffer materialBuffer;
+
+	void Init();
+	void CleanResources();
+
+	// applies the writes queued since this frame's set was last written and recycles the slots no frame
+	// in flight can reach anymore. on the render thread, after the frame's fence wait
+	void Update(uint64_t frameNumber);
+	// the copy the frame being recorded binds
+	VkDescriptorSet GetSet() { return sets[_frameNumber % FRAME_OVERLAP]; };
+
+	// the writes are only queued, so every call may come from the loader thread while the render thread draws.
+	// removed slots are held back for FRAME_OVERLAP frames, the frames in flight may still index them.
+	// slot 0 is the shared default, a full table returns it and removing or setting it does nothing
+	uint32_t AddTexture(VkImageView view);
+	void RemoveTexture(uint32_t index);
+	// points a slot at another view of the same texture, materials using it pick it up without a rewrite
+	void SetTexture(uint32_t index, VkImageView view);
+	uint32_t AddSampler(VkSampler sampler);
+	void RemoveSampler(uint32_t index);
+	// material constants are kept on the cpu until UploadMaterials copies the changed range
+	// into the device local table
+	uint32_t AddMaterial(const MetallicRougness::MaterialConstants& constants);
+	void RemoveMaterial(uint32_t index);
+	// recorded into the frame's command buffer, ordered against the frames still reading the table
+	void UploadMaterials(VkCommandBuffer cmd);
+	// the table is allocated in full up front, so this needs no lock
+	const MetallicRougness::MaterialConstants& GetMaterial(uint32_t index) { return _materials[index]; };
+
+private:
+	struct SlotWrite {
+		uint32_t binding;
+		uint32_t index;
+		VkImageView view;
+		VkSampler sampler;
+	};
+	struct RetiredSlot {
+		uint32_t index;
+		uint64_t frameNumber;
+	};
+
+	void QueueWrite(const SlotWrite& write);
+	void RetireSlot(std::vector<RetiredSlot>& retired, uint32_t index);
+	static void ReleaseSlots(std::vector<RetiredSlot>& retired, std::vector<uint32_t>& freeSlots, uint64_t frameNumber);
+	// false when the table is full, the Add functions then hand out slot 0 without touching it
+	static bool AllocateSlot(std::vector<uint32_t>& freeSlots, uint32_t& slotCount, uint32_t maxSlots, const char* name, uint32_t& slot);
+
+	std::vector<uint32_t> _freeTextures;
+	std::vector<uint32_t> _freeSamplers;
+	std::vector<uint32_t> _freeMaterials;
+	std::vector<RetiredSlot> _retiredTextures;
+	std::vector<RetiredSlot> _retiredSamplers;
+	std::vector<RetiredSlot> _retiredMaterials;
+	uint32_t _textureCount{ 0 };
+	uint32_t _samplerCount{ 0 };
+	uint32_t _materialCount{ 0 };
+
+	std::mutex _mutex;
+	// per copy of the set, until its frame comes around again
+	std::vector<SlotWrite> _pendingWrites[FRAME_OVERLAP];
+	uint64_t _frameNumber{ 0 };
+	std::vector<MetallicRougness::MaterialConstants> _materials;
+	uint32_t _dirtyBegin{ UINT32_MAX };
+	uint32_t _dirtyEnd{ 0 };
+};
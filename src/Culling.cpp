@@ -0,0 +1,463 @@
+#include "Culling.h"
+#include "Engine.h"
+#include "Pipelines.h"
+#include "Initializers.h"
+#include "Images.h"
+
+#include <algorithm>
+#include <bit>
+
+void GPUCulling::BuildPipelines()
+{
+	VkDevice device = Engine::Get()->GetDevice();
+	VkShaderModule cullShader = Util::LoadShader("cull.comp.spv");
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(CullPushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	{
+		DescriptorLayoutBuilder builder;
+		builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		cullDescriptorLayout = builder.Build(VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+	{
+		DescriptorLayoutBuilder builder;
+		builder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		builder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		reduceDescriptorLayout = builder.Build(VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	VkPipelineLayoutCreateInfo layoutInfo = Init::PipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &cullDescriptorLayout;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	layoutInfo.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &cullLayout));
+
+	VkPipelineLayoutCreateInfo reduceLayoutInfo = Init::PipelineLayoutCreateInfo();
+	reduceLayoutInfo.setLayoutCount = 1;
+	reduceLayoutInfo.pSetLayouts = &reduceDescriptorLayout;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &reduceLayoutInfo, nullptr, &reduceLayout));
+
+	VkComputePipelineCreateInfo computePipelineInfo = { .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	computePipelineInfo.layout = cullLayout;
+	computePipelineInfo.stage = Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &cullPipeline));
+
+	VkShaderModule reduceShader = Util::LoadShader("depth_reduce.comp.spv");
+	computePipelineInfo.layout = reduceLayout;
+	computePipelineInfo.stage.module = reduceShader;
+
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &reducePipeline));
+
+	VkShaderModule clusterShader = Util::LoadShader("cluster_cull.comp.spv");
+	computePipelineInfo.layout = cullLayout;
+	computePipelineInfo.stage.module = clusterShader;
+
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &clusterPipeline));
+
+	vkDestroyShaderModule(device, cullShader, nullptr);
+	vkDestroyShaderModule(device, reduceShader, nullptr);
+	vkDestroyShaderModule(device, clusterShader, nullptr);
+
+	// an extension command, so it has to be loaded by hand
+	if (Engine::Get()->IsMeshShadingSupported())
+		drawMeshTasksIndirect = (PFN_vkCmdDrawMeshTasksIndirectEXT)vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksIndirectEXT");
+
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
+	};
+	descriptorAllocator.Init(16, sizes);
+}
+
+void GPUCulling::InitDepthPyramid(const AllocatedImage& depthImage)
+{
+	Engine* engine = Engine::Get();
+	VkDevice device = engine->GetDevice();
+
+	depthImageExtent = VkExtent2D{ depthImage.imageExtent.width, depthImage.imageExtent.height };
+
+	// power of two so every level halves exactly, the first reduction footprint covers the rest
+	VkExtent3D pyramidSize{ std::bit_floor(depthImage.imageExtent.width), std::bit_floor(depthImage.imageExtent.height), 1 };
+	depthPyramid = engine->CreateImage(pyramidSize, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true);
+	uint32_t mipCount = static_cast<uint32_t>(std::floor(std::log2(std::max(pyramidSize.width, pyramidSize.height)))) + 1;
+
+	VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	sampl.magFilter = VK_FILTER_NEAREST;
+	sampl.minFilter = VK_FILTER_NEAREST;
+	sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampl.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampl.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampl.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampl.minLod = 0;
+	sampl.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK(vkCreateSampler(device, &sampl, nullptr, &pyramidSampler));
+
+	DescriptorWriter writer;
+	for (uint32_t mip = 0; mip < mipCount; mip++) {
+		VkImageViewCreateInfo viewInfo = Init::ImageViewCreateInfo(depthPyramid.imageFormat, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		viewInfo.subresourceRange.baseMipLevel = mip;
+		viewInfo.subresourceRange.levelCount = 1;
+
+		VkImageView mipView;
+		VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &mipView));
+		pyramidMips.push_back(mipView);
+
+		// each level reads the one above it, the first one reads the depth image
+		VkDescriptorSet set = descriptorAllocator.Allocate(reduceDescriptorLayout);
+		writer.Clear();
+		writer.WriteImage(0, mipView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		if (mip == 0)
+			writer.WriteImage(1, depthImage.imageView, pyramidSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		else
+			writer.WriteImage(1, pyramidMips[mip - 1], pyramidSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		writer.UpdateSet(set);
+		reduceDescriptors.push_back(set);
+	}
+
+	cullDescriptors = descriptorAllocator.Allocate(cullDescriptorLayout);
+	writer.Clear();
+	writer.WriteImage(0, depthPyramid.imageView, pyramidSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.UpdateSet(cullDescriptors);
+}
+
+void GPUCulling::CleanResources()
+{
+	Engine* engine = Engine::Get();
+	const VkDevice device = Engine::GetMainDevice();
+	vkDestroyPipelineLayout(device, cullLayout, nullptr);
+	vkDestroyPipeline(device, cullPipeline, nullptr);
+	vkDestroyPipeline(device, clusterPipeline, nullptr);
+	vkDestroyPipelineLayout(device, reduceLayout, nullptr);
+	vkDestroyPipeline(device, reducePipeline, nullptr);
+	vkDestroyDescriptorSetLayout(device, cullDescriptorLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, reduceDescriptorLayout, nullptr);
+	descriptorAllocator.DestroyPools();
+
+	for (VkImageView view : pyramidMips) {
+		vkDestroyImageView(device, view, nullptr);
+	}
+	pyramidMips.clear();
+	engine->DestroyImage(depthPyramid);
+	vkDestroySampler(device, pyramidSampler, nullptr);
+
+	if (visibilityCapacity != 0)
+		engine->DestroyBuffer(visibilityBuffer);
+}
+
+void GPUCulling::DestroyFrame(CullingFrame& frame)
+{
+	if (frame.drawCapacity == 0)
+		return;
+
+	Engine* engine = Engine::Get();
+	engine->DestroyBuffer(frame.cullDataBuffer);
+	engine->DestroyBuffer(frame.batchBuffer);
+	engine->DestroyBuffer(frame.drawBuffer);
+	engine->DestroyBuffer(frame.countBuffer);
+	engine->DestroyBuffer(frame.readbackBuffer);
+	engine->DestroyBuffer(frame.clusterWorkBuffer);
+	frame.drawCapacity = 0;
+	frame.batchCapacity = 0;
+	frame.workCapacity = 0;
+}
+
+void GPUCulling::Reserve(CullingFrame& frame, uint32_t drawCount, uint32_t batchCount, uint32_t workCount)
+{
+	if (drawCount <= frame.drawCapacity && batchCount <= frame.batchCapacity && workCount <= frame.workCapacity)
+		return;
+
+	// the frame fence has already been waited on, so nothing is using the old buffers anymore
+	DestroyFrame(frame);
+
+	Engine* engine = Engine::Get();
+	frame.drawCapacity = std::max<uint32_t>(std::bit_ceil(drawCount), 64);
+	frame.batchCapacity = std::max<uint32_t>(std::bit_ceil(batchCount), 64);
+	frame.workCapacity = std::max<uint32_t>(std::bit_ceil(workCount), 64);
+
+	const VkBufferUsageFlags addressUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	frame.cullDataBuffer = engine->CreateBuffer(sizeof(GPUCullData), addressUsage, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	frame.batchBuffer = engine->CreateBuffer(sizeof(GPUDrawBatch) * frame.batchCapacity, addressUsage, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	// early and late passes write to separate halves of the draw and count buffers
+	frame.drawBuffer = engine->CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * frame.drawCapacity * 2,
+		addressUsage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	frame.countBuffer = engine->CreateBuffer(sizeof(GPUCullStats) + sizeof(uint32_t) * frame.batchCapacity * 2,
+		addressUsage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	frame.readbackBuffer = engine->CreateBuffer(sizeof(GPUCullStats), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+	frame.clusterWorkBuffer = engine->CreateBuffer(ClusterWorkOffset(frame, CullPass::Late) * 2,
+		addressUsage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	memset(frame.readbackBuffer.info.pMappedData, 0, sizeof(GPUCullStats));
+}
+
+void GPUCulling::ReserveVisibility(uint32_t objectCount, DeletionQueue& frameDeletionQueue)
+{
+	if (objectCount <= visibilityCapacity)
+		return;
+
+	// shared by every frame in flight, the one before this may still use the old buffer
+	Engine* engine = Engine::Get();
+	if (visibilityCapacity != 0) {
+		AllocatedBuffer oldBuffer = visibilityBuffer;
+		frameDeletionQueue.Push([=]() { Engine::Get()->DestroyBuffer(oldBuffer); });
+	}
+
+	visibilityCapacity = std::max<uint32_t>(std::bit_ceil(objectCount), 64);
+	visibilityBuffer = engine->CreateBuffer(sizeof(uint32_t) * visibilityCapacity,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	visibilityCleared = false;
+}
+
+void GPUCulling::Prepare(VkCommandBuffer cmd, CullingFrame& frame, DeletionQueue& frameDeletionQueue, const glm::mat4& viewproj,
+	const glm::vec3& cameraPosition, VkExtent2D viewportExtent, ClusterPath clusterPath, float lodScale)
+{
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+
+	frame.clusterPath = clusterPath;
+	frame.lodScale = lodScale;
+	frame.batches.clear();
+	uint32_t drawCount = 0;
+	for (const GPUScene::DrawBatch& sceneBatch : scene.GetBatches()) {
+		// meshlets drawn by mesh shaders don't take any indexed draw slots, the compute pass takes one per meshlet
+		uint32_t slots = clusterPath == ClusterPath::Compute ? sceneBatch.meshletDrawCount : sceneBatch.objectCount;
+		frame.batches.push_back(DrawBatch{ .pipeline = sceneBatch.pipeline, .indexType = sceneBatch.indexType, .drawOffset = drawCount, .drawCount = slots });
+		drawCount += slots;
+	}
+
+	frame.objectCount = scene.GetObjectCount();
+	frame.workCount = clusterPath != ClusterPath::Off ? scene.GetClusterWorkCount() : 0;
+	Reserve(frame, drawCount, (uint32_t)frame.batches.size(), frame.workCount);
+	ReserveVisibility(scene.GetObjectCapacity(), frameDeletionQueue);
+
+	GPUDrawBatch* batchData = (GPUDrawBatch*)frame.batchBuffer.info.pMappedData;
+	for (size_t i = 0; i < frame.batches.size(); i++) {
+		batchData[i].drawOffset = frame.batches[i].drawOffset;
+		batchData[i].drawCount = frame.batches[i].drawCount;
+	}
+
+	// extract the frustum planes from the rows of the view projection matrix
+	GPUCullData* cullData = (GPUCullData*)frame.cullDataBuffer.info.pMappedData;
+	glm::mat4 rows = glm::transpose(viewproj);
+	cullData->frustum[0] = rows[3] + rows[0];
+	cullData->frustum[1] = rows[3] - rows[0];
+	cullData->frustum[2] = rows[3] + rows[1];
+	cullData->frustum[3] = rows[3] - rows[1];
+	cullData->frustum[4] = rows[2];
+	cullData->frustum[5] = rows[3] - rows[2];
+	for (glm::vec4& plane : cullData->frustum) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	cullData->viewproj = viewproj;
+	cullData->pyramidSize = glm::vec4(depthPyramid.imageExtent.width, depthPyramid.imageExtent.height, pyramidMips.size(), 0.f);
+	// the viewport covers the window, which can be smaller than the depth image the pyramid was built from
+	cullData->uvScale = glm::vec4((float)viewportExtent.width / depthImageExtent.width, (float)viewportExtent.height / depthImageExtent.height, 0.f, 0.f);
+	cullData->cameraPosition = glm::vec4(cameraPosition, 1.f);
+
+	if (!pyramidReady) {
+		Util::TransitionImage(cmd, depthPyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		pyramidReady = true;
+	}
+	if (!visibilityCleared) {
+		// nothing counts as visible last frame, so the late pass picks everything up
+		vkCmdFillBuffer(cmd, visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+		visibilityCleared = true;
+	}
+
+	vkCmdFillBuffer(cmd, frame.countBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	Util::BufferBarrier(cmd, frame.countBuffer.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+	if (frame.workCount != 0) {
+		// no work items yet, a group count of 0 by 1 by 1 in front of each half
+		for (CullPass pass : { CullPass::Early, CullPass::Late }) {
+			VkDeviceSize offset = ClusterWorkOffset(frame, pass);
+			vkCmdFillBuffer(cmd, frame.clusterWorkBuffer.buffer, offset, sizeof(uint32_t), 0);
+			vkCmdFillBuffer(cmd, frame.clusterWorkBuffer.buffer, offset + sizeof(uint32_t), sizeof(uint32_t) * 2, 1);
+		}
+		Util::BufferBarrier(cmd, frame.clusterWorkBuffer.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	}
+	// also orders the visibility writes of the previous frame's cull passes before this frame's reads
+	Util::BufferBarrier(cmd, visibilityBuffer.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+}
+
+void GPUCulling::Cull(VkCommandBuffer cmd, CullingFrame& frame, CullPass pass)
+{
+	if (frame.objectCount == 0)
+		return;
+
+	Engine* engine = Engine::Get();
+	bool late = pass == CullPass::Late;
+
+	CullPushConstants pushConstants;
+	pushConstants.cullData = engine->GetBufferAddress(frame.cullDataBuffer);
+	pushConstants.sceneBuffer = engine->GetGPUScene().GetObjectBufferAddress();
+	pushConstants.drawListBuffer = engine->GetGPUScene().GetDrawListAddress();
+	pushConstants.batchBuffer = engine->GetBufferAddress(frame.batchBuffer);
+	pushConstants.drawBuffer = engine->GetBufferAddress(frame.drawBuffer);
+	pushConstants.countBuffer = engine->GetBufferAddress(frame.countBuffer);
+	pushConstants.visibilityBuffer = engine->GetBufferAddress(visibilityBuffer);
+	pushConstants.clusterWorkBuffer = engine->GetBufferAddress(frame.clusterWorkBuffer) + ClusterWorkOffset(frame, pass);
+	pushConstants.objectCount = frame.objectCount;
+	pushConstants.pass = (uint32_t)pass;
+	pushConstants.drawBase = late ? frame.drawCapacity : 0;
+	pushConstants.countBase = late ? frame.batchCapacity : 0;
+	pushConstants.lodScale = frame.lodScale;
+	pushConstants.clusterPath = (uint32_t)frame.clusterPath;
+
+	if (late) {
+		// the early pass wrote the lods it picked, the late pass has to pick the same ones
+		Util::BufferBarrier(cmd, visibilityBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	}
+	if (late && frame.clusterPath == ClusterPath::MeshShader && frame.workCount != 0) {
+		// the task shaders of the early pass counted into the same stats
+		Util::BufferBarrier(cmd, frame.countBuffer.buffer, VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout, 0, 1, &cullDescriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, (frame.objectCount + 63) / 64, 1, 1);
+
+	if (frame.workCount != 0) {
+		if (frame.clusterPath == ClusterPath::MeshShader) {
+			// the task shaders pick the work items up while drawing
+			Util::BufferBarrier(cmd, frame.clusterWorkBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+			Util::BufferBarrier(cmd, frame.countBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+		}
+		else {
+			Util::BufferBarrier(cmd, frame.clusterWorkBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+			Util::BufferBarrier(cmd, frame.countBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+			// same layout and push constants as the cull pass, one workgroup per work item
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipeline);
+			vkCmdDispatchIndirect(cmd, frame.clusterWorkBuffer.buffer, ClusterWorkOffset(frame, pass));
+		}
+	}
+
+	Util::BufferBarrier(cmd, frame.drawBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+	Util::BufferBarrier(cmd, frame.countBuffer.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+}
+
+void GPUCulling::BuildDepthPyramid(VkCommandBuffer cmd, const AllocatedImage& depthImage)
+{
+	Util::TransitionImage(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reducePipeline);
+	for (uint32_t mip = 0; mip < pyramidMips.size(); mip++) {
+		uint32_t width = std::max(depthPyramid.imageExtent.width >> mip, 1u);
+		uint32_t height = std::max(depthPyramid.imageExtent.height >> mip, 1u);
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduceLayout, 0, 1, &reduceDescriptors[mip], 0, nullptr);
+		vkCmdDispatch(cmd, (width + 15) / 16, (height + 15) / 16, 1);
+
+		// the next level reads this one
+		Util::TransitionImage(cmd, depthPyramid.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+	}
+
+	Util::TransitionImage(cmd, depthImage.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+}
+
+void GPUCulling::Draw(VkCommandBuffer cmd, CullingFrame& frame, VkDescriptorSet globalDescriptor, CullPass pass)
+{
+	if (frame.objectCount == 0)
+		return;
+
+	bool late = pass == CullPass::Late;
+	VkDeviceSize drawBase = late ? frame.drawCapacity : 0;
+	VkDeviceSize countBase = late ? frame.batchCapacity : 0;
+
+	Engine* engine = Engine::Get();
+	IndirectPushConstants pushConstants;
+	pushConstants.objectBuffer = engine->GetGPUScene().GetObjectBufferAddress();
+	VkDescriptorSet sets[] = { globalDescriptor, engine->GetBindless().GetSet() };
+
+	MaterialPipeline* lastPipeline = nullptr;
+	for (size_t i = 0; i < frame.batches.size(); i++) {
+		const DrawBatch& batch = frame.batches[i];
+		if (batch.drawCount == 0)
+			continue;
+		MaterialPipeline* pipeline = batch.pipeline;
+
+		if (pipeline != lastPipeline) {
+			lastPipeline = pipeline;
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, 2, sets, 0, nullptr);
+			vkCmdPushConstants(cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(IndirectPushConstants), &pushConstants);
+		}
+		vkCmdBindIndexBuffer(cmd, engine->GetIndexPool().GetBuffer(batch.indexType), 0, batch.indexType);
+
+		vkCmdDrawIndexedIndirectCount(cmd, frame.drawBuffer.buffer, (drawBase + batch.drawOffset) * sizeof(VkDrawIndexedIndirectCommand),
+			frame.countBuffer.buffer, sizeof(GPUCullStats) + (countBase + i) * sizeof(uint32_t), batch.drawCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	if (frame.clusterPath == ClusterPath::MeshShader && frame.workCount != 0) {
+		// every opaque material shares the one indirect pipeline, so all meshlets go out in a single draw
+		MaterialPipeline& pipeline = engine->GetMetalMaterial().meshletPipeline;
+
+		MeshletPushConstants meshletConstants;
+		meshletConstants.cullData = engine->GetBufferAddress(frame.cullDataBuffer);
+		meshletConstants.sceneBuffer = pushConstants.objectBuffer;
+		meshletConstants.drawListBuffer = engine->GetGPUScene().GetDrawListAddress();
+		meshletConstants.clusterWorkBuffer = engine->GetBufferAddress(frame.clusterWorkBuffer) + ClusterWorkOffset(frame, pass);
+		meshletConstants.countBuffer = engine->GetBufferAddress(frame.countBuffer);
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 2, sets, 0, nullptr);
+		vkCmdPushConstants(cmd, pipeline.layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshletPushConstants), &meshletConstants);
+		// the group counts in front of the work items are the draw arguments
+		drawMeshTasksIndirect(cmd, frame.clusterWorkBuffer.buffer, ClusterWorkOffset(frame, pass), 1, sizeof(VkDrawMeshTasksIndirectCommandEXT));
+	}
+}
+
+VkDeviceSize GPUCulling::ClusterWorkOffset(const CullingFrame& frame, CullPass pass)
+{
+	// the dispatch arguments take up 16 bytes in front of the items
+	return pass == CullPass::Late ? sizeof(uint32_t) * 4 + sizeof(uint32_t) * 2 * frame.workCapacity : 0;
+}
+
+void GPUCulling::CopyStats(VkCommandBuffer cmd, CullingFrame& frame)
+{
+	if (frame.objectCount == 0)
+		return;
+
+	// task shaders keep counting while the meshlets are drawn
+	VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	if (frame.clusterPath == ClusterPath::MeshShader)
+		writeStages |= VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT;
+	Util::BufferBarrier(cmd, frame.countBuffer.buffer, writeStages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+
+	// the stats are read on the cpu once this frame comes around again, so the readback never stalls
+	VkBufferCopy statsCopy{ 0 };
+	statsCopy.srcOffset = 0;
+	statsCopy.dstOffset = 0;
+	statsCopy.size = sizeof(GPUCullStats);
+	vkCmdCopyBuffer(cmd, frame.countBuffer.buffer, frame.readbackBuffer.buffer, 1, &statsCopy);
+}
+
+GPUCullStats GPUCulling::ReadStats(CullingFrame& frame)
+{
+	if (frame.drawCapacity == 0)
+		return GPUCullStats{};
+
+	vmaInvalidateAllocation(Engine::Get()->GetAllocator(), frame.readbackBuffer.allocation, 0, VK_WHOLE_SIZE);
+	return *(GPUCullStats*)frame.readbackBuffer.info.pMappedData;
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include "Render.h"
+
+struct DeletionQueue;
+
+struct GPUCullData {
+	glm::vec4 frustum[6];
+	glm::mat4 viewproj;
+	glm::vec4 pyramidSize; // xy for the size in texels, z for the mip count
+	glm::vec4 uvScale; // xy maps the viewport into the depth pyramid
+	glm::vec4 cameraPosition; // for the meshlet cone test
+};
+
+struct GPUDrawBatch {
+	uint32_t drawOffset;
+	uint32_t drawCount;
+};
+
+// written by the cull shader in front of the per batch draw counts
+struct GPUCullStats {
+	uint32_t drawn;
+	uint32_t culled;
+	uint32_t triangles;
+	uint32_t occluded;
+	uint32_t clustersCulled;
+};
+
+enum class CullPass : uint32_t {
+	Frustum, // frustum test only, single pass
+	Early, // draws what was visible last frame
+	Late // tests everything else against the depth pyramid built from the early pass
+};
+
+// how objects drawn at lod 0 get their meshlets culled
+enum class ClusterPath : uint32_t {
+	Off, // drawn whole like every other lod
+	Compute, // a compute pass culls the meshlets and writes one indirect draw per visible one
+	MeshShader // task shaders cull the meshlets and mesh shaders draw them, needs VK_EXT_mesh_shader
+};
+
+struct CullPushConstants {
+	VkDeviceAddress cullData;
+	VkDeviceAddress sceneBuffer;
+	VkDeviceAddress drawListBuffer;
+	VkDeviceAddress batchBuffer;
+	VkDeviceAddress drawBuffer;
+	VkDeviceAddress countBuffer;
+	VkDeviceAddress visibilityBuffer;
+	VkDeviceAddress clusterWorkBuffer;
+	uint32_t objectCount;
+	uint32_t pass;
+	uint32_t drawBase;
+	uint32_t countBase;
+	// projected size to pixels for the lod pick, 0 keeps everything at lod 0
+	float lodScale;
+	uint32_t clusterPath;
+};
+
+// the objects of one gpu scene batch, drawn with one indirect count call
+struct DrawBatch {
+	MaterialPipeline* pipeline;
+	VkIndexType indexType;
+	// draw command slots, one per object or one per meshlet of objects drawn by the compute cluster pass
+	uint32_t drawOffset;
+	uint32_t drawCount;
+};
+
+struct CullingFrame {
+	AllocatedBuffer cullDataBuffer;
+	AllocatedBuffer batchBuffer;
+	AllocatedBuffer drawBuffer;
+	AllocatedBuffer countBuffer;
+	AllocatedBuffer readbackBuffer;
+	// dispatch arguments and work items of the cluster pass, one half per cull pass
+	AllocatedBuffer clusterWorkBuffer;
+
+	uint32_t drawCapacity{ 0 };
+	uint32_t batchCapacity{ 0 };
+	uint32_t workCapacity{ 0 };
+	// gpu scene ids the cull pass runs over
+	uint32_t objectCount{ 0 };
+	// work items if every object was visible, 0 when nothing is culled per meshlet
+	uint32_t workCount{ 0 };
+	ClusterPath clusterPath{ ClusterPath::Off };
+	float lodScale{ 0.f };
+	std::vector<DrawBatch> batches;
+};
+
+struct GPUCulling {
+	// meshlets tested by one cluster workgroup, matches MESHLETS_PER_ITEM in the shaders
+	static constexpr uint32_t MeshletsPerWorkItem = 32;
+
+	VkPipeline cullPipeline;
+	// shares the layout of the cull pipeline
+	VkPipeline clusterPipeline;
+	PFN_vkCmdDrawMeshTasksIndirectEXT drawMeshTasksIndirect{ nullptr };
+	VkPipelineLayout cullLayout;
+	VkDescriptorSetLayout cullDescriptorLayout;
+	VkDescriptorSet cullDescriptors;
+
+	VkPipeline reducePipeline;
+	VkPipelineLayout reduceLayout;
+	VkDescriptorSetLayout reduceDescriptorLayout;
+
+	// min reduced depth, so each texel holds the farthest depth under it with reverse z
+	AllocatedImage depthPyramid;
+	std::vector<VkImageView> pyramidMips;
+	std::vector<VkDescriptorSet> reduceDescriptors;
+	VkSampler pyramidSampler;
+	VkExtent2D depthImageExtent;
+	bool pyramidReady{ false };
+
+	// one entry per gpu scene object id. bit 0 for whether it passed the late cull of the previous frame,
+	// the lod the cull pass picked for it last above that
+	AllocatedBuffer visibilityBuffer;
+	uint32_t visibilityCapacity{ 0 };
+	bool visibilityCleared{ false };
+
+	DescriptorAllocatorGrowable descriptorAllocator;
+
+	void BuildPipelines();
+	void InitDepthPyramid(const AllocatedImage& depthImage);
+	void CleanResources();
+	void DestroyFrame(CullingFrame& frame);
+
+	// lays the gpu scene batches out in the frame's draw buffer, must run outside of rendering and after the gpu scene upload.
+	// the draw list itself stays in the gpu scene, nothing per object is written here.
+	// buffers shared by the frames in flight are replaced through the frame's deletion queue
+	void Prepare(VkCommandBuffer cmd, CullingFrame& frame, DeletionQueue& frameDeletionQueue, const glm::mat4& viewproj,
+		const glm::vec3& cameraPosition, VkExtent2D viewportExtent, ClusterPath clusterPath, float lodScale);
+	// records the cull dispatch of one pass and its cluster pass, must run outside of rendering
+	void Cull(VkCommandBuffer cmd, CullingFrame& frame, CullPass pass);
+	// reduces the depth image into the pyramid, expects it in depth attachment layout and leaves it there
+	void BuildDepthPyramid(VkCommandBuffer cmd, const AllocatedImage& depthImage);
+	// records one indirect count draw per batch, must run inside of rendering
+	void Draw(VkCommandBuffer cmd, CullingFrame& frame, VkDescriptorSet globalDescriptor, CullPass pass);
+	// copies the stats of every pass for ReadStats, must run outside of rendering and after the last Draw
+	void CopyStats(VkCommandBuffer cmd, CullingFrame& frame);
+	// results of the last cull recorded for this frame, only valid after its fence has been waited on
+	GPUCullStats ReadStats(CullingFrame& frame);
+
+private:
+	void Reserve(CullingFrame& frame, uint32_t drawCount, uint32_t batchCount, uint32_t workCount);
+	void ReserveVisibility(uint32_t objectCount, DeletionQueue& frameDeletionQueue);
+	VkDeviceSize ClusterWorkOffset(const CullingFrame& frame, CullPass pass);
+};
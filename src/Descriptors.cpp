@@ -2,11 +2,11 @@
 #include "Engine.h"
 
 
-void DescriptorLayoutBuilder::AddBinding(uint32_t binding, VkDescriptorType type)
+void DescriptorLayoutBuilder::AddBinding(uint32_t binding, VkDescriptorType type, uint32_t count)
 {
 	VkDescriptorSetLayoutBinding newBind{};
 	newBind.binding = binding;
-	newBind.descriptorCount = 1;
+	newBind.descriptorCount = count;
 	newBind.descriptorType = type;
 
 	bindings.push_back(newBind);
@@ -193,7 +193,7 @@ VkDescriptorPool DescriptorAllocatorGrowable::CreatePool(uint32_t setCount, std:
 	return newPool;
 }
 
-void DescriptorWriter::WriteImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type)
+void DescriptorWriter::WriteImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement)
 {
 	VkDescriptorImageInfo& info = imageInfos.emplace_back(VkDescriptorImageInfo{
 		.sampler = sampler,
@@ -204,6 +204,7 @@ void DescriptorWriter::WriteImage(int binding, VkImageView image, VkSampler samp
 	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
 
 	write.dstBinding = binding;
+	write.dstArrayElement = arrayElement;
 	write.dstSet = VK_NULL_HANDLE; //left empty for now until we need to write it
 	write.descriptorCount = 1;
 	write.descriptorType = type;
@@ -212,7 +213,7 @@ void DescriptorWriter::WriteImage(int binding, VkImageView image, VkSampler samp
 	writes.push_back(write);
 }
 
-void DescriptorWriter::WriteBuffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type)
+void DescriptorWriter::WriteBuffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type, uint32_t arrayElement)
 {
 	VkDescriptorBufferInfo& info = bufferInfos.emplace_back(VkDescriptorBufferInfo{
 		.buffer = buffer,
@@ -223,6 +224,7 @@ void DescriptorWriter::WriteBuffer(int binding, VkBuffer buffer, size_t size, si
 	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
 
 	write.dstBinding = binding;
+	write.dstArrayElement = arrayElement;
 	write.dstSet = VK_NULL_HANDLE; //left empty for now until we need to write it
 	write.descriptorCount = 1;
 	write.descriptorType = type;
@@ -4,7 +4,7 @@ struct DescriptorLayoutBuilder {
 
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-	void AddBinding(uint32_t binding, VkDescriptorType type);
+	void AddBinding(uint32_t binding, VkDescriptorType type, uint32_t count = 1);
 	void Clear();
 	VkDescriptorSetLayout Build(VkShaderStageFlags shaderStages, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
 };
@@ -53,8 +53,8 @@ struct DescriptorWriter {
 	std::deque<VkDescriptorBufferInfo> bufferInfos;
 	std::vector<VkWriteDescriptorSet> writes;
 
-	void WriteImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type);
-	void WriteBuffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type);
+	void WriteImage(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement = 0);
+	void WriteBuffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type, uint32_t arrayElement = 0);
 
 	void Clear();
 	void UpdateSet(VkDescriptorSet set);
@@ -0,0 +1,194 @@
+#include "DrawSort.h"
+#include "Engine.h"
+
+#include <cstring>
+#include <numeric>
+
+// opaque key layout, most significant first: pipeline 8 | index type 16 | material 16 | surface 12 | depth 12
+// transparent key layout: depth 24 | pipeline 8 | index type 16 | material 16
+// materials are bindless and cost nothing to switch, so they sort below the index type. every mesh's
+// indices live in the pool buffer of its type, so the type picks the index buffer
+constexpr uint32_t PipelineBits = 8;
+constexpr uint32_t MaterialBits = 16;
+constexpr uint32_t IndexBufferBits = 16;
+constexpr uint32_t SurfaceBits = 12;
+constexpr uint32_t DepthBits = 24;
+constexpr uint32_t OpaqueDepthBits = 12;
+constexpr uint64_t StateBits = PipelineBits + MaterialBits + IndexBufferBits;
+
+constexpr uint32_t RadixBits = 8;
+constexpr uint32_t RadixSize = 1 << RadixBits;
+// below this a single thread is faster than splitting the work
+constexpr size_t ParallelSortThreshold = 4096;
+
+uint32_t DrawSorter::GetId(std::unordered_map<const void*, uint32_t>& ids, const void* handle)
+{
+	auto it = ids.find(handle);
+	if (it != ids.end())
+		return it->second;
+
+	uint32_t id = (uint32_t)ids.size();
+	ids[handle] = id;
+	return id;
+}
+
+uint64_t DrawSorter::StateKey(const RenderObject& r, GPUScene& scene)
+{
+	// ids past the field width wrap around, which only costs some extra binds
+	uint64_t pipeline = GetId(_pipelineIds, scene.GetMaterial(r.materialId)->pipeline) & ((1ull << PipelineBits) - 1);
+	uint64_t material = GetId(_materialIds, (const void*)(uintptr_t)r.materialId) & ((1ull << MaterialBits) - 1);
+	uint64_t indexBuffer = scene.GetMesh(r.meshId).indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+	return (pipeline << (IndexBufferBits + MaterialBits)) | (indexBuffer << MaterialBits) | material;
+}
+
+uint32_t DrawSorter::DepthKey(const RenderObject& r, const glm::mat4& view, GPUScene& scene)
+{
+	glm::vec3 origin = scene.GetMesh(r.meshId).bounds.origin;
+	glm::vec4 center = view * glm::vec4(TransformPoint(scene.GetObject(r.objectId).transform, origin), 1.f);
+	float distance = std::max(-center.z, 0.f);
+
+	// positive floats sort the same as their bits, keep the top ones
+	uint32_t bits;
+	memcpy(&bits, &distance, sizeof(float));
+	return bits >> (32 - DepthBits);
+}
+
+void DrawSorter::SortOpaque(const std::vector<RenderObject>& objects, const glm::mat4& view, std::vector<uint32_t>& order)
+{
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+
+	_items.resize(objects.size());
+	for (uint32_t i = 0; i < objects.size(); i++) {
+		// same surface next to each other so the draws can be merged into instances
+		uint64_t surface = GetId(_surfaceIds, (const void*)(((uintptr_t)objects[i].meshId << 3) | objects[i].lod)) & ((1ull << SurfaceBits) - 1);
+		uint64_t key = (StateKey(objects[i], scene) << (SurfaceBits + OpaqueDepthBits)) | (surface << OpaqueDepthBits);
+		key |= DepthKey(objects[i], view, scene) >> (DepthBits - OpaqueDepthBits);
+		_items[i] = SortItem{ key, i };
+	}
+
+	RadixSort(_items, _scratch);
+
+	order.resize(_items.size());
+	for (uint32_t i = 0; i < _items.size(); i++) {
+		order[i] = _items[i].index;
+	}
+}
+
+void DrawSorter::SortTransparent(const std::vector<RenderObject>& objects, const glm::mat4& view, std::vector<uint32_t>& order)
+{
+	constexpr uint32_t depthMask = (1u << DepthBits) - 1;
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+
+	_items.resize(objects.size());
+	for (uint32_t i = 0; i < objects.size(); i++) {
+		uint64_t farFirst = depthMask - DepthKey(objects[i], view, scene);
+		_items[i] = SortItem{ (farFirst << StateBits) | StateKey(objects[i], scene), i };
+	}
+
+	RadixSort(_items, _scratch);
+
+	order.resize(_items.size());
+	for (uint32_t i = 0; i < _items.size(); i++) {
+		order[i] = _items[i].index;
+	}
+}
+
+void DrawSorter::RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+{
+	size_t count = items.size();
+	if (count < 2)
+		return;
+	scratch.resize(count);
+
+	JobSystem& jobs = Engine::Get()->GetJobSystem();
+	uint32_t chunkCount = count < ParallelSortThreshold ? 1 : jobs.GetWorkerCount() + 1;
+	size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	// digits that are the same for every key don't need a pass
+	std::vector<uint64_t> chunkDiffs(chunkCount, 0);
+	jobs.ParallelFor(chunkCount, [&](uint32_t chunk) {
+		size_t end = std::min(count, (chunk + 1) * chunkSize);
+		uint64_t diff = 0;
+		for (size_t i = chunk * chunkSize; i < end; i++) {
+			diff |= items[i].key ^ items[0].key;
+		}
+		chunkDiffs[chunk] = diff;
+		});
+	uint64_t diff = 0;
+	for (uint64_t d : chunkDiffs) {
+		diff |= d;
+	}
+
+	std::vector<std::array<uint32_t, RadixSize>> histograms(chunkCount);
+	SortItem* src = items.data();
+	SortItem* dst = scratch.data();
+
+	for (uint32_t shift = 0; shift < 64; shift += RadixBits) {
+		if (((diff >> shift) & (RadixSize - 1)) == 0)
+			continue;
+
+		jobs.ParallelFor(chunkCount, [&](uint32_t chunk) {
+			std::array<uint32_t, RadixSize>& histogram = histograms[chunk];
+			histogram.fill(0);
+			size_t end = std::min(count, (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < end; i++) {
+				histogram[(src[i].key >> shift) & (RadixSize - 1)]++;
+			}
+			});
+
+		// turn the counts into write offsets, earlier chunks go first within a digit to keep it stable
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < RadixSize; digit++) {
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+				uint32_t digitCount = histograms[chunk][digit];
+				histograms[chunk][digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		jobs.ParallelFor(chunkCount, [&](uint32_t chunk) {
+			std::array<uint32_t, RadixSize>& offsets = histograms[chunk];
+			size_t end = std::min(count, (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < end; i++) {
+				dst[offsets[(src[i].key >> shift) & (RadixSize - 1)]++] = src[i];
+			}
+			});
+
+		std::swap(src, dst);
+	}
+
+	if (src != items.data())
+		items.swap(scratch);
+}
+
+BindCounts DrawSorter::CountBinds(const std::vector<RenderObject>& objects, const std::vector<uint32_t>& order)
+{
+	BindCounts counts{};
+	MaterialPipeline* pipeline = nullptr;
+	VkIndexType indexType = VK_INDEX_TYPE_MAX_ENUM;
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+
+	for (uint32_t i : order) {
+		const RenderObject& r = objects[i];
+		MaterialPipeline* objectPipeline = scene.GetMaterial(r.materialId)->pipeline;
+		VkIndexType objectIndexType = scene.GetMesh(r.meshId).indexType;
+		// the scene and bindless sets are rebound together with the pipeline
+		if (objectPipeline != pipeline) {
+			pipeline = objectPipeline;
+			counts.pipeline++;
+			counts.descriptor++;
+		}
+		if (objectIndexType != indexType) {
+			indexType = objectIndexType;
+			counts.indexBuffer++;
+		}
+	}
+	return counts;
+}
+
+BindCounts DrawSorter::CountBinds(const std::vector<RenderObject>& objects)
+{
+	std::vector<uint32_t> order(objects.size());
+	std::iota(order.begin(), order.end(), 0);
+	return CountBinds(objects, order);
+}
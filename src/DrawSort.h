@@ -0,0 +1,46 @@
+#pragma once
+#include "Render.h"
+#include "GPUScene.h"
+
+#include <unordered_map>
+
+struct BindCounts {
+	int pipeline;
+	int descriptor;
+	int indexBuffer;
+};
+
+// orders render objects by a packed 64 bit key so that draws sharing state end up next to each other
+class DrawSorter
+{
+public:
+	struct SortItem {
+		uint64_t key;
+		uint32_t index;
+	};
+
+	// opaque: pipeline, index type, material, surface, then front to back
+	// transparent: back to front, then the same state as opaque to break ties
+	void SortOpaque(const std::vector<RenderObject>& objects, const glm::mat4& view, std::vector<uint32_t>& order);
+	void SortTransparent(const std::vector<RenderObject>& objects, const glm::mat4& view, std::vector<uint32_t>& order);
+
+	// stable lsd radix sort, histograms and scatters are split across the job system
+	static void RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch);
+	// how many binds drawing the objects in this order would take, with the same caching as Engine::DrawGeometry
+	static BindCounts CountBinds(const std::vector<RenderObject>& objects, const std::vector<uint32_t>& order);
+	static BindCounts CountBinds(const std::vector<RenderObject>& objects);
+
+private:
+	uint64_t StateKey(const RenderObject& r, GPUScene& scene);
+	static uint32_t DepthKey(const RenderObject& r, const glm::mat4& view, GPUScene& scene);
+	static uint32_t GetId(std::unordered_map<const void*, uint32_t>& ids, const void* handle);
+
+	// ids are handed out on first sight and kept, so the order of equal state doesn't change between frames
+	std::unordered_map<const void*, uint32_t> _pipelineIds;
+	std::unordered_map<const void*, uint32_t> _materialIds;
+	// keyed by mesh id and lod, so only draws of the same index range end up next to each other
+	std::unordered_map<const void*, uint32_t> _surfaceIds;
+
+	std::vector<SortItem> _items;
+	std::vector<SortItem> _scratch;
+};
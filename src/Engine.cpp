@@ -10,6 +10,8 @@
 #include <SDL_image.h>
 #include <chrono>
 #include <thread>
+#include <bit>
+#include <cfloat>
 #include <VkBootstrap.h>
 #include <vk_mem_alloc.h>
 #include <imgui.h>
@@ -25,46 +27,11 @@ false;
 #endif
 
 MaterialPipeline* lastPipeline = nullptr;
-MaterialInstance* lastMaterial = nullptr;
 VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
 
 Engine* _loadedEngine = nullptr;
 
 
-bool IsVisible(const RenderObject& obj, const glm::mat4& viewproj) {
-	std::array<glm::vec3, 8> corners{
-		glm::vec3 { 1, 1, 1 },
-		glm::vec3 { 1, 1, -1 },
-		glm::vec3 { 1, -1, 1 },
-		glm::vec3 { 1, -1, -1 },
-		glm::vec3 { -1, 1, 1 },
-		glm::vec3 { -1, 1, -1 },
-		glm::vec3 { -1, -1, 1 },
-		glm::vec3 { -1, -1, -1 },
-	};
-
-	glm::mat4 matrix = viewproj * obj.transform;
-
-	glm::vec3 min = { 1.5, 1.5, 1.5 };
-	glm::vec3 max = { -1.5, -1.5, -1.5 };
-
-	for (int c = 0; c < 8; c++) {
-		// project each corner into clip space
-		glm::vec4 v = matrix * glm::vec4(obj.bounds.origin + (corners[c] * obj.bounds.extents), 1.f);
-
-		v.x = v.x / v.w;
-		v.y = v.y / v.w;
-		v.z = v.z / v.w;
-
-		min = glm::min(glm::vec3{ v.x, v.y, v.z }, min);
-		max = glm::max(glm::vec3{ v.x, v.y, v.z }, max);
-	}
-
-	if (min.z > 1.f || max.z < 0.f || min.x > 1.f || max.x < -1.f || min.y > 1.f || max.y < -1.f) 
-		return false;
-
-	return true;
-}
 Engine* Engine::Get() { return _loadedEngine; }
 
 const VkDevice& Engine::GetMainDevice()
@@ -106,6 +73,8 @@ void Engine::Init()
 		return;
 	}
 
+	_jobSystem.Init();
+
 	InitVulkan();
 	InitSwapchain();
 	InitCommands();
@@ -113,6 +82,8 @@ void Engine::Init()
 	InitDescriptors();
 	InitPipelines();
 	InitImGui();
+	_textureStreamer.Init();
+	_sceneLoader.Init();
 	InitDefaultData();
 
 	_isInitialized = true;
@@ -159,12 +130,81 @@ void Engine::Run()
 
 }
 
+void Engine::BenchmarkLoad(std::string_view filePath, uint32_t runs)
+{
+	// the startup scene would otherwise load on top of the timed runs, and every run would share
+	// its images and meshes
+	_sceneLoader.Finish();
+	vkDeviceWaitIdle(_device);
+	_loadedScenes.clear();
+
+	// best of a few runs per mode with the default settings, the first load also warms up the file cache.
+	// the importer itself is timed, not the cooked copy
+	auto timeLoad = [&](bool parallel, uint64_t& hash) {
+		GLTFLoadOptions options;
+		options.parallel = parallel;
+		options.useCache = false;
+		float best = FLT_MAX;
+		for (uint32_t i = 0; i < runs; i++) {
+			// the last run's scene is gone, but nothing may be shared with the next one either
+			_assetRegistry.ForgetAll();
+			auto start = std::chrono::system_clock::now();
+			auto file = LoadedGLTF::Load(filePath, options);
+			auto end = std::chrono::system_clock::now();
+			if (!file.has_value())
+				return -1.f;
+			best = std::min(best, std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f);
+		}
+
+		// hashing changes what is decoded and kept, so it gets a load of its own outside the timing
+		_assetRegistry.ForgetAll();
+		options.hashContents = true;
+		auto file = LoadedGLTF::Load(filePath, options);
+		if (!file.has_value())
+			return -1.f;
+		hash = (*file)->GetContentHash();
+		return best;
+	};
+
+	uint64_t serialHash = 0, parallelHash = 0;
+	float serialTime = timeLoad(false, serialHash);
+	float parallelTime = timeLoad(true, parallelHash);
+	if (serialTime < 0.f || parallelTime < 0.f) {
+		fmt::println("Load benchmark: failed to load {}", filePath);
+		return;
+	}
+
+	fmt::println("Load benchmark: {}", filePath);
+	fmt::println("  serial {:.1f} ms, parallel {:.1f} ms with {} workers, {:.2f}x", serialTime, parallelTime, _jobSystem.GetWorkerCount(), serialTime / parallelTime);
+	fmt::println("  content hash {:016x} / {:016x}, {}", serialHash, parallelHash, serialHash == parallelHash ? "identical" : "MISMATCH");
+}
+
+void Engine::Cook(std::string_view filePath, const GLTFLoadOptions& options)
+{
+	_sceneLoader.Finish();
+
+	// the cooked copy holds bc blocks, which this device couldn't upload
+	if (!_textureCompressionBCSupported) {
+		fmt::println("Cook: needs bc texture compression");
+		return;
+	}
+
+	GLTFLoadOptions cookOptions = options;
+	cookOptions.useCache = true;
+	cookOptions.cook = true;
+	if (!LoadedGLTF::Load(filePath, cookOptions).has_value())
+		fmt::println("Cook: failed to load {}", filePath);
+}
+
 void Engine::Cleanup()
 {
 	if (_isInitialized)
 	{
+		// the loader may still be submitting, it has to be out of the way before the queue goes idle
+		_sceneLoader.Shutdown();
 		vkDeviceWaitIdle(_device);
 		_loadedScenes.clear();
+		_textureStreamer.Shutdown();
 
 		for (int i = 0; i < FRAME_OVERLAP; i++)
 		{
@@ -174,11 +214,15 @@ void Engine::Cleanup()
 			vkDestroySemaphore(_device, _frames[i].renderSemaphore, nullptr);
 			vkDestroySemaphore(_device, _frames[i].swapchainSemaphore, nullptr);
 			_frames[i].deletionQueue.Flush();
+			_gpuCulling.DestroyFrame(_frames[i].culling);
+			if (_frames[i].instanceCapacity != 0)
+				DestroyBuffer(_frames[i].instanceBuffer);
 		}
 		for (auto& mesh : _testMeshes)
 		{
-			DestroyBuffer(mesh->meshBuffers.indexBuffer);
-			DestroyBuffer(mesh->meshBuffers.vertexBuffer);
+			_indexPool.Free(mesh->meshBuffers.indices);
+			if (mesh->meshBuffers.vertexBufferAddress != 0)
+				DestroyBuffer(mesh->meshBuffers.vertexBuffer);
 		}
 		_mainDeletionQueue.Flush();
 		DestroySwapchain();
@@ -189,6 +233,7 @@ void Engine::Cleanup()
 		IMG_Quit();
 		SDL_DestroyWindow(_window);
 		SDL_Quit();
+		_jobSystem.Shutdown();
 	}
 	_loadedEngine = nullptr;
 }
@@ -214,16 +259,42 @@ void Engine::InitVulkan()
 	VkPhysicalDeviceVulkan12Features features12{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
 	features12.bufferDeviceAddress = true;
 	features12.descriptorIndexing = true;
+	features12.runtimeDescriptorArray = true;
+	features12.descriptorBindingPartiallyBound = true;
+	features12.descriptorBindingSampledImageUpdateAfterBind = true;
+	features12.shaderSampledImageArrayNonUniformIndexing = true;
+	features12.drawIndirectCount = true;
+
+	VkPhysicalDeviceFeatures features10{};
+	features10.drawIndirectFirstInstance = true;
+	// mip generation writes every color format through one shader, picking the level at runtime
+	features10.shaderStorageImageWriteWithoutFormat = true;
+	features10.shaderStorageImageArrayDynamicIndexing = true;
 
 	vkb::PhysicalDeviceSelector selector{ vkbInstance };
 	vkb::PhysicalDevice physicalDevice = selector
 		.set_minimum_version(1, 3)
 		.set_required_features_13(features)
 		.set_required_features_12(features12)
+		.set_required_features(features10)
 		.set_surface(_surface)
 		.select()
 		.value();
 
+	// optional, culled meshlets fall back to compute and indirect draws without it
+	VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+	meshShaderFeatures.taskShader = true;
+	meshShaderFeatures.meshShader = true;
+	_meshShadingSupported = physicalDevice.enable_extension_if_present(VK_EXT_MESH_SHADER_EXTENSION_NAME)
+		&& physicalDevice.enable_extension_features_if_present(meshShaderFeatures);
+	fmt::println("Mesh shaders {}", _meshShadingSupported ? "supported" : "not supported, using compute cluster culling");
+
+	// optional too, images stay rgba8 without it
+	VkPhysicalDeviceFeatures compressionFeatures{};
+	compressionFeatures.textureCompressionBC = true;
+	_textureCompressionBCSupported = physicalDevice.enable_features_if_present(compressionFeatures);
+	fmt::println("BC texture compression {}", _textureCompressionBCSupported ? "supported" : "not supported, uploading rgba8");
+
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 	vkb::Device vkbDevice = deviceBuilder.build().value();
 	_device = vkbDevice.device;
@@ -273,6 +344,8 @@ void Engine::InitSwapchain()
 	_depthImage.imageExtent = drawImageExtent;
 	VkImageUsageFlags depthImageUsages{};
 	depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	// read by the depth pyramid reduction
+	depthImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	VkImageCreateInfo dimgInfo = Init::ImageCreateInfo(_depthImage.imageFormat, depthImageUsages, drawImageExtent);
 	vmaCreateImage(_allocator, &dimgInfo, &imgAllocInfo, &_depthImage.image, &_depthImage.allocation, nullptr);
@@ -354,6 +427,11 @@ void Engine::InitDescriptors()
 		builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 		_singleImageDescriptorLayout = builder.Build(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
+	_bindless.Init();
+	_mainDeletionQueue.Push([&]() {
+		_bindless.CleanResources();
+		});
+
 	_drawImageDescriptors = _descriptorAllocator.Allocate(_drawImageDescriptorLayout);
 
 	DescriptorWriter writer;
@@ -393,9 +471,16 @@ void Engine::InitPipelines()
 {
 	InitBackgroundPipelines();
 	_metalRoughMat.BuildPipelines();
+	_gpuCulling.BuildPipelines();
+	_gpuCulling.InitDepthPyramid(_depthImage);
+	_gpuScene.BuildPipelines();
+	_mipGenerator.BuildPipelines();
 	_mainDeletionQueue.Push([&]()
 		{
 			_metalRoughMat.CleanResources();
+			_gpuCulling.CleanResources();
+			_gpuScene.CleanResources();
+			_mipGenerator.CleanResources();
 		});
 }
 
@@ -523,6 +608,12 @@ void Engine::InitImGui()
 
 void Engine::InitDefaultData()
 {	
+	// every mesh uploaded from here on takes its indices from the pool
+	_indexPool.Init();
+	_mainDeletionQueue.Push([&]() {
+		_indexPool.CleanResources();
+		});
+
 	//3 default textures, white, grey, black. 1 pixel each
 	uint32_t white = glm::packUnorm4x8(glm::vec4(1, 1, 1, 1));
 	_whiteImage = CreateImage((void*)&white, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
@@ -558,15 +649,30 @@ void Engine::InitDefaultData()
 	sampl.minFilter = VK_FILTER_LINEAR;
 	vkCreateSampler(_device, &sampl, nullptr, &_defaultSamplerLinear);
 
+	// slot 0 of every bindless table is a default that anything missing falls back to
+	_bindless.AddTexture(_whiteImage.imageView);
+	_bindless.AddSampler(_defaultSamplerLinear);
+
+	MetallicRougness::MaterialConstants defaultConstants{};
+	defaultConstants.colorFactors = glm::vec4(1.f);
+	defaultConstants.metallicFactor = 1.f;
+	defaultConstants.roughnessFactor = 0.5f;
+	defaultConstants.normalScale = 1.f;
+	_bindless.AddMaterial(defaultConstants);
+
 	
 	_camera.SetVelocity(glm::vec3(0.f));
 	_camera.SetPosition(glm::vec3(30.f, -00.f, -085.f));
 	_camera.SetPitch(0.f);
 	_camera.SetYaw(0.f);
 
-	auto structureFile = LoadedGLTF::Load("../../../assets/structure.glb");
-	assert(structureFile.has_value());
-	_loadedScenes["structure"] = *structureFile;
+	// nothing in the structure moves
+	GLTFLoadOptions structureOptions;
+	structureOptions.mergeStaticGeometry = true;
+	// loads while the first frames render, drawn as soon as its geometry is in
+	_sceneLoader.LoadAsync("../../../assets/structure.glb", structureOptions, [this](const std::shared_ptr<LoadedGLTF>& scene) {
+		_loadedScenes["structure"] = scene;
+		});
 
 	_mainDeletionQueue.Push([&]() {
 		vkDestroySampler(_device, _defaultSamplerNearest, nullptr);
@@ -581,11 +687,24 @@ void Engine::InitDefaultData()
 
 void Engine::Draw()
 {
-	UpdateScene();
 	// Wait until GPU has finished rendering the last frame
 	VK_CHECK(vkWaitForFences(_device, 1, &GetCurrentFrame().renderFence, true, 1000000000)); // Timeout of 1 second
 	GetCurrentFrame().deletionQueue.Flush();
 	GetCurrentFrame().descriptors.ClearPools();
+	// after the fence, so whatever the loader hands over lands in this frame's copy of the bindless set
+	UpdateScene();
+	// no pending command buffer binds this frame's copy of the bindless set anymore
+	_bindless.Update(_frameNumber);
+	_indexPool.Update(_frameNumber);
+
+	if (_useGPUCulling) {
+		GPUCullStats cullStats = _gpuCulling.ReadStats(GetCurrentFrame().culling);
+		_stats.visibleCount = cullStats.drawn;
+		_stats.culledCount = cullStats.culled;
+		_stats.occludedCount = cullStats.occluded;
+		_stats.gpuTriangleCount = cullStats.triangles;
+		_stats.clusterCulledCount = cullStats.clustersCulled;
+	}
 
 	VK_CHECK(vkResetFences(_device, 1, &GetCurrentFrame().renderFence));
 
@@ -606,6 +725,9 @@ void Engine::Draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	// materials added since the last frame, ahead of every draw that could read them
+	_bindless.UploadMaterials(cmd);
+
 	// Make the swapchain image into writeable mode before rendering
 	Util::TransitionImage(cmd, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
 
@@ -632,7 +754,9 @@ void Engine::Draw()
 	auto signalInfo = Init::SemaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, GetCurrentFrame().renderSemaphore);
 	auto submitInfo = Init::SubmitInfo(&cmdInfo, &signalInfo, &waitInfo);
 
+	std::unique_lock<std::mutex> queueLock(_queueMutex);
 	VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submitInfo, GetCurrentFrame().renderFence));
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.pNext = nullptr;
@@ -644,6 +768,7 @@ void Engine::Draw()
 
 	presentInfo.pImageIndices = &swapchainImageIndex;
 	VkResult presentResult = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+	queueLock.unlock();
 	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR)
 		_resizeRequested = true;
 	_frameNumber++;
@@ -680,12 +805,79 @@ void Engine::DrawGeometry(VkCommandBuffer cmd)
 	_stats.triangleCount = 0;
 
 	auto start = std::chrono::system_clock::now();
+	// the gpu path keeps its draw list in the gpu scene, only the cpu recorded draws are sorted
 	std::vector<uint32_t> opaqueDraws;
-	for (int i = 0; i < _drawContext.opaqueSurfaces.size(); i++) {
-		//if (IsVisible(_drawContext.opaqueSurfaces[i], _sceneData.viewproj)) {
-			opaqueDraws.push_back(i);
-		//}
+	std::vector<uint32_t> transparentDraws;
+	if (!_useGPUCulling)
+		_drawSorter.SortOpaque(_drawContext.opaqueSurfaces, _sceneData.view, opaqueDraws);
+	_drawSorter.SortTransparent(_drawContext.transparentSurfaces, _sceneData.view, transparentDraws);
+
+	// binds of the cpu recorded draws, in traversal order against sorted order
+	_stats.unsortedBinds = DrawSorter::CountBinds(_drawContext.transparentSurfaces);
+	_stats.sortedBinds = DrawSorter::CountBinds(_drawContext.transparentSurfaces, transparentDraws);
+	if (!_useGPUCulling) {
+		BindCounts unsorted = DrawSorter::CountBinds(_drawContext.opaqueSurfaces);
+		BindCounts sorted = DrawSorter::CountBinds(_drawContext.opaqueSurfaces, opaqueDraws);
+		_stats.unsortedBinds.pipeline += unsorted.pipeline;
+		_stats.unsortedBinds.descriptor += unsorted.descriptor;
+		_stats.unsortedBinds.indexBuffer += unsorted.indexBuffer;
+		_stats.sortedBinds.pipeline += sorted.pipeline;
+		_stats.sortedBinds.descriptor += sorted.descriptor;
+		_stats.sortedBinds.indexBuffer += sorted.indexBuffer;
+	}
+
+	FrameData& frame = GetCurrentFrame();
+
+	// only objects whose data changed since last frame are copied, a static scene uploads nothing
+	_gpuScene.Upload(cmd, frame.deletionQueue);
+	_stats.sceneUploadBytes = _gpuScene.GetUploadedBytes();
+	// finished mip reads go in before anything samples the textures this frame
+	_textureStreamer.Upload(cmd, frame.deletionQueue);
+	VkDeviceAddress sceneBufferAddress = _gpuScene.GetObjectBufferAddress();
+
+	// runs of the same surface and material become one instanced draw, object ids are read by gl_InstanceIndex
+	uint32_t instanceTotal = (uint32_t)transparentDraws.size() + (_useGPUCulling ? 0 : (uint32_t)opaqueDraws.size());
+	if (std::max(instanceTotal, 1u) > frame.instanceCapacity) {
+		// the frame fence has already been waited on, so nothing is using the old buffer anymore
+		if (frame.instanceCapacity != 0)
+			DestroyBuffer(frame.instanceBuffer);
+		frame.instanceCapacity = std::max<uint32_t>(std::bit_ceil(instanceTotal), 64);
+		frame.instanceBuffer = CreateBuffer(sizeof(uint32_t) * frame.instanceCapacity,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	}
+	VkDeviceAddress instanceBufferAddress = GetBufferAddress(frame.instanceBuffer);
+	uint32_t* instanceIds = (uint32_t*)frame.instanceBuffer.info.pMappedData;
+
+	std::vector<InstancedDraw> instancedDraws;
+	uint32_t instanceCount = 0;
+	auto addDraws = [&](const std::vector<RenderObject>& objects, const std::vector<uint32_t>& order) {
+		for (uint32_t i : order) {
+			const RenderObject& r = objects[i];
+			instanceIds[instanceCount] = r.objectId;
+
+			const RenderObject* last = instancedDraws.empty() ? nullptr : instancedDraws.back().object;
+			if (_useInstancing && last && last->meshId == r.meshId && last->lod == r.lod && last->materialId == r.materialId) {
+				instancedDraws.back().instanceCount++;
+			}
+			else {
+				instancedDraws.push_back(InstancedDraw{ .object = &r, .firstInstance = instanceCount, .instanceCount = 1 });
+			}
+			instanceCount++;
+		}
+	};
+	if (!_useGPUCulling)
+		addDraws(_drawContext.opaqueSurfaces, opaqueDraws);
+	addDraws(_drawContext.transparentSurfaces, transparentDraws);
+
+	bool occlusionCulling = _useGPUCulling && _useOcclusionCulling;
+	if (_useGPUCulling) {
+		ClusterPath clusterPath = ClusterPath::Off;
+		if (_useClusterCulling)
+			clusterPath = _useMeshShading && _meshShadingSupported ? ClusterPath::MeshShader : ClusterPath::Compute;
+		_gpuCulling.Prepare(cmd, frame.culling, frame.deletionQueue, _sceneData.viewproj, _camera.GetPosition(), _windowExtent, clusterPath, _useLods ? _projectionScale : 0.f);
+		_gpuCulling.Cull(cmd, frame.culling, occlusionCulling ? CullPass::Early : CullPass::Frustum);
 	}
+
 	VkRenderingAttachmentInfo colorAttachment = Init::AttachmentInfo(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	VkRenderingAttachmentInfo depthAttachment = Init::DepthAttachmentInfo(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 	VkRenderingInfo renderInfo = Init::RenderingInfo(_drawExtent, &colorAttachment, &depthAttachment);
@@ -706,65 +898,99 @@ void Engine::DrawGeometry(VkCommandBuffer cmd)
 	writer.WriteBuffer(0, sceneDataBuffer.buffer, sizeof(SceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 	writer.UpdateSet(globalDescriptor);
 
-	auto draw = [&](const RenderObject& r) {
+	VkDescriptorSet passDescriptors[] = { globalDescriptor, _bindless.GetSet() };
 
-		if (r.material != lastMaterial) {
-			lastMaterial = r.material;
-			if (r.material->pipeline != lastPipeline) {
+	// bound state does not carry over between command buffers
+	lastPipeline = nullptr;
+	lastIndexBuffer = VK_NULL_HANDLE;
+	// one shared index buffer per index type, fetched once since the loader may swap in a grown one
+	VkBuffer indexBuffers[] = { _indexPool.GetBuffer(VK_INDEX_TYPE_UINT16), _indexPool.GetBuffer(VK_INDEX_TYPE_UINT32) };
 
-				lastPipeline = r.material->pipeline;
-				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 0, 1,
-					&globalDescriptor, 0, nullptr);
+	auto setViewport = [&]() {
+		VkViewport viewport = {};
+		viewport.x = 0;
+		viewport.y = 0;
+		viewport.width = (float)_windowExtent.width;
+		viewport.height = (float)_windowExtent.height;
+		viewport.minDepth = 0.f;
+		viewport.maxDepth = 1.f;
 
-				VkViewport viewport = {};
-				viewport.x = 0;
-				viewport.y = 0;
-				viewport.width = (float)_windowExtent.width;
-				viewport.height = (float)_windowExtent.height;
-				viewport.minDepth = 0.f;
-				viewport.maxDepth = 1.f;
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
 
-				vkCmdSetViewport(cmd, 0, 1, &viewport);
+		VkRect2D scissor = {};
+		scissor.offset.x = 0;
+		scissor.offset.y = 0;
+		scissor.extent.width = _windowExtent.width;
+		scissor.extent.height = _windowExtent.height;
 
-				VkRect2D scissor = {};
-				scissor.offset.x = 0;
-				scissor.offset.y = 0;
-				scissor.extent.width = _windowExtent.width;
-				scissor.extent.height = _windowExtent.height;
+		vkCmdSetScissor(cmd, 0, 1, &scissor);
+	};
 
-				vkCmdSetScissor(cmd, 0, 1, &scissor);
-			}
+	if (_useGPUCulling) {
+		setViewport();
+		_gpuCulling.Draw(cmd, frame.culling, globalDescriptor, occlusionCulling ? CullPass::Early : CullPass::Frustum);
+		_stats.drawCallCount += (int)frame.culling.batches.size();
+		_stats.triangleCount += _stats.gpuTriangleCount;
+	}
+
+	if (occlusionCulling) {
+		// build the depth pyramid from what was visible last frame, then draw whatever it doesn't hide
+		vkCmdEndRendering(cmd);
+		_gpuCulling.BuildDepthPyramid(cmd, _depthImage);
+		_gpuCulling.Cull(cmd, frame.culling, CullPass::Late);
 
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1,
-				&r.material->materialSet, 0, nullptr);
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		vkCmdBeginRendering(cmd, &renderInfo);
+
+		setViewport();
+		_gpuCulling.Draw(cmd, frame.culling, globalDescriptor, CullPass::Late);
+		_stats.drawCallCount += (int)frame.culling.batches.size();
+	}
+
+	auto draw = [&](const InstancedDraw& d) {
+		const RenderObject& r = *d.object;
+		MaterialPipeline* pipeline = _gpuScene.GetMaterial(r.materialId)->pipeline;
+		const MeshDraw& mesh = _gpuScene.GetMesh(r.meshId);
+		const MeshLod& lod = mesh.lods[r.lod];
+		// nothing to draw without indices
+		if (lod.indexCount == 0)
+			return;
+
+		// materials are indices into the bindless set, so only a pipeline change needs new bindings
+		if (pipeline != lastPipeline) {
+
+			lastPipeline = pipeline;
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, 2,
+				passDescriptors, 0, nullptr);
+
+			setViewport();
 		}
 
-		if (r.indexBuffer != lastIndexBuffer)
+		VkBuffer indexBuffer = indexBuffers[mesh.indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1];
+		if (indexBuffer != lastIndexBuffer)
 		{
-			lastIndexBuffer = r.indexBuffer;
-			vkCmdBindIndexBuffer(cmd, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			lastIndexBuffer = indexBuffer;
+			vkCmdBindIndexBuffer(cmd, indexBuffer, 0, mesh.indexType);
 		}
 
 		DrawPushConstants pushConstants;
-		pushConstants.vertexBuffer = r.vertexBufferAddress;
-		pushConstants.worldMatrix = r.transform;
-		vkCmdPushConstants(cmd, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+		pushConstants.objectBuffer = sceneBufferAddress;
+		pushConstants.instanceBuffer = instanceBufferAddress;
+		vkCmdPushConstants(cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
 
-		vkCmdDrawIndexed(cmd, r.indexCount, 1, r.firstIndex, 0, 0);
+		vkCmdDrawIndexed(cmd, lod.indexCount, d.instanceCount, lod.firstIndex, 0, d.firstInstance);
 		_stats.drawCallCount++;
-		_stats.triangleCount += (r.indexCount) / 3;
+		_stats.triangleCount += (lod.indexCount) / 3 * d.instanceCount;
 
 	};
 
-	for (auto& r : opaqueDraws) {
-			draw(_drawContext.opaqueSurfaces[r]);
-	}
-
-	for (auto& r : _drawContext.transparentSurfaces) {
-		draw(r);
+	for (auto& d : instancedDraws) {
+		draw(d);
 	}
 	vkCmdEndRendering(cmd);
+	if (_useGPUCulling)
+		_gpuCulling.CopyStats(cmd, frame.culling);
 	auto end = std::chrono::system_clock::now();
 	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 	_stats.meshDrawTime = elapsed.count() / 1000.f;
@@ -776,7 +1002,11 @@ void Engine::UpdateScene()
 
 	_drawContext.opaqueSurfaces.clear();
 	_drawContext.transparentSurfaces.clear();
-	_loadedScenes["structure"]->Draw(glm::mat4{1.f}, _drawContext);
+	// hands over scenes the loader finished, before anything reads the gpu scene
+	_sceneLoader.Poll();
+	for (auto& [name, scene] : _loadedScenes) {
+		scene->Draw(glm::mat4{ 1.f }, _drawContext);
+	}
 
 	_camera.Update(_stats.frameTime);
 
@@ -791,6 +1021,23 @@ void Engine::UpdateScene()
 	_sceneData.ambientColor = glm::vec4(.1f);
 	_sceneData.sunlightColor = glm::vec4(1.f);
 	_sceneData.sunlightDirection = glm::vec4(0, 1, 0.5, 1.f);
+
+	_projectionScale = _windowExtent.height / (2.f * std::tan(glm::radians(_fov) / 2.f));
+	// the cull pass picks the lods of the gpu drawn objects itself, the cpu pick is for the rest
+	if (_useLods) {
+		_gpuScene.SelectLods(_drawContext.opaqueSurfaces, _camera.GetPosition(), _projectionScale);
+		_gpuScene.SelectLods(_drawContext.transparentSurfaces, _camera.GetPosition(), _projectionScale);
+	}
+
+	_stats.softwareOccludedCount = 0;
+	if (_useSoftwareOcclusion) {
+		_stats.softwareOccludedCount = _softwareOcclusion.Cull(_drawContext, _sceneData.viewproj);
+		_stats.softwareOcclusionTime = _softwareOcclusion.GetCost();
+	}
+
+	// after occlusion, hidden objects don't ask for texture detail
+	_textureStreamer.SetBudget((size_t)_textureBudgetMB * 1024 * 1024);
+	_textureStreamer.Update(_drawContext, _camera.GetPosition(), _projectionScale);
 	auto end = std::chrono::system_clock::now();
 	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 	_stats.sceneUpdateTime = elapsed.count() / 1000.f;
@@ -818,6 +1065,15 @@ void Engine::ProcessImGui()
 	if (ImGui::Begin("Settings"))
 	{
 		ImGui::SliderFloat("FOV", &_fov, 0.f, 180.f);
+		ImGui::Checkbox("GPU culling", &_useGPUCulling);
+		ImGui::Checkbox("Occlusion culling", &_useOcclusionCulling);
+		ImGui::Checkbox("Meshlet culling", &_useClusterCulling);
+		if (_meshShadingSupported)
+			ImGui::Checkbox("Mesh shaders", &_useMeshShading);
+		ImGui::Checkbox("Lods", &_useLods);
+		ImGui::Checkbox("Software occlusion", &_useSoftwareOcclusion);
+		ImGui::Checkbox("Instancing", &_useInstancing);
+		ImGui::SliderInt("Texture budget MB", &_textureBudgetMB, 16, 4096);
 	}
 	ImGui::End();
 
@@ -829,6 +1085,37 @@ void Engine::ProcessImGui()
 		ImGui::Text("update time %f ms", _stats.sceneUpdateTime);
 		ImGui::Text("triangles %i", _stats.triangleCount);
 		ImGui::Text("draws %i", _stats.drawCallCount);
+		ImGui::Text("scene upload %zu bytes", _stats.sceneUploadBytes);
+		if (_sceneLoader.GetPendingCount() != 0)
+			ImGui::Text("loading %u scenes", _sceneLoader.GetPendingCount());
+		ImGui::Text("streamed textures %zu / %zu bytes, %u pending", _textureStreamer.GetResidentBytes(), _textureStreamer.GetBudget(), _textureStreamer.GetPendingCount());
+		// handles given out per gpu copy, both counted since startup
+		AssetRegistry::Stats imageStats = _assetRegistry.GetImageStats();
+		AssetRegistry::Stats meshStats = _assetRegistry.GetMeshStats();
+		AssetRegistry::Stats samplerStats = _assetRegistry.GetSamplerStats();
+		ImGui::Text("shared images %u/%u meshes %u/%u samplers %u/%u", imageStats.shared, imageStats.created + imageStats.shared,
+			meshStats.shared, meshStats.created + meshStats.shared, samplerStats.shared, samplerStats.created + samplerStats.shared);
+		uint32_t assetsCreated = imageStats.created + meshStats.created + samplerStats.created;
+		uint32_t assetsShared = imageStats.shared + meshStats.shared + samplerStats.shared;
+		ImGui::Text("dedupe ratio %.2f, %zu bytes saved", assetsCreated != 0 ? (float)(assetsCreated + assetsShared) / assetsCreated : 1.f,
+			imageStats.savedBytes + meshStats.savedBytes);
+		if (_useGPUCulling) {
+			ImGui::Text("gpu visible %i", _stats.visibleCount);
+			ImGui::Text("gpu culled %i", _stats.culledCount);
+			if (_useOcclusionCulling)
+				ImGui::Text("gpu occluded %i", _stats.occludedCount);
+			if (_useClusterCulling)
+				ImGui::Text("gpu meshlets culled %i", _stats.clusterCulledCount);
+		}
+		ImGui::Text("binds pipeline %i descriptor %i index %i", _stats.sortedBinds.pipeline, _stats.sortedBinds.descriptor, _stats.sortedBinds.indexBuffer);
+		ImGui::Text("unsorted pipeline %i descriptor %i index %i", _stats.unsortedBinds.pipeline, _stats.unsortedBinds.descriptor, _stats.unsortedBinds.indexBuffer);
+		for (auto& [name, scene] : _loadedScenes) {
+			ImGui::Text("%s materials %zu bytes", name.c_str(), scene->GetMaterialMemory());
+		}
+		if (_useSoftwareOcclusion) {
+			ImGui::Text("cpu occluded %i", _stats.softwareOccludedCount);
+			ImGui::Text("cpu occlusion time %f ms", _stats.softwareOcclusionTime);
+		}
 	}
 	
 	ImGui::End();
@@ -867,7 +1154,10 @@ void Engine::DestroySwapchain()
 
 void Engine::ResizeSwapchain()
 {
-	vkDeviceWaitIdle(_device);
+	{
+		std::lock_guard<std::mutex> queueLock(_queueMutex);
+		vkDeviceWaitIdle(_device);
+	}
 	DestroySwapchain();
 	int width, height;
 	SDL_GetWindowSize(_window, &width, &height);
@@ -880,6 +1170,7 @@ void Engine::ResizeSwapchain()
 
 void Engine::ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
 {
+	std::lock_guard<std::mutex> lock(_immMutex);
 	VK_CHECK(vkResetFences(_device, 1, &_immFence));
 	VK_CHECK(vkResetCommandBuffer(_immCommandBuffer, 0));
 
@@ -894,7 +1185,10 @@ void Engine::ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function
 	VkCommandBufferSubmitInfo cmdInfo = Init::CommandBufferSubmitInfo(cmd);
 	VkSubmitInfo2 submit = Init::SubmitInfo(&cmdInfo, nullptr, nullptr);
 
-	VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, _immFence));
+	{
+		std::lock_guard<std::mutex> queueLock(_queueMutex);
+		VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, _immFence));
+	}
 	VK_CHECK(vkWaitForFences(_device, 1, &_immFence, true, 9999999999));
 }
 
@@ -921,16 +1215,25 @@ void Engine::DestroyBuffer(const AllocatedBuffer& buffer)
 	vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 
+VkDeviceAddress Engine::GetBufferAddress(const AllocatedBuffer& buffer)
+{
+	VkBufferDeviceAddressInfo deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer.buffer };
+	return vkGetBufferDeviceAddress(_device, &deviceAddressInfo);
+}
+
 AllocatedImage Engine::CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+{
+	return CreateImage(size, format, usage, mipmapped ? Util::GetMipLevelCount(size) : 1, VkComponentMapping{});
+}
+
+AllocatedImage Engine::CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels, VkComponentMapping swizzle)
 {
 	AllocatedImage newImage;
 	newImage.imageFormat = format;
 	newImage.imageExtent = size;
 
 	VkImageCreateInfo imgInfo = Init::ImageCreateInfo(format, usage, size);
-	if (mipmapped) {
-		imgInfo.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
-	}
+	imgInfo.mipLevels = mipLevels;
 
 	// always allocate images on dedicated GPU memory
 	VmaAllocationCreateInfo allocInfo = {};
@@ -950,48 +1253,130 @@ AllocatedImage Engine::CreateImage(VkExtent3D size, VkFormat format, VkImageUsag
 	// build a image-view for the image
 	VkImageViewCreateInfo viewInfo = Init::ImageViewCreateInfo(format, newImage.image, aspectFlag);
 	viewInfo.subresourceRange.levelCount = imgInfo.mipLevels;
+	viewInfo.components = swizzle;
 
 	VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &newImage.imageView));
 
 	return newImage;
 }
 
-AllocatedImage Engine::CreateImage(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+std::vector<AllocatedImage> Engine::CreateImages(std::span<const ImageUpload> images, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
 {
-	size_t dataSize = size.depth * size.width * size.height * 4;
-	AllocatedBuffer uploadbuffer = CreateBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	std::vector<AllocatedImage> newImages;
+	newImages.reserve(images.size());
+
+	// split so the staging buffer stays bounded, a single image larger than the budget still goes alone
+	size_t batchStart = 0;
+	size_t batchBytes = 0;
+	for (size_t i = 0; i < images.size(); i++) {
+		if (i > batchStart && batchBytes + images[i].GetByteSize() > UploadBatchSize) {
+			CreateImageBatch(images.subspan(batchStart, i - batchStart), format, usage, mipmapped, newImages);
+			batchStart = i;
+			batchBytes = 0;
+		}
+		batchBytes += images[i].GetByteSize();
+	}
+	if (batchStart < images.size())
+		CreateImageBatch(images.subspan(batchStart), format, usage, mipmapped, newImages);
 
-	memcpy(uploadbuffer.info.pMappedData, data, dataSize);
+	return newImages;
+}
 
-	AllocatedImage newImage = CreateImage(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
+void Engine::CreateImageBatch(std::span<const ImageUpload> images, VkFormat format, VkImageUsageFlags usage, bool mipmapped, std::vector<AllocatedImage>& newImages)
+{
+	std::lock_guard<std::mutex> lock(_imageUploadMutex);
+	size_t firstImage = newImages.size();
+	std::vector<size_t> stagingOffsets(images.size());
+	// images that get their levels from the compute downsampler, the rest are blitted
+	std::vector<uint8_t> computeMips(images.size(), 0);
+	size_t dataSize = 0;
+	for (size_t i = 0; i < images.size(); i++) {
+		const ImageUpload& image = images[i];
+		VkFormat imageFormat = image.format != VK_FORMAT_UNDEFINED ? image.format : format;
+		// compressed images can't be filtered on the gpu, they get exactly the levels they come with
+		uint32_t mipLevels = 1;
+		VkImageUsageFlags imageUsage = usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		if (Util::IsBlockCompressed(imageFormat)) {
+			mipLevels = mipmapped ? image.mipLevels : 1;
+		}
+		else if (mipmapped) {
+			mipLevels = Util::GetMipLevelCount(image.size);
+			if (image.mipLevels == 1 && _mipGenerator.SupportsFormat(imageFormat)) {
+				computeMips[i] = 1;
+				imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+			}
+		}
 
-	ImmediateSubmit([&](VkCommandBuffer cmd) {
-		Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
-
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageExtent = size;
-
-		// copy the buffer into the image
-		vkCmdCopyBufferToImage(cmd, uploadbuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-			&copyRegion);
-		if (mipmapped)
-			Util::GenerateMipmaps(cmd, newImage.image, VkExtent2D{ newImage.imageExtent.width, newImage.imageExtent.height });
+		// aligned to the largest block, copies have to start on a whole one
+		dataSize = (dataSize + 15) & ~size_t(15);
+		stagingOffsets[i] = dataSize;
+		dataSize += image.GetByteSize();
+		newImages.push_back(CreateImage(image.size, imageFormat, imageUsage, mipLevels, image.swizzle));
+	}
+	// decoders may read back rows they wrote, so the staging memory stays on the cpu like the mesh path
+	AllocatedBuffer uploadbuffer = CreateBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+	uint8_t* data = (uint8_t*)uploadbuffer.info.pMappedData;
+	// the images own disjoint parts of the staging buffer
+	_jobSystem.ParallelFor((uint32_t)images.size(), [&](uint32_t i) {
+		const ImageUpload& image = images[i];
+		if (image.writePixels)
+			image.writePixels(data + stagingOffsets[i]);
 		else
-			Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			memcpy(data + stagingOffsets[i], image.pixels.data(), image.pixels.size());
 		});
 
+	// one submit for the whole batch instead of a wait per image
+	std::vector<AllocatedImage> mipImages;
+	ImmediateSubmit([&](VkCommandBuffer cmd) {
+		for (size_t i = 0; i < images.size(); i++) {
+			const ImageUpload& image = images[i];
+			AllocatedImage& newImage = newImages[firstImage + i];
+			Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+			// levels that come with the pixels are copied, the image must have room for them
+			size_t bufferOffset = stagingOffsets[i];
+			uint32_t copiedLevels = mipmapped ? image.mipLevels : 1;
+			VkExtent3D levelSize = image.size;
+			for (uint32_t level = 0; level < copiedLevels; level++) {
+				VkBufferImageCopy copyRegion = {};
+				copyRegion.bufferOffset = bufferOffset;
+				copyRegion.bufferRowLength = 0;
+				copyRegion.bufferImageHeight = 0;
+
+				copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				copyRegion.imageSubresource.mipLevel = level;
+				copyRegion.imageSubresource.baseArrayLayer = 0;
+				copyRegion.imageSubresource.layerCount = 1;
+				copyRegion.imageExtent = levelSize;
+
+				vkCmdCopyBufferToImage(cmd, uploadbuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+					&copyRegion);
+				bufferOffset += Util::GetImageByteSize(newImage.imageFormat, levelSize);
+				levelSize.width = std::max(levelSize.width / 2, 1u);
+				levelSize.height = std::max(levelSize.height / 2, 1u);
+			}
+			if (computeMips[i])
+				mipImages.push_back(newImage);
+			else if (mipmapped && image.mipLevels == 1 && !Util::IsBlockCompressed(newImage.imageFormat))
+				Util::GenerateMipmaps(cmd, newImage.image, VkExtent2D{ newImage.imageExtent.width, newImage.imageExtent.height });
+			else
+				Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+		// a dispatch per image behind a single barrier, after every copy of the batch
+		_mipGenerator.Record(cmd, mipImages);
+		});
+
+	_mipGenerator.Reset();
 	DestroyBuffer(uploadbuffer);
+}
 
-	return newImage;
+AllocatedImage Engine::CreateImage(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+{
+	// the same path as the batches, mips included
+	ImageUpload upload{ size, 1, std::span<const uint8_t>((const uint8_t*)data, Util::GetImageByteSize(format, size)) };
+	return CreateImages(std::span<const ImageUpload>(&upload, 1), format, usage, mipmapped)[0];
 }
 
 void Engine::DestroyImage(const AllocatedImage& img)
@@ -1000,42 +1385,155 @@ void Engine::DestroyImage(const AllocatedImage& img)
 	vmaDestroyImage(_allocator, img.image, img.allocation);
 }
 
-MeshBuffers Engine::UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices)
+MeshBuffers Engine::UploadMesh(std::span<uint32_t> indices, std::span<PackedVertex> vertices, std::span<GPUMeshlet> meshlets, std::span<uint32_t> meshletData)
+{
+	MeshUpload upload{ indices, vertices, meshlets, meshletData };
+	return UploadMeshes(std::span<const MeshUpload>(&upload, 1))[0];
+}
+
+std::vector<MeshBuffers> Engine::UploadMeshes(std::span<const MeshUpload> meshes)
+{
+	std::vector<MeshBuffers> newMeshes;
+	newMeshes.reserve(meshes.size());
+
+	size_t batchStart = 0;
+	size_t batchBytes = 0;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		const MeshUpload& mesh = meshes[i];
+		size_t meshBytes = mesh.indices.size_bytes() + mesh.GetVertexCount() * sizeof(PackedVertex) + mesh.meshlets.size_bytes() + mesh.meshletData.size_bytes();
+		if (i > batchStart && batchBytes + meshBytes > UploadBatchSize) {
+			UploadMeshBatch(meshes.subspan(batchStart, i - batchStart), newMeshes);
+			batchStart = i;
+			batchBytes = 0;
+		}
+		batchBytes += meshBytes;
+	}
+	if (batchStart < meshes.size())
+		UploadMeshBatch(meshes.subspan(batchStart), newMeshes);
+
+	return newMeshes;
+}
+
+void Engine::UploadMeshBatch(std::span<const MeshUpload> meshes, std::vector<MeshBuffers>& uploaded)
 {
-	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-	const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+	struct UploadLayout {
+		size_t vertexBufferSize;
+		size_t indexBufferSize;
+		size_t meshletDescriptorSize;
+		size_t meshletBufferSize;
+		size_t stagingOffset;
+	};
+
+	std::vector<MeshBuffers> newMeshes(meshes.size());
+	std::vector<UploadLayout> layouts(meshes.size());
+	size_t stagingSize = 0;
+	// the ranges are allocated up front, a pool that has to grow is swapped in after the submit
+	_indexPool.BeginUpload();
+	for (size_t i = 0; i < meshes.size(); i++) {
+		const MeshUpload& mesh = meshes[i];
+		UploadLayout& layout = layouts[i];
+		MeshBuffers& newSurface = newMeshes[i];
+
+		// indices are relative to the start of the vertex buffer, so its size decides the width
+		const bool shortIndices = mesh.GetVertexCount() <= 65536;
+		const size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+		layout.vertexBufferSize = mesh.GetVertexCount() * sizeof(PackedVertex);
+		layout.indexBufferSize = mesh.indices.size() * indexSize;
+		layout.meshletDescriptorSize = mesh.meshlets.size() * sizeof(GPUMeshlet);
+		layout.meshletBufferSize = layout.meshletDescriptorSize + mesh.meshletData.size() * sizeof(uint32_t);
+		// aligned so the vertices can be written in place
+		stagingSize = (stagingSize + 15) & ~size_t(15);
+		layout.stagingOffset = stagingSize;
+		stagingSize += layout.vertexBufferSize + layout.indexBufferSize + layout.meshletBufferSize;
+
+		newSurface.indices = _indexPool.Allocate(shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32, (uint32_t)mesh.indices.size());
+		// vma refuses empty buffers
+		if (layout.vertexBufferSize != 0) {
+			newSurface.vertexBuffer = CreateBuffer(layout.vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+				VMA_MEMORY_USAGE_GPU_ONLY);
+			newSurface.vertexBufferAddress = GetBufferAddress(newSurface.vertexBuffer);
+		}
 
-	MeshBuffers newSurface;
-	newSurface.vertexBuffer = CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+		if (layout.meshletBufferSize != 0) {
+			newSurface.meshletBuffer = CreateBuffer(layout.meshletBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+				VMA_MEMORY_USAGE_GPU_ONLY);
+			newSurface.meshletBufferAddress = GetBufferAddress(newSurface.meshletBuffer);
+		}
+	}
 
-	VkBufferDeviceAddressInfo deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer };
-	newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device, &deviceAddressInfo);
+	// nothing to copy when every mesh of the batch is empty
+	if (stagingSize == 0) {
+		_indexPool.EndUpload();
+		uploaded.insert(uploaded.end(), newMeshes.begin(), newMeshes.end());
+		return;
+	}
 
-	newSurface.indexBuffer = CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+	AllocatedBuffer staging = CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	char* data = (char*)staging.allocation->GetMappedData();
+	// the meshes own disjoint parts of the staging buffer
+	_jobSystem.ParallelFor((uint32_t)meshes.size(), [&](uint32_t i) {
+		const MeshUpload& mesh = meshes[i];
+		const UploadLayout& layout = layouts[i];
+		char* meshStaging = data + layout.stagingOffset;
 
+		if (mesh.writeVertices)
+			mesh.writeVertices((PackedVertex*)meshStaging);
+		else
+			memcpy(meshStaging, mesh.vertices.data(), layout.vertexBufferSize);
+		if (newMeshes[i].indices.indexType == VK_INDEX_TYPE_UINT16) {
+			uint16_t* shortData = (uint16_t*)(meshStaging + layout.vertexBufferSize);
+			for (size_t index = 0; index < mesh.indices.size(); index++) {
+				shortData[index] = (uint16_t)mesh.indices[index];
+			}
+		}
+		else {
+			memcpy(meshStaging + layout.vertexBufferSize, mesh.indices.data(), layout.indexBufferSize);
+		}
+		char* meshletStaging = meshStaging + layout.vertexBufferSize + layout.indexBufferSize;
+		if (layout.meshletBufferSize != 0) {
+			memcpy(meshletStaging, mesh.meshlets.data(), layout.meshletDescriptorSize);
+			memcpy(meshletStaging + layout.meshletDescriptorSize, mesh.meshletData.data(), mesh.meshletData.size() * sizeof(uint32_t));
+		}
+		});
 
-	AllocatedBuffer staging = CreateBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-	void* data = staging.allocation->GetMappedData();
-	memcpy(data, vertices.data(), vertexBufferSize);
-	memcpy((char*)data + vertexBufferSize, indices.data(), indexBufferSize);
+	VkBuffer indexBuffers[] = { _indexPool.GetUploadBuffer(VK_INDEX_TYPE_UINT16), _indexPool.GetUploadBuffer(VK_INDEX_TYPE_UINT32) };
+	// every mesh of the batch goes out in a single submit
 	ImmediateSubmit([&](VkCommandBuffer cmd)
 		{
-			VkBufferCopy vertexCopy{ 0 };
-			vertexCopy.dstOffset = 0;
-			vertexCopy.srcOffset = 0;
-			vertexCopy.size = vertexBufferSize;
-
-			vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
-			VkBufferCopy indexCopy{ 0 };
-			indexCopy.dstOffset = 0;
-			indexCopy.srcOffset = vertexBufferSize;
-			indexCopy.size = indexBufferSize;
-
-			vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
+			_indexPool.RecordGrowth(cmd);
+			for (size_t i = 0; i < meshes.size(); i++) {
+				const UploadLayout& layout = layouts[i];
+
+				if (layout.vertexBufferSize != 0) {
+					VkBufferCopy vertexCopy{ 0 };
+					vertexCopy.dstOffset = 0;
+					vertexCopy.srcOffset = layout.stagingOffset;
+					vertexCopy.size = layout.vertexBufferSize;
+
+					vkCmdCopyBuffer(cmd, staging.buffer, newMeshes[i].vertexBuffer.buffer, 1, &vertexCopy);
+				}
+				if (layout.indexBufferSize != 0) {
+					const IndexPool::Range& indices = newMeshes[i].indices;
+					VkBufferCopy indexCopy{ 0 };
+					indexCopy.dstOffset = indices.firstIndex * IndexPool::GetIndexSize(indices.indexType);
+					indexCopy.srcOffset = layout.stagingOffset + layout.vertexBufferSize;
+					indexCopy.size = layout.indexBufferSize;
+
+					vkCmdCopyBuffer(cmd, staging.buffer, indexBuffers[indices.indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1], 1, &indexCopy);
+				}
+
+				if (layout.meshletBufferSize != 0) {
+					VkBufferCopy meshletCopy{ 0 };
+					meshletCopy.dstOffset = 0;
+					meshletCopy.srcOffset = layout.stagingOffset + layout.vertexBufferSize + layout.indexBufferSize;
+					meshletCopy.size = layout.meshletBufferSize;
+
+					vkCmdCopyBuffer(cmd, staging.buffer, newMeshes[i].meshletBuffer.buffer, 1, &meshletCopy);
+				}
+			}
 		});
+	_indexPool.EndUpload();
 	DestroyBuffer(staging);
-	return newSurface;
+	uploaded.insert(uploaded.end(), newMeshes.begin(), newMeshes.end());
 }
 
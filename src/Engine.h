@@ -2,8 +2,17 @@
 #include "Mesh.h"
 #include "Render.h"
 #include "Camera.h"
-
-constexpr uint32_t FRAME_OVERLAP = 2;
+#include "Culling.h"
+#include "Jobs.h"
+#include "SoftwareOcclusion.h"
+#include "DrawSort.h"
+#include "Bindless.h"
+#include "GPUScene.h"
+#include "MipGenerator.h"
+#include "TextureStreamer.h"
+#include "SceneLoader.h"
+#include "AssetRegistry.h"
+#include "Images.h"
 
 struct DeletionQueue
 {
@@ -33,6 +42,10 @@ struct FrameData {
 	
 	DeletionQueue deletionQueue;
 	DescriptorAllocatorGrowable descriptors;
+	CullingFrame culling;
+
+	AllocatedBuffer instanceBuffer;
+	uint32_t instanceCapacity{ 0 };
 };
 
 struct EngineStats {
@@ -41,14 +54,31 @@ struct EngineStats {
 	int drawCallCount;
 	float sceneUpdateTime;
 	float meshDrawTime;
+	// gpu culling results, read back a few frames late
+	int visibleCount;
+	int culledCount;
+	int occludedCount;
+	int gpuTriangleCount;
+	int clusterCulledCount;
+	int softwareOccludedCount;
+	float softwareOcclusionTime;
+	BindCounts sortedBinds;
+	BindCounts unsortedBinds;
+	size_t sceneUploadBytes;
 };
 
 class Engine
 {
 public:
+	// staging memory a single batched upload submit may use
+	static constexpr size_t UploadBatchSize = 64 * 1024 * 1024;
+
 	static Engine* Get();
 	static const VkDevice& GetMainDevice();
 	VkDevice& GetDevice() { return _device; };
+	VkPhysicalDevice GetPhysicalDevice() { return _chosenGPU; };
+	VmaAllocator& GetAllocator() { return _allocator; };
+	JobSystem& GetJobSystem() { return _jobSystem; };
 	AllocatedImage& GetDrawImage() { return _drawImage; };
 	AllocatedImage& GetDepthImage() { return _depthImage; };
 	AllocatedImage& GetErrorImage() { return _errorCheckerboardImage; };
@@ -57,23 +87,51 @@ public:
 	VkSampler& GetSamplerLinear() { return _defaultSamplerLinear; };
 	VkSampler& GetSamplerNearest() { return _defaultSamplerNearest; };
 	MetallicRougness& GetMetalMaterial() { return _metalRoughMat; };
+	BindlessResources& GetBindless() { return _bindless; };
+	GPUScene& GetGPUScene() { return _gpuScene; };
+	IndexPool& GetIndexPool() { return _indexPool; };
+	TextureStreamer& GetTextureStreamer() { return _textureStreamer; };
+	SceneLoader& GetSceneLoader() { return _sceneLoader; };
+	AssetRegistry& GetAssetRegistry() { return _assetRegistry; };
+	bool IsMeshShadingSupported() { return _meshShadingSupported; };
+	// without it images are uploaded as rgba8, cooked scenes and bc containers can't be read
+	bool IsTextureCompressionBCSupported() { return _textureCompressionBCSupported; };
 
 	VkDescriptorSetLayout& GetSceneDataLayout() { return _sceneDataDescriptorLayout; };
-	MeshBuffers UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+	// the meshlet buffer is only created when there are meshlets
+	MeshBuffers UploadMesh(std::span<uint32_t> indices, std::span<PackedVertex> vertices, std::span<GPUMeshlet> meshlets = {}, std::span<uint32_t> meshletData = {});
+	// uploads through shared staging buffers, one submit per UploadBatchSize bytes
+	std::vector<MeshBuffers> UploadMeshes(std::span<const MeshUpload> meshes);
 	
 	AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
 	void DestroyBuffer(const AllocatedBuffer& buffer);
+	VkDeviceAddress GetBufferAddress(const AllocatedBuffer& buffer);
+
+	// safe to call from the loader thread, immediate submits run one at a time
+	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
+	AllocatedImage CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+	// exactly mipLevels levels, the view applies the swizzle
+	AllocatedImage CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels, VkComponentMapping swizzle);
 	AllocatedImage CreateImage(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+	// same batching as UploadMeshes
+	std::vector<AllocatedImage> CreateImages(std::span<const ImageUpload> images, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
 	void DestroyImage(const AllocatedImage& img);
 	
 	float GetFrameTime() { return _stats.frameTime;};
 	void ShowError(const char* title, const char* message);
 	void Init();
 	void Run();
+	// loads the file serially and in parallel, prints the best times and whether both gave the same data
+	void BenchmarkLoad(std::string_view filePath, uint32_t runs = 3);
+	// imports the file and writes its cooked copy to the cache directory, the copy is only read by
+	// loads with the same mesh options
+	void Cook(std::string_view filePath, const GLTFLoadOptions& options);
 	void Cleanup();
 private:
 	void ShowSDLError();
+	void UploadMeshBatch(std::span<const MeshUpload> meshes, std::vector<MeshBuffers>& uploaded);
+	void CreateImageBatch(std::span<const ImageUpload> images, VkFormat format, VkImageUsageFlags usage, bool mipmapped, std::vector<AllocatedImage>& newImages);
 	void InitVulkan();
 	void InitSwapchain();
 	void InitCommands();
@@ -93,10 +151,8 @@ private:
 	void CreateSwapchain(uint32_t width, uint32_t height);
 	void DestroySwapchain();
 	void ResizeSwapchain();
-	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
 	FrameData& GetCurrentFrame() { return _frames[_frameNumber % FRAME_OVERLAP]; };
-	AllocatedImage CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
 
 	bool _isInitialized{ false };
 	int _frameNumber{ 0 };
@@ -138,6 +194,11 @@ private:
 	VkFence _immFence;
 	VkCommandBuffer _immCommandBuffer;
 	VkCommandPool _immCommandPool;
+	std::mutex _immMutex;
+	// the graphics queue is shared by the frames and the loader thread's uploads
+	std::mutex _queueMutex;
+	// image batches share the mip generator
+	std::mutex _imageUploadMutex;
 
 	std::vector<ComputeEffect> _backgroundEffects;
 	int _currentBackgroundEffect{ 0 };
@@ -157,6 +218,28 @@ private:
 
 	MaterialInstance _defaultData;
 	MetallicRougness _metalRoughMat;
+	BindlessResources _bindless;
+	GPUScene _gpuScene;
+	IndexPool _indexPool;
+	GPUCulling _gpuCulling;
+	MipGenerator _mipGenerator;
+	AssetRegistry _assetRegistry;
+	TextureStreamer _textureStreamer;
+	SceneLoader _sceneLoader;
+	int _textureBudgetMB{ 512 };
+	bool _useGPUCulling{ true };
+	bool _useOcclusionCulling{ true };
+	// lod 0 objects are culled per meshlet, by task shaders when the device has them
+	bool _useClusterCulling{ true };
+	bool _useMeshShading{ true };
+	bool _meshShadingSupported{ false };
+	bool _textureCompressionBCSupported{ false };
+	SoftwareOcclusion _softwareOcclusion;
+	bool _useSoftwareOcclusion{ false };
+	JobSystem _jobSystem;
+	DrawSorter _drawSorter;
+	bool _useInstancing{ true };
+	bool _useLods{ true };
 
 	DrawContext _drawContext;
 	std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> _loadedScenes;
@@ -164,6 +247,8 @@ private:
 	std::vector<std::shared_ptr<MeshAsset>> _testMeshes;
 	Camera _camera;
 	float _fov = 70.f;
+	// turns a view space size at distance 1 into pixels, for the lod selection
+	float _projectionScale{ 1.f };
 	EngineStats _stats;
 
 };
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "GPUScene.h"
+#include "Engine.h"
+#include "Pipelines.h"
+#include "Initializers.h"
+#include "Images.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+struct ScatterPushConstants {
+	VkDeviceAddress idBuffer;
+	VkDeviceAddress uploadBuffer;
+	VkDeviceAddress sceneBuffer;
+	VkDeviceAddress drawUploadBuffer;
+	VkDeviceAddress drawListBuffer;
+	uint32_t count;
+};
+
+// only the full surface is split into meshlets, and a single one gains nothing over the object test
+static bool IsClusterCulled(const GPUDrawData& draw)
+{
+	return draw.meshletCount > 1;
+}
+
+void GPUScene::BuildPipelines()
+{
+	VkDevice device = Engine::Get()->GetDevice();
+	VkShaderModule scatterShader = Util::LoadShader("scatter_objects.comp.spv");
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(ScatterPushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = Init::PipelineLayoutCreateInfo();
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	layoutInfo.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_scatterLayout));
+
+	VkComputePipelineCreateInfo computePipelineInfo = { .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	computePipelineInfo.layout = _scatterLayout;
+	computePipelineInfo.stage = Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, scatterShader);
+
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &_scatterPipeline));
+
+	vkDestroyShaderModule(device, scatterShader, nullptr);
+}
+
+void GPUScene::CleanResources()
+{
+	VkDevice device = Engine::GetMainDevice();
+	vkDestroyPipeline(device, _scatterPipeline, nullptr);
+	vkDestroyPipelineLayout(device, _scatterLayout, nullptr);
+	if (_capacity != 0) {
+		Engine::Get()->DestroyBuffer(_objectBuffer);
+		Engine::Get()->DestroyBuffer(_drawListBuffer);
+	}
+}
+
+uint32_t GPUScene::AllocateObject()
+{
+	if (!_freeIds.empty()) {
+		uint32_t id = _freeIds.back();
+		_freeIds.pop_back();
+		_objectLods[id] = 0;
+		return id;
+	}
+
+	_objects.emplace_back();
+	_draws.emplace_back();
+	_dirtyFlags.push_back(0);
+	_objectLods.push_back(0);
+	return (uint32_t)_objects.size() - 1;
+}
+
+void GPUScene::FreeObject(uint32_t id)
+{
+	// the cull pass still runs over the id, it has to skip it
+	SetDrawEntry(id, GPUDrawData{});
+	_freeIds.push_back(id);
+}
+
+void GPUScene::MarkDirty(uint32_t id)
+{
+	if (_dirtyFlags[id] == 0) {
+		_dirtyFlags[id] = 1;
+		_dirtyIds.push_back(id);
+	}
+}
+
+void GPUScene::UpdateObject(uint32_t id, const GPUObjectData& data)
+{
+	if (_dirtyFlags[id] == 0 && memcmp(&_objects[id], &data, sizeof(GPUObjectData)) == 0)
+		return;
+
+	_objects[id] = data;
+	MarkDirty(id);
+}
+
+void GPUScene::SetDraw(uint32_t id, uint32_t meshId, uint32_t materialId)
+{
+	const MeshDraw& mesh = _meshes[meshId];
+	MaterialInstance* material = _materials[materialId];
+
+	GPUDrawData draw{};
+	// transparent surfaces have no indirect pipeline, they are sorted and drawn on the cpu
+	if (material->indirectPipeline != nullptr) {
+		draw.batchIndex = GetBatch(material->indirectPipeline, mesh.indexType);
+		draw.lodCount = mesh.lodCount;
+		draw.meshletCount = mesh.meshletCount;
+		draw.indexBase = mesh.indexBase;
+		std::copy_n(mesh.lods, mesh.lodCount, draw.lods);
+	}
+	SetDrawEntry(id, draw);
+}
+
+void GPUScene::SetDrawEntry(uint32_t id, const GPUDrawData& draw)
+{
+	const uint32_t itemSize = GPUCulling::MeshletsPerWorkItem;
+
+	GPUDrawData& old = _draws[id];
+	if (old.batchIndex != GPUDrawData::NotDrawn) {
+		DrawBatch& batch = _batches[old.batchIndex];
+		batch.objectCount--;
+		batch.meshletDrawCount -= IsClusterCulled(old) ? old.meshletCount : 1;
+		_clusterWorkCount -= IsClusterCulled(old) ? (old.meshletCount + itemSize - 1) / itemSize : 0;
+	}
+	if (draw.batchIndex != GPUDrawData::NotDrawn) {
+		DrawBatch& batch = _batches[draw.batchIndex];
+		batch.objectCount++;
+		batch.meshletDrawCount += IsClusterCulled(draw) ? draw.meshletCount : 1;
+		_clusterWorkCount += IsClusterCulled(draw) ? (draw.meshletCount + itemSize - 1) / itemSize : 0;
+	}
+
+	old = draw;
+	MarkDirty(id);
+}
+
+uint32_t GPUScene::GetBatch(MaterialPipeline* pipeline, VkIndexType indexType)
+{
+	// a handful of them, materials are bindless and the index buffers are shared per type
+	for (uint32_t i = 0; i < _batches.size(); i++) {
+		if (_batches[i].pipeline == pipeline && _batches[i].indexType == indexType)
+			return i;
+	}
+	_batches.push_back(DrawBatch{ pipeline, indexType, 0, 0 });
+	return (uint32_t)_batches.size() - 1;
+}
+
+uint32_t GPUScene::AddMesh(const MeshDraw& mesh)
+{
+	if (!_freeMeshIds.empty()) {
+		uint32_t id = _freeMeshIds.back();
+		_freeMeshIds.pop_back();
+		_meshes[id] = mesh;
+		return id;
+	}
+
+	_meshes.push_back(mesh);
+	return (uint32_t)_meshes.size() - 1;
+}
+
+void GPUScene::RemoveMesh(uint32_t id)
+{
+	_freeMeshIds.push_back(id);
+}
+
+void GPUScene::SetMaterial(uint32_t index, MaterialInstance* material)
+{
+	if (index >= _materials.size())
+		_materials.resize(index + 1, nullptr);
+	_materials[index] = material;
+}
+
+void GPUScene::SelectLods(std::vector<RenderObject>& objects, const glm::vec3& cameraPosition, float projectionScale)
+{
+	for (RenderObject& r : objects) {
+		const MeshDraw& mesh = _meshes[r.meshId];
+		const glm::mat3x4& transform = _objects[r.objectId].transform;
+
+		// the largest axis scale, the rows are stored so the axes are spread over them
+		float scale = 0.f;
+		for (int axis = 0; axis < 3; axis++) {
+			scale = std::max(scale, glm::length(glm::vec3(transform[0][axis], transform[1][axis], transform[2][axis])));
+		}
+		float radius = mesh.bounds.sphereRadius * scale;
+		float distance = glm::length(TransformPoint(transform, mesh.bounds.origin) - cameraPosition);
+
+		uint32_t current = _objectLods[r.objectId];
+		uint32_t lod = 0;
+		// inside the sphere everything is at full detail
+		if (distance > radius) {
+			float projectedRadius = radius / distance * projectionScale;
+			for (uint32_t i = mesh.lodCount - 1; i > 0; i--) {
+				float limit = i > current ? LodPixelError * LodHysteresis : LodPixelError;
+				if (mesh.lods[i].error * projectedRadius < limit) {
+					lod = i;
+					break;
+				}
+			}
+		}
+
+		_objectLods[r.objectId] = (uint8_t)lod;
+		r.lod = lod;
+	}
+}
+
+void GPUScene::Upload(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue)
+{
+	Engine* engine = Engine::Get();
+	_uploadedBytes = 0;
+
+	if (_objects.size() > _capacity) {
+		// a new buffer starts out empty, so everything gets sent again
+		if (_capacity != 0) {
+			AllocatedBuffer oldBuffer = _objectBuffer;
+			AllocatedBuffer oldDrawList = _drawListBuffer;
+			frameDeletionQueue.Push([=]() {
+				Engine::Get()->DestroyBuffer(oldBuffer);
+				Engine::Get()->DestroyBuffer(oldDrawList);
+				});
+		}
+
+		_capacity = std::max<uint32_t>(std::bit_ceil((uint32_t)_objects.size()), 1024);
+		_objectBuffer = engine->CreateBuffer(sizeof(GPUObjectData) * _capacity,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		_objectBufferAddress = engine->GetBufferAddress(_objectBuffer);
+		_drawListBuffer = engine->CreateBuffer(sizeof(GPUDrawData) * _capacity,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		_drawListAddress = engine->GetBufferAddress(_drawListBuffer);
+
+		_dirtyIds.clear();
+		for (uint32_t id = 0; id < _objects.size(); id++) {
+			_dirtyFlags[id] = 1;
+			_dirtyIds.push_back(id);
+		}
+	}
+
+	if (_dirtyIds.empty())
+		return;
+
+	// ids first, then the objects at the next 16 byte boundary and their draw list entries
+	uint32_t count = (uint32_t)_dirtyIds.size();
+	size_t dataOffset = (sizeof(uint32_t) * count + 15) & ~size_t(15);
+	size_t drawOffset = dataOffset + sizeof(GPUObjectData) * count;
+	size_t uploadSize = drawOffset + sizeof(GPUDrawData) * count;
+
+	AllocatedBuffer uploadBuffer = engine->CreateBuffer(uploadSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	frameDeletionQueue.Push([=]() {
+		Engine::Get()->DestroyBuffer(uploadBuffer);
+		});
+
+	uint8_t* mapped = (uint8_t*)uploadBuffer.info.pMappedData;
+	memcpy(mapped, _dirtyIds.data(), sizeof(uint32_t) * count);
+	GPUObjectData* uploadObjects = (GPUObjectData*)(mapped + dataOffset);
+	GPUDrawData* uploadDraws = (GPUDrawData*)(mapped + drawOffset);
+	for (uint32_t i = 0; i < count; i++) {
+		uploadObjects[i] = _objects[_dirtyIds[i]];
+		uploadDraws[i] = _draws[_dirtyIds[i]];
+		_dirtyFlags[_dirtyIds[i]] = 0;
+	}
+	_dirtyIds.clear();
+	_uploadedBytes = uploadSize;
+
+	// the task and mesh shaders of the meshlet path read both as well
+	VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	if (engine->IsMeshShadingSupported())
+		readStages |= VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+
+	// earlier frames may still be reading the objects that get overwritten
+	for (VkBuffer buffer : { _objectBuffer.buffer, _drawListBuffer.buffer }) {
+		Util::BufferBarrier(cmd, buffer, readStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	}
+
+	VkDeviceAddress uploadAddress = engine->GetBufferAddress(uploadBuffer);
+	ScatterPushConstants pushConstants;
+	pushConstants.idBuffer = uploadAddress;
+	pushConstants.uploadBuffer = uploadAddress + dataOffset;
+	pushConstants.sceneBuffer = _objectBufferAddress;
+	pushConstants.drawUploadBuffer = uploadAddress + drawOffset;
+	pushConstants.drawListBuffer = _drawListAddress;
+	pushConstants.count = count;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _scatterPipeline);
+	vkCmdPushConstants(cmd, _scatterLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ScatterPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, (count + 63) / 64, 1, 1);
+
+	for (VkBuffer buffer : { _objectBuffer.buffer, _drawListBuffer.buffer }) {
+		Util::BufferBarrier(cmd, buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			readStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "Render.h"
+
+struct DeletionQueue;
+
+// what the cull pass draws for one object id, std430 layout. the lods are absolute ranges in the index pool
+struct GPUDrawData {
+	// free ids and surfaces drawn on the cpu, the cull pass skips them
+	static constexpr uint32_t NotDrawn = UINT32_MAX;
+
+	uint32_t batchIndex{ NotDrawn };
+	uint32_t lodCount;
+	// culled per meshlet by the cluster pass when drawn at lod 0 with more than one
+	uint32_t meshletCount;
+	// start of the mesh in the index pool, meshlet index ranges are relative to it
+	uint32_t indexBase;
+	MeshLod lods[MeshDraw::MaxLods];
+};
+
+// device local copy of every render object, indexed by an id that stays the same while the object lives.
+// the cpu keeps a shadow copy and only objects that changed since the last upload are sent over.
+// the draw list of the cull pass lives next to it, one entry per id, sent over with the same dirty ids
+class GPUScene
+{
+public:
+	// objects drawn by the cull pass share one indirect draw per pipeline and index type
+	struct DrawBatch {
+		MaterialPipeline* pipeline;
+		VkIndexType indexType;
+		uint32_t objectCount;
+		// draw slots when every object that has meshlets gets one per meshlet
+		uint32_t meshletDrawCount;
+	};
+
+	// a lod is used while its error covers less than this many pixels
+	static constexpr float LodPixelError = 1.f;
+	// switching to a coarser lod needs the error this much below the limit, so objects at the edge don't flicker
+	static constexpr float LodHysteresis = 0.75f;
+
+	void BuildPipelines();
+	void CleanResources();
+
+	uint32_t AllocateObject();
+	void FreeObject(uint32_t id);
+	// marks the object dirty if the data differs from what was uploaded before
+	void UpdateObject(uint32_t id, const GPUObjectData& data);
+	// what the cull pass draws for the object, its mesh and material have to be in the tables already
+	void SetDraw(uint32_t id, uint32_t meshId, uint32_t materialId);
+
+	const GPUObjectData& GetObject(uint32_t id) { return _objects[id]; };
+
+	// cpu only tables the draw packets point into, next to the per object data
+	uint32_t AddMesh(const MeshDraw& mesh);
+	void RemoveMesh(uint32_t id);
+	const MeshDraw& GetMesh(uint32_t id) { return _meshes[id]; };
+	// indexed by the bindless material slot, so the same index works on both sides
+	void SetMaterial(uint32_t index, MaterialInstance* material);
+	MaterialInstance* GetMaterial(uint32_t index) { return _materials[index]; };
+
+	// picks the lod of every object from the projected size of its bounding sphere. projectionScale
+	// turns a view space size at distance 1 into pixels
+	void SelectLods(std::vector<RenderObject>& objects, const glm::vec3& cameraPosition, float projectionScale);
+
+	// scatters the dirty objects and their draw list entries into the scene buffers, must run outside of rendering.
+	// the staging buffer and any replaced scene buffer are released through the frame's deletion queue
+	void Upload(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue);
+
+	VkDeviceAddress GetObjectBufferAddress() { return _objectBufferAddress; };
+	VkDeviceAddress GetDrawListAddress() { return _drawListAddress; };
+	// ids below this fit the scene buffers, valid after Upload
+	uint32_t GetObjectCapacity() { return _capacity; };
+	// every id handed out so far, free ones included
+	uint32_t GetObjectCount() { return (uint32_t)_objects.size(); };
+	// batch indices stay the same once handed out, a batch without objects is left in place
+	const std::vector<DrawBatch>& GetBatches() { return _batches; };
+	// cluster work items if every object that has meshlets was drawn at lod 0
+	uint32_t GetClusterWorkCount() { return _clusterWorkCount; };
+	// bytes copied to the gpu by the last upload
+	size_t GetUploadedBytes() { return _uploadedBytes; };
+
+private:
+	void MarkDirty(uint32_t id);
+	// moves the object's share of the batch counts over to the new entry
+	void SetDrawEntry(uint32_t id, const GPUDrawData& draw);
+	uint32_t GetBatch(MaterialPipeline* pipeline, VkIndexType indexType);
+
+	VkPipeline _scatterPipeline;
+	VkPipelineLayout _scatterLayout;
+
+	std::vector<GPUObjectData> _objects;
+	std::vector<GPUDrawData> _draws;
+	std::vector<DrawBatch> _batches;
+	uint32_t _clusterWorkCount{ 0 };
+	std::vector<uint32_t> _freeIds;
+	std::vector<uint32_t> _dirtyIds;
+	std::vector<uint8_t> _dirtyFlags;
+	// lod picked last frame, per object
+	std::vector<uint8_t> _objectLods;
+
+	std::vector<MeshDraw> _meshes;
+	std::vector<uint32_t> _freeMeshIds;
+	std::vector<MaterialInstance*> _materials;
+
+	AllocatedBuffer _objectBuffer;
+	VkDeviceAddress _objectBufferAddress{ 0 };
+	AllocatedBuffer _drawListBuffer;
+	VkDeviceAddress _drawListAddress{ 0 };
+	uint32_t _capacity{ 0 };
+	size_t _uploadedBytes{ 0 };
+};
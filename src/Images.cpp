@@ -2,6 +2,12 @@
 #include "Initializers.h"
 #include "Engine.h"
 #include <SDL_image.h>
+#include <turbojpeg.h>
+#include <png.h>
+#include <ktx.h>
+
+#include <cstring>
+#include <fstream>
 
 
 
@@ -19,7 +25,8 @@ void Util::TransitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout cur
 	imageBarrier.oldLayout = currentLayout;
 	imageBarrier.newLayout = newLayout;
 
-	VkImageAspectFlags aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	bool isDepth = newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || currentLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+	VkImageAspectFlags aspectMask = isDepth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 	imageBarrier.subresourceRange = Init::ImageSubresourceRange(aspectMask);
 	imageBarrier.image = image;
 	VkDependencyInfo depInfo{};
@@ -66,9 +73,9 @@ void Util::CopyImage(VkCommandBuffer cmd, VkImage src, VkImage dst, VkExtent2D s
 }
 
 //SDL_image extension
-SDL_Surface* IMG_LoadFromMemory(void* buffer, int size)
+SDL_Surface* IMG_LoadFromMemory(const void* buffer, int size)
 {
-    SDL_RWops* rw = SDL_RWFromMem(buffer, size);
+    SDL_RWops* rw = SDL_RWFromConstMem(buffer, size);
     SDL_Surface* temp = IMG_Load_RW(rw, 1);
 
     if (!temp)
@@ -85,81 +92,220 @@ SDL_Surface* IMG_LoadFromMemory(void* buffer, int size)
     return image;
 }
 
-std::optional<AllocatedImage> Util::LoadImage(fastgltf::Asset& asset, fastgltf::Image& image)
+// tightly packed rgba8, whatever layout the file decoded to
+static bool ReadSurface(SDL_Surface* surface, DecodedImage& decoded)
+{
+    if (!surface)
+        return false;
+
+    SDL_Surface* rgba = surface->format->format == SDL_PIXELFORMAT_RGBA32 ? surface : SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+    if (rgba) {
+        decoded.size = VkExtent3D{ (uint32_t)rgba->w, (uint32_t)rgba->h, 1 };
+        decoded.pixels.resize((size_t)rgba->w * rgba->h * 4);
+        for (int y = 0; y < rgba->h; y++) {
+            memcpy(decoded.pixels.data() + (size_t)y * rgba->w * 4, (const uint8_t*)rgba->pixels + (size_t)y * rgba->pitch, (size_t)rgba->w * 4);
+        }
+        if (rgba != surface)
+            SDL_FreeSurface(rgba);
+    }
+    SDL_FreeSurface(surface);
+    return rgba != nullptr;
+}
+
+std::optional<DecodedImage> Util::DecodeImage(const fastgltf::Asset& asset, const fastgltf::Image& image)
 {
-    AllocatedImage newImage{};
+    // formats with a direct decoder skip the SDL surface and its conversion
+    std::optional<EncodedImage> encoded = ReadImageHeader(asset, image);
+    if (encoded.has_value() && encoded->CanDecodeInto()) {
+        DecodedImage decoded{};
+        decoded.size = encoded->size;
+        decoded.pixels.resize((size_t)encoded->size.width * encoded->size.height * 4);
+        if (!DecodeImageInto(*encoded, decoded.pixels.data()))
+            return {};
+        return decoded;
+    }
+    if (encoded.has_value() && encoded->IsContainer())
+        return ReadContainer(*encoded);
+
+    DecodedImage decoded{};
+    bool loaded = false;
 
     std::visit(
         fastgltf::visitor{
-            [](auto& arg) {
+            [](const auto& arg) {
             fmt::println("Unhandled type: {}", typeid(arg).name());
             },
-            [&](fastgltf::sources::URI& filePath) {
+            [&](const fastgltf::sources::URI& filePath) {
                 assert(filePath.fileByteOffset == 0);
                 assert(filePath.uri.isLocalPath());
 
                 const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
+                loaded = ReadSurface(IMG_Load(path.c_str()), decoded);
+            },
+            [&](const fastgltf::sources::Array& vector) {
+                loaded = ReadSurface(IMG_LoadFromMemory(vector.bytes.data(), static_cast<int>(vector.bytes.size())), decoded);
+            },
+            [&](const fastgltf::sources::BufferView& view) {
+                auto& bufferView = asset.bufferViews[view.bufferViewIndex];
+                auto& buffer = asset.buffers[bufferView.bufferIndex];
 
-                SDL_Surface* surface = IMG_Load(path.c_str());
-                if (surface) {
-                    VkExtent3D imageSize;
-                    imageSize.width = surface->w;
-                    imageSize.height = surface->h;
-                    imageSize.depth = 1;
+                std::visit(fastgltf::visitor {
+                    [](const auto& arg) {
+                    fmt::println("Buffer view unhandled type    : {}", typeid(arg).name());
+                    },
+                    [&](const fastgltf::sources::Array& vector) {
+                        loaded = ReadSurface(IMG_LoadFromMemory(vector.bytes.data() + bufferView.byteOffset, static_cast<int>(bufferView.byteLength)), decoded);
+                    },
+                    // glb binary chunks are read in place from the mapped file
+                    [&](const fastgltf::sources::ByteView& byteView) {
+                        loaded = ReadSurface(IMG_LoadFromMemory(byteView.bytes.data() + bufferView.byteOffset, static_cast<int>(bufferView.byteLength)), decoded);
+                    }
+                }, buffer.data);
+            },
+        },
+        image.data);
 
+    if (!loaded) {
+        return {};
+    }
+    else {
+        return decoded;
+    }
+}
 
-                    newImage = Engine::Get()->CreateImage(surface->pixels, imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+static uint32_t ReadBigEndian(const uint8_t* bytes)
+{
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3];
+}
 
-                    SDL_FreeSurface(surface);
-                }
-            },
-            [&](fastgltf::sources::Array& vector) {
-                SDL_Surface* surface = IMG_LoadFromMemory(vector.bytes.data(), static_cast<int>(vector.bytes.size()));  
-                if (surface) {
-                    VkExtent3D imageSize;
-                    imageSize.width = surface->w;
-                    imageSize.height = surface->h;
-                    imageSize.depth = 1;
+static uint32_t ReadLittleEndian(const uint8_t* bytes)
+{
+    return (uint32_t)bytes[3] << 24 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[0];
+}
 
+static const uint8_t Ktx2Identifier[] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
 
-                    newImage = Engine::Get()->CreateImage(surface->pixels, imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+std::optional<EncodedImage> Util::ReadImageHeader(const fastgltf::Asset& asset, const fastgltf::Image& image)
+{
+    EncodedImage encoded{};
+    bool found = false;
 
-                    SDL_FreeSurface(surface);
-                }
+    std::visit(
+        fastgltf::visitor{
+            [](const auto& arg) {},
+            [&](const fastgltf::sources::URI& filePath) {
+                assert(filePath.fileByteOffset == 0);
+                assert(filePath.uri.isLocalPath());
+
+                const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
+                std::ifstream file(path, std::ios::binary | std::ios::ate);
+                if (!file.is_open())
+                    return;
+                encoded.fileData.resize((size_t)file.tellg());
+                file.seekg(0);
+                file.read((char*)encoded.fileData.data(), encoded.fileData.size());
+                encoded.bytes = encoded.fileData;
+                found = !file.fail();
+            },
+            [&](const fastgltf::sources::Array& vector) {
+                encoded.bytes = std::span<const uint8_t>((const uint8_t*)vector.bytes.data(), vector.bytes.size());
+                found = true;
             },
-            [&](fastgltf::sources::BufferView& view) {
+            [&](const fastgltf::sources::BufferView& view) {
                 auto& bufferView = asset.bufferViews[view.bufferViewIndex];
                 auto& buffer = asset.buffers[bufferView.bufferIndex];
 
                 std::visit(fastgltf::visitor {
-                    [](auto& arg) {
-                    fmt::println("Buffer view unhandled type    : {}", typeid(arg).name());
+                    [](const auto& arg) {},
+                    [&](const fastgltf::sources::Array& vector) {
+                        encoded.bytes = std::span<const uint8_t>((const uint8_t*)vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
+                        found = true;
                     },
-                    [&](fastgltf::sources::Array& vector) {
-                        SDL_Surface* surface = IMG_LoadFromMemory(vector.bytes.data() + bufferView.byteOffset, static_cast<int>(bufferView.byteLength));
-                        if (surface) {
-                            VkExtent3D imageSize;
-                            imageSize.width = surface->w;
-                            imageSize.height = surface->h;
-                            imageSize.depth = 1;
-
-
-                            newImage = Engine::Get()->CreateImage(surface->pixels, imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
-                            SDL_FreeSurface(surface);
-
-                        }
+                    [&](const fastgltf::sources::ByteView& byteView) {
+                        encoded.bytes = std::span<const uint8_t>((const uint8_t*)byteView.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
+                        found = true;
                     }
                 }, buffer.data);
             },
         },
         image.data);
 
-    if (newImage.image == VK_NULL_HANDLE) {
+    if (!found)
         return {};
+
+    const std::span<const uint8_t> bytes = encoded.bytes;
+    static const uint8_t pngSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (bytes.size() >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff) {
+        tjhandle handle = tjInitDecompress();
+        int width, height, subsampling, colorspace;
+        if (handle && tjDecompressHeader3(handle, bytes.data(), (unsigned long)bytes.size(), &width, &height, &subsampling, &colorspace) == 0
+            // turbojpeg can't turn cmyk into rgb, SDL_image can
+            && colorspace != TJCS_CMYK && colorspace != TJCS_YCCK) {
+            encoded.format = EncodedImage::Format::Jpeg;
+            encoded.size = VkExtent3D{ (uint32_t)width, (uint32_t)height, 1 };
+        }
+        if (handle)
+            tjDestroy(handle);
     }
-    else {
-        return newImage;
+    // the size sits in the IHDR chunk, which always comes first
+    else if (bytes.size() >= 24 && memcmp(bytes.data(), pngSignature, sizeof(pngSignature)) == 0 && memcmp(bytes.data() + 12, "IHDR", 4) == 0) {
+        encoded.format = EncodedImage::Format::Png;
+        encoded.size = VkExtent3D{ ReadBigEndian(bytes.data() + 16), ReadBigEndian(bytes.data() + 20), 1 };
+    }
+    else if (bytes.size() >= 28 && memcmp(bytes.data(), Ktx2Identifier, sizeof(Ktx2Identifier)) == 0) {
+        encoded.format = EncodedImage::Format::Ktx2;
+        encoded.size = VkExtent3D{ ReadLittleEndian(bytes.data() + 20), ReadLittleEndian(bytes.data() + 24), 1 };
     }
+    else if (bytes.size() >= 128 && memcmp(bytes.data(), "DDS ", 4) == 0) {
+        encoded.format = EncodedImage::Format::Dds;
+        encoded.size = VkExtent3D{ ReadLittleEndian(bytes.data() + 16), ReadLittleEndian(bytes.data() + 12), 1 };
+    }
+
+    if (encoded.size.width == 0 || encoded.size.height == 0)
+        encoded.format = EncodedImage::Format::Unknown;
+    return encoded;
+}
+
+bool Util::DecodeImageInto(const EncodedImage& image, uint8_t* pixels)
+{
+    const int width = (int)image.size.width;
+    const int height = (int)image.size.height;
+
+    if (image.format == EncodedImage::Format::Jpeg) {
+        tjhandle handle = tjInitDecompress();
+        if (!handle)
+            return false;
+        int result = tjDecompress2(handle, image.bytes.data(), (unsigned long)image.bytes.size(), pixels, width, width * 4, height, TJPF_RGBA, 0);
+        // warnings still leave a whole image behind
+        bool decoded = result == 0 || tjGetErrorCode(handle) == TJERR_WARNING;
+        if (!decoded)
+            fmt::println("tjDecompress2 Error: {}", tjGetErrorStr2(handle));
+        tjDestroy(handle);
+        return decoded;
+    }
+
+    if (image.format == EncodedImage::Format::Png) {
+        png_image png{};
+        png.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_memory(&png, image.bytes.data(), image.bytes.size())) {
+            fmt::println("libpng Error: {}", png.message);
+            return false;
+        }
+        if (png.width != image.size.width || png.height != image.size.height) {
+            png_image_free(&png);
+            return false;
+        }
+
+        // libpng expands palettes, grey and 16 bit channels while it writes the rows
+        png.format = PNG_FORMAT_RGBA;
+        if (!png_image_finish_read(&png, nullptr, pixels, width * 4, nullptr)) {
+            fmt::println("libpng Error: {}", png.message);
+            return false;
+        }
+        return true;
+    }
+
+    return false;
 }
 
 void Util::GenerateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize)
@@ -233,3 +379,225 @@ void Util::GenerateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageS
 
 }
 
+void Util::BufferBarrier(VkCommandBuffer cmd, VkBuffer buffer, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+{
+    VkBufferMemoryBarrier2 bufferBarrier{ .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, .pNext = nullptr };
+    bufferBarrier.srcStageMask = srcStage;
+    bufferBarrier.srcAccessMask = srcAccess;
+    bufferBarrier.dstStageMask = dstStage;
+    bufferBarrier.dstAccessMask = dstAccess;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = buffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+
+    VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr };
+    depInfo.bufferMemoryBarrierCount = 1;
+    depInfo.pBufferMemoryBarriers = &bufferBarrier;
+
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+uint32_t Util::GetMipLevelCount(VkExtent3D size)
+{
+	return static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+}
+
+void Util::GenerateMipChain(DecodedImage& image)
+{
+	// compressed images come with their own levels
+	if (image.format != VK_FORMAT_R8G8B8A8_UNORM)
+		return;
+
+	image.mipLevels = GetMipLevelCount(image.size);
+
+	size_t levelOffset = 0;
+	uint32_t width = image.size.width;
+	uint32_t height = image.size.height;
+	for (uint32_t level = 1; level < image.mipLevels; level++) {
+		uint32_t halfWidth = std::max(width / 2, 1u);
+		uint32_t halfHeight = std::max(height / 2, 1u);
+		size_t nextOffset = levelOffset + (size_t)width * height * 4;
+		image.pixels.resize(nextOffset + (size_t)halfWidth * halfHeight * 4);
+
+		const uint8_t* src = image.pixels.data() + levelOffset;
+		uint8_t* dst = image.pixels.data() + nextOffset;
+		for (uint32_t y = 0; y < halfHeight; y++) {
+			// odd sizes reuse the last row or column
+			uint32_t y0 = std::min(y * 2, height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, height - 1);
+			for (uint32_t x = 0; x < halfWidth; x++) {
+				uint32_t x0 = std::min(x * 2, width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, width - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src[((size_t)y0 * width + x0) * 4 + c] + src[((size_t)y0 * width + x1) * 4 + c]
+						+ src[((size_t)y1 * width + x0) * 4 + c] + src[((size_t)y1 * width + x1) * 4 + c];
+					dst[((size_t)y * halfWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+
+		levelOffset = nextOffset;
+		width = halfWidth;
+		height = halfHeight;
+	}
+}
+
+bool Util::IsBlockCompressed(VkFormat format)
+{
+	return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+size_t Util::GetImageByteSize(VkFormat format, VkExtent3D size)
+{
+	if (!IsBlockCompressed(format))
+		return (size_t)size.width * size.height * 4;
+
+	// bc1 and bc4 blocks are half the size of the others
+	bool halfBlocks = format <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_BC4_SNORM_BLOCK;
+	return (size_t)((size.width + 3) / 4) * ((size.height + 3) / 4) * (halfBlocks ? 8 : 16);
+}
+
+size_t Util::GetImageByteSize(VkFormat format, VkExtent3D size, uint32_t mipLevels)
+{
+	size_t bytes = 0;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		bytes += GetImageByteSize(format, size);
+		size.width = std::max(size.width / 2, 1u);
+		size.height = std::max(size.height / 2, 1u);
+	}
+	return bytes;
+}
+
+// every other texture is sampled as unorm, so srgb files are read the same way
+static VkFormat GetUnormFormat(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_SRGB: return VK_FORMAT_R8G8B8A8_UNORM;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case VK_FORMAT_BC2_SRGB_BLOCK: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case VK_FORMAT_BC3_SRGB_BLOCK: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case VK_FORMAT_BC7_SRGB_BLOCK: return VK_FORMAT_BC7_UNORM_BLOCK;
+	default: return format;
+	}
+}
+
+static std::optional<DecodedImage> ReadKtx2(std::span<const uint8_t> bytes)
+{
+	ktxTexture2* texture = nullptr;
+	KTX_error_code result = ktxTexture2_CreateFromMemory(bytes.data(), bytes.size(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &texture);
+	if (result != KTX_SUCCESS) {
+		fmt::println("ktx Error: {}", ktxErrorString(result));
+		return {};
+	}
+
+	if (ktxTexture2_NeedsTranscoding(texture)) {
+		// bc7 keeps most of the uastc quality, two channel data fits bc5 at the same size
+		ktx_transcode_fmt_e target = ktxTexture2_GetNumComponents(texture) == 2 ? KTX_TTF_BC5_RG : KTX_TTF_BC7_RGBA;
+		if (!Engine::Get()->IsTextureCompressionBCSupported())
+			target = KTX_TTF_RGBA32;
+		result = ktxTexture2_TranscodeBasis(texture, target, 0);
+		if (result != KTX_SUCCESS) {
+			fmt::println("ktx Error: {}", ktxErrorString(result));
+			ktxTexture_Destroy(ktxTexture(texture));
+			return {};
+		}
+	}
+
+	DecodedImage decoded{};
+	decoded.format = GetUnormFormat((VkFormat)texture->vkFormat);
+	decoded.size = VkExtent3D{ texture->baseWidth, texture->baseHeight, 1 };
+	decoded.mipLevels = texture->numLevels;
+
+	bool loaded = (Util::IsBlockCompressed(decoded.format) && Engine::Get()->IsTextureCompressionBCSupported()) || decoded.format == VK_FORMAT_R8G8B8A8_UNORM;
+	if (!loaded)
+		fmt::println("Unsupported ktx2 format: {}", (uint32_t)texture->vkFormat);
+
+	// only the first layer and face of arrays and cubes
+	const uint8_t* data = ktxTexture_GetData(ktxTexture(texture));
+	size_t dataSize = ktxTexture_GetDataSize(ktxTexture(texture));
+	VkExtent3D levelSize = decoded.size;
+	decoded.pixels.reserve(Util::GetImageByteSize(decoded.format, decoded.size, decoded.mipLevels));
+	for (uint32_t level = 0; loaded && level < decoded.mipLevels; level++) {
+		ktx_size_t offset = 0;
+		size_t levelBytes = Util::GetImageByteSize(decoded.format, levelSize);
+		if (ktxTexture_GetImageOffset(ktxTexture(texture), level, 0, 0, &offset) != KTX_SUCCESS || offset + levelBytes > dataSize) {
+			loaded = false;
+			break;
+		}
+		decoded.pixels.insert(decoded.pixels.end(), data + offset, data + offset + levelBytes);
+		levelSize.width = std::max(levelSize.width / 2, 1u);
+		levelSize.height = std::max(levelSize.height / 2, 1u);
+	}
+
+	ktxTexture_Destroy(ktxTexture(texture));
+	if (!loaded)
+		return {};
+	return decoded;
+}
+
+static VkFormat GetDdsFormat(std::span<const uint8_t> bytes, size_t& dataOffset)
+{
+	dataOffset = 128;
+	auto fourCC = [&](const char* code) { return memcmp(bytes.data() + 84, code, 4) == 0; };
+	if (fourCC("DXT1"))
+		return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	if (fourCC("DXT2") || fourCC("DXT3"))
+		return VK_FORMAT_BC2_UNORM_BLOCK;
+	if (fourCC("DXT4") || fourCC("DXT5"))
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	if (fourCC("ATI1") || fourCC("BC4U"))
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	if (fourCC("ATI2") || fourCC("BC5U"))
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	if (!fourCC("DX10") || bytes.size() < 148)
+		return VK_FORMAT_UNDEFINED;
+
+	// the dxgi format of the extended header
+	dataOffset = 148;
+	switch (ReadLittleEndian(bytes.data() + 128)) {
+	case 28: case 29: return VK_FORMAT_R8G8B8A8_UNORM;
+	case 71: case 72: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 74: case 75: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 77: case 78: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case 98: case 99: return VK_FORMAT_BC7_UNORM_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+static std::optional<DecodedImage> ReadDds(const EncodedImage& image)
+{
+	size_t dataOffset;
+	DecodedImage decoded{};
+	decoded.format = GetDdsFormat(image.bytes, dataOffset);
+	if (decoded.format == VK_FORMAT_UNDEFINED || (Util::IsBlockCompressed(decoded.format) && !Engine::Get()->IsTextureCompressionBCSupported())) {
+		fmt::println("Unsupported dds format");
+		return {};
+	}
+	decoded.size = image.size;
+	decoded.mipLevels = std::max(ReadLittleEndian(image.bytes.data() + 28), 1u);
+
+	// levels of the first face follow the header back to back
+	size_t dataSize = Util::GetImageByteSize(decoded.format, decoded.size, decoded.mipLevels);
+	if (dataOffset + dataSize > image.bytes.size())
+		return {};
+	decoded.pixels.assign(image.bytes.begin() + dataOffset, image.bytes.begin() + dataOffset + dataSize);
+	return decoded;
+}
+
+std::optional<DecodedImage> Util::ReadContainer(const EncodedImage& image)
+{
+	if (image.format == EncodedImage::Format::Ktx2)
+		return ReadKtx2(image.bytes);
+	if (image.format == EncodedImage::Format::Dds)
+		return ReadDds(image);
+	return {};
+}
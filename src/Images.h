@@ -1,11 +1,76 @@
 #pragma once
 #include "Types.h"
 #include <fastgltf/core.hpp>
+#include <functional>
+
+// pixels decoded on the cpu, waiting to be uploaded. rgba8 unless they came block compressed from
+// a ktx2 or dds file or went through the cooker
+struct DecodedImage {
+	VkExtent3D size;
+	uint32_t mipLevels{ 1 };
+	VkFormat format{ VK_FORMAT_R8G8B8A8_UNORM };
+	// two channel textures keep their channels in r and g, the view moves them back into place
+	VkComponentMapping swizzle{};
+	std::vector<uint8_t> pixels;
+};
+
+// the encoded bytes of an image and its size read from the header, nothing decoded yet.
+// the bytes point into the gltf buffers, images in their own file are read into fileData, so it can be moved but not copied
+struct EncodedImage {
+	enum class Format { Unknown, Jpeg, Png, Ktx2, Dds };
+
+	Format format{ Format::Unknown };
+	VkExtent3D size{ 0, 0, 1 };
+	std::span<const uint8_t> bytes;
+	std::vector<uint8_t> fileData;
+
+	EncodedImage() = default;
+	EncodedImage(EncodedImage&&) = default;
+	EncodedImage& operator=(EncodedImage&&) = default;
+
+	// jpeg and png decode into caller memory, ktx2 and dds already hold gpu levels, everything else goes through SDL_image
+	bool CanDecodeInto() const { return format == Format::Jpeg || format == Format::Png; };
+	bool IsContainer() const { return format == Format::Ktx2 || format == Format::Dds; };
+};
+
+// pixels handed to Engine::CreateImages, they may point into a mapped file.
+// every mip level is tightly packed after the previous one, with a single rgba8 level the rest are made on the gpu.
+// block compressed images can't be blitted, they get exactly the levels they come with
+struct ImageUpload {
+	VkExtent3D size;
+	uint32_t mipLevels;
+	std::span<const uint8_t> pixels;
+	// when set, called on a worker to write the rgba8 pixels of a single level straight into the staging memory
+	std::function<void(uint8_t* staging)> writePixels;
+	// undefined takes the format passed to CreateImages
+	VkFormat format{ VK_FORMAT_UNDEFINED };
+	VkComponentMapping swizzle{};
+
+	size_t GetByteSize() const { return writePixels ? (size_t)size.width * size.height * 4 : pixels.size(); };
+};
 
 namespace Util
 {
 	void TransitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
+	void BufferBarrier(VkCommandBuffer cmd, VkBuffer buffer, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
 	void CopyImage(VkCommandBuffer cmd, VkImage src, VkImage dst, VkExtent2D srcSize, VkExtent2D dstSize);
-	std::optional<AllocatedImage> LoadImage(fastgltf::Asset& asset, fastgltf::Image& image);
+	// only touches the cpu, so images can be decoded on worker threads
+	std::optional<DecodedImage> DecodeImage(const fastgltf::Asset& asset, const fastgltf::Image& image);
+	// finds the bytes of the image and reads its size without decoding, empty when the source can't be read
+	std::optional<EncodedImage> ReadImageHeader(const fastgltf::Asset& asset, const fastgltf::Image& image);
+	// decodes tightly packed rgba8 rows into pixels, which must hold width * height * 4 bytes
+	bool DecodeImageInto(const EncodedImage& image, uint8_t* pixels);
 	void GenerateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize);
+	// the same number of levels as the gpu path, box filtered and appended to the pixels
+	void GenerateMipChain(DecodedImage& image);
+	uint32_t GetMipLevelCount(VkExtent3D size);
+	// ktx2 and dds files keep their levels as they are, basis payloads are transcoded to bc7 or bc5,
+	// or rgba8 when the device has no bc
+	std::optional<DecodedImage> ReadContainer(const EncodedImage& image);
+
+	bool IsBlockCompressed(VkFormat format);
+	// bytes of one level, 4x4 blocks for the bc formats and rgba8 for everything else
+	size_t GetImageByteSize(VkFormat format, VkExtent3D size);
+	// bytes of the first levels of a chain
+	size_t GetImageByteSize(VkFormat format, VkExtent3D size, uint32_t mipLevels);
 };
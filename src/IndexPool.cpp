@@ -0,0 +1,182 @@
+#include "IndexPool.h"
+#include "Engine.h"
+#include "Images.h"
+
+#include <algorithm>
+#include <bit>
+
+void IndexPool::Init()
+{
+	for (VkIndexType indexType : { VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32 }) {
+		Pool& pool = GetPool(indexType);
+		pool.capacity = InitialCapacity;
+		pool.buffer = CreatePoolBuffer(indexType, pool.capacity);
+		pool.freeRanges.push_back(FreeRange{ 0, pool.capacity });
+	}
+}
+
+void IndexPool::CleanResources()
+{
+	Engine* engine = Engine::Get();
+	for (Pool& pool : _pools) {
+		engine->DestroyBuffer(pool.buffer);
+		if (pool.grownCapacity != 0)
+			engine->DestroyBuffer(pool.grownBuffer);
+	}
+	for (RetiredBuffer& retired : _retiredBuffers) {
+		engine->DestroyBuffer(retired.buffer);
+	}
+	_retiredBuffers.clear();
+}
+
+AllocatedBuffer IndexPool::CreatePoolBuffer(VkIndexType indexType, uint32_t capacity)
+{
+	// a source too, a grown buffer starts out as a copy of the one it replaces
+	return Engine::Get()->CreateBuffer(GetIndexSize(indexType) * capacity,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+}
+
+void IndexPool::Update(uint64_t frameNumber)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_frameNumber = frameNumber;
+
+	// the frames that could still read a range have passed their fence once frameNumber got this far
+	std::erase_if(_retiredRanges, [&](const RetiredRange& retired) {
+		if (retired.frameNumber + FRAME_OVERLAP > frameNumber)
+			return false;
+		Release(GetPool(retired.range.indexType), retired.range.firstIndex, retired.range.indexCount);
+		return true;
+		});
+	std::erase_if(_retiredBuffers, [&](const RetiredBuffer& retired) {
+		if (retired.frameNumber + FRAME_OVERLAP > frameNumber)
+			return false;
+		Engine::Get()->DestroyBuffer(retired.buffer);
+		return true;
+		});
+}
+
+VkBuffer IndexPool::GetBuffer(VkIndexType indexType)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return GetPool(indexType).buffer.buffer;
+}
+
+void IndexPool::Free(const Range& range)
+{
+	if (range.indexCount == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_retiredRanges.push_back(RetiredRange{ range, _frameNumber });
+}
+
+void IndexPool::Release(Pool& pool, uint32_t firstIndex, uint32_t indexCount)
+{
+	auto next = std::lower_bound(pool.freeRanges.begin(), pool.freeRanges.end(), firstIndex, [](const FreeRange& range, uint32_t first) {
+		return range.firstIndex < first;
+		});
+
+	// merged with its neighbours, so freed meshes make room for larger ones again
+	if (next != pool.freeRanges.begin()) {
+		auto previous = next - 1;
+		if (previous->firstIndex + previous->indexCount == firstIndex) {
+			previous->indexCount += indexCount;
+			if (next != pool.freeRanges.end() && firstIndex + indexCount == next->firstIndex) {
+				previous->indexCount += next->indexCount;
+				pool.freeRanges.erase(next);
+			}
+			return;
+		}
+	}
+	if (next != pool.freeRanges.end() && firstIndex + indexCount == next->firstIndex) {
+		next->firstIndex = firstIndex;
+		next->indexCount += indexCount;
+		return;
+	}
+	pool.freeRanges.insert(next, FreeRange{ firstIndex, indexCount });
+}
+
+void IndexPool::BeginUpload()
+{
+	_uploadMutex.lock();
+}
+
+IndexPool::Range IndexPool::Allocate(VkIndexType indexType, uint32_t indexCount)
+{
+	Range range{ indexType, 0, indexCount };
+	if (indexCount == 0)
+		return range;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	Pool& pool = GetPool(indexType);
+	auto findRange = [&]() {
+		return std::find_if(pool.freeRanges.begin(), pool.freeRanges.end(), [&](const FreeRange& free) { return free.indexCount >= indexCount; });
+	};
+
+	auto found = findRange();
+	if (found == pool.freeRanges.end()) {
+		uint32_t capacity = pool.grownCapacity != 0 ? pool.grownCapacity : pool.capacity;
+		uint32_t newCapacity = std::bit_ceil(std::max(capacity * 2, capacity + indexCount));
+		// grown earlier in this upload, nothing has been copied into it yet
+		if (pool.grownCapacity != 0)
+			Engine::Get()->DestroyBuffer(pool.grownBuffer);
+		pool.grownBuffer = CreatePoolBuffer(indexType, newCapacity);
+		pool.grownCapacity = newCapacity;
+
+		Release(pool, capacity, newCapacity - capacity);
+		found = findRange();
+	}
+
+	range.firstIndex = found->firstIndex;
+	found->firstIndex += indexCount;
+	found->indexCount -= indexCount;
+	if (found->indexCount == 0)
+		pool.freeRanges.erase(found);
+	return range;
+}
+
+VkBuffer IndexPool::GetUploadBuffer(VkIndexType indexType)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Pool& pool = GetPool(indexType);
+	return pool.grownCapacity != 0 ? pool.grownBuffer.buffer : pool.buffer.buffer;
+}
+
+void IndexPool::RecordGrowth(VkCommandBuffer cmd)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (VkIndexType indexType : { VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32 }) {
+		Pool& pool = GetPool(indexType);
+		if (pool.grownCapacity == 0)
+			continue;
+
+		VkBufferCopy copy{ 0 };
+		copy.srcOffset = 0;
+		copy.dstOffset = 0;
+		copy.size = GetIndexSize(indexType) * pool.capacity;
+		vkCmdCopyBuffer(cmd, pool.buffer.buffer, pool.grownBuffer.buffer, 1, &copy);
+
+		// ranges that were free in the old contents get written by the upload's copies
+		Util::BufferBarrier(cmd, pool.grownBuffer.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+	}
+}
+
+void IndexPool::EndUpload()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (Pool& pool : _pools) {
+			if (pool.grownCapacity == 0)
+				continue;
+
+			// the frame being recorded may have bound the old buffer already
+			_retiredBuffers.push_back(RetiredBuffer{ pool.buffer, _frameNumber });
+			pool.buffer = pool.grownBuffer;
+			pool.capacity = pool.grownCapacity;
+			pool.grownCapacity = 0;
+		}
+	}
+	_uploadMutex.unlock();
+}
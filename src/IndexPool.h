@@ -0,0 +1,79 @@
+#pragma once
+#include "Types.h"
+
+#include <mutex>
+
+// the indices of every mesh share one buffer per index type, so draws only split on the pipeline and the
+// index width. meshes get a range of it, which their draws address through firstIndex.
+// ranges are allocated by the uploads on the loader thread while the render thread draws from the same
+// buffers, freed ones are held back for FRAME_OVERLAP frames like the bindless slots
+class IndexPool
+{
+public:
+	// in indices, per index type
+	static constexpr uint32_t InitialCapacity = 1 << 20;
+
+	struct Range {
+		VkIndexType indexType{ VK_INDEX_TYPE_UINT32 };
+		uint32_t firstIndex{ 0 };
+		uint32_t indexCount{ 0 };
+	};
+
+	void Init();
+	void CleanResources();
+
+	// releases the ranges and buffers no frame in flight can reach anymore. on the render thread, after the frame's fence wait
+	void Update(uint64_t frameNumber);
+	// the buffer draws of this type bind at offset 0
+	VkBuffer GetBuffer(VkIndexType indexType);
+	void Free(const Range& range);
+
+	// one upload at a time allocates, a buffer that has to grow is swapped in by EndUpload
+	// once the submit that filled it has finished
+	void BeginUpload();
+	Range Allocate(VkIndexType indexType, uint32_t indexCount);
+	// the buffer the upload copies its indices into, the grown one if Allocate had to grow it
+	VkBuffer GetUploadBuffer(VkIndexType indexType);
+	// copies what the drawn buffer holds into the grown one, recorded in front of the upload's own copies
+	void RecordGrowth(VkCommandBuffer cmd);
+	void EndUpload();
+
+	static size_t GetIndexSize(VkIndexType indexType) { return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t); };
+
+private:
+	struct FreeRange {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+	struct Pool {
+		AllocatedBuffer buffer;
+		uint32_t capacity{ 0 };
+		// replaces buffer at the end of the upload that grew it, 0 while there is none
+		AllocatedBuffer grownBuffer;
+		uint32_t grownCapacity{ 0 };
+		// sorted by first index, neighbours are merged
+		std::vector<FreeRange> freeRanges;
+	};
+	struct RetiredRange {
+		Range range;
+		uint64_t frameNumber;
+	};
+	struct RetiredBuffer {
+		AllocatedBuffer buffer;
+		uint64_t frameNumber;
+	};
+
+	Pool& GetPool(VkIndexType indexType) { return _pools[indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1]; };
+	static AllocatedBuffer CreatePoolBuffer(VkIndexType indexType, uint32_t capacity);
+	static void Release(Pool& pool, uint32_t firstIndex, uint32_t indexCount);
+
+	// 16 bit indices first, then 32 bit
+	Pool _pools[2];
+	std::vector<RetiredRange> _retiredRanges;
+	std::vector<RetiredBuffer> _retiredBuffers;
+
+	std::mutex _mutex;
+	// held from BeginUpload to EndUpload
+	std::mutex _uploadMutex;
+	uint64_t _frameNumber{ 0 };
+};
@@ -0,0 +1,95 @@
+#include "Jobs.h"
+
+void JobSystem::Init(uint32_t workerCount)
+{
+	if (workerCount == 0) {
+		// leave a core for the main thread
+		workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	_stop = false;
+	for (uint32_t i = 0; i < workerCount; i++) {
+		_workers.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+void JobSystem::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (std::thread& worker : _workers) {
+		worker.join();
+	}
+	_workers.clear();
+	_tasks.clear();
+}
+
+void JobSystem::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& function)
+{
+	if (count == 0)
+		return;
+
+	if (_workers.empty() || count == 1) {
+		for (uint32_t i = 0; i < count; i++) {
+			function(i);
+		}
+		return;
+	}
+
+	// shared so tasks that only get picked up after everything is done don't touch a dead stack frame
+	struct ForState {
+		std::function<void(uint32_t)> function;
+		uint32_t count;
+		std::atomic<uint32_t> next{ 0 };
+		std::atomic<uint32_t> finished{ 0 };
+	};
+	std::shared_ptr<ForState> state = std::make_shared<ForState>();
+	state->function = function;
+	state->count = count;
+
+	auto task = [this, state]() {
+		for (uint32_t i = state->next++; i < state->count; i = state->next++) {
+			state->function(i);
+			if (++state->finished == state->count) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				_done.notify_all();
+			}
+		}
+	};
+
+	uint32_t taskCount = std::min(count - 1, GetWorkerCount());
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (uint32_t i = 0; i < taskCount; i++) {
+			_tasks.push_back(task);
+		}
+	}
+	_wake.notify_all();
+
+	// the caller keeps pulling indices until none are left, then waits for the ones still running
+	task();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [&]() { return state->finished == state->count; });
+}
+
+void JobSystem::WorkerLoop()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+			if (_stop)
+				return;
+
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "Types.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// fixed pool of worker threads, callers take part in their own work so nested calls can't deadlock
+class JobSystem
+{
+public:
+	void Init(uint32_t workerCount = 0);
+	void Shutdown();
+	uint32_t GetWorkerCount() { return (uint32_t)_workers.size(); };
+
+	// runs function(index) for every index in [0, count) across the workers and blocks until all are done
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& function);
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> _workers;
+	std::deque<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	bool _stop{ false };
+};
@@ -1,12 +1,24 @@
 ﻿#include "Engine.h"
 #include <SDL2/SDL.h>
+#include <cstring>
 
 
 int main(int argc, char* argv[])
 {
 	Engine engine;
 	engine.Init();
-	engine.Run();
+	// --load-benchmark <file> times the gltf loader instead of running
+	if (argc > 2 && strcmp(argv[1], "--load-benchmark") == 0)
+		engine.BenchmarkLoad(argv[2]);
+	// --cook <file> [--merge-static] writes the cooked copy of the file, --merge-static for scenes
+	// loaded with mergeStaticGeometry like the structure
+	else if (argc > 2 && strcmp(argv[1], "--cook") == 0) {
+		GLTFLoadOptions options;
+		options.mergeStaticGeometry = argc > 3 && strcmp(argv[3], "--merge-static") == 0;
+		engine.Cook(argv[2], options);
+	}
+	else
+		engine.Run();
 	engine.Cleanup();
 	return 0;
 }
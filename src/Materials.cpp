@@ -15,15 +15,8 @@ void MetallicRougness::BuildPipelines()
 	matrixRange.size = sizeof(DrawPushConstants);
 	matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-	DescriptorLayoutBuilder layoutBuilder;
-	layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	layoutBuilder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	layoutBuilder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-	materialLayout = layoutBuilder.Build(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
 	VkDescriptorSetLayout layouts[] = { engine->GetSceneDataLayout(),
-		materialLayout };
+		engine->GetBindless().layout };
 
 	VkPipelineLayoutCreateInfo meshLayoutInfo = Init::PipelineLayoutCreateInfo();
 	meshLayoutInfo.setLayoutCount = 2;
@@ -65,39 +58,82 @@ void MetallicRougness::BuildPipelines()
 
 	transparentPipeline.pipeline = pipelineBuilder.BuildPipeline(device);
 
+	// opaque variant that pulls its transforms from the object buffer written by gpu culling
+	VkShaderModule meshIndirectVertexShader = Util::LoadShader("mesh_indirect.vert.spv");
+
+	VkPushConstantRange objectRange{};
+	objectRange.offset = 0;
+	objectRange.size = sizeof(IndirectPushConstants);
+	objectRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	meshLayoutInfo.pPushConstantRanges = &objectRange;
+
+	VkPipelineLayout indirectLayout;
+	VK_CHECK(vkCreatePipelineLayout(device, &meshLayoutInfo, nullptr, &indirectLayout));
+	indirectPipeline.layout = indirectLayout;
+
+	pipelineBuilder.SetShaders(meshIndirectVertexShader, meshFragShader);
+	pipelineBuilder.DisableBlending();
+	pipelineBuilder.EnableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	pipelineBuilder.pipelineLayout = indirectLayout;
+
+	indirectPipeline.pipeline = pipelineBuilder.BuildPipeline(device);
+
+	if (engine->IsMeshShadingSupported()) {
+		VkShaderModule meshletTaskShader = Util::LoadShader("meshlet.task.spv");
+		VkShaderModule meshletMeshShader = Util::LoadShader("meshlet.mesh.spv");
+
+		VkPushConstantRange meshletRange{};
+		meshletRange.offset = 0;
+		meshletRange.size = sizeof(MeshletPushConstants);
+		meshletRange.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+		meshLayoutInfo.pPushConstantRanges = &meshletRange;
+
+		VkPipelineLayout meshletLayout;
+		VK_CHECK(vkCreatePipelineLayout(device, &meshLayoutInfo, nullptr, &meshletLayout));
+		meshletPipeline.layout = meshletLayout;
+
+		pipelineBuilder.SetMeshShaders(meshletTaskShader, meshletMeshShader, meshFragShader);
+		pipelineBuilder.pipelineLayout = meshletLayout;
+
+		meshletPipeline.pipeline = pipelineBuilder.BuildPipeline(device);
+
+		vkDestroyShaderModule(device, meshletTaskShader, nullptr);
+		vkDestroyShaderModule(device, meshletMeshShader, nullptr);
+	}
+
 	vkDestroyShaderModule(device, meshFragShader, nullptr);
 	vkDestroyShaderModule(device, meshVertexShader, nullptr);
+	vkDestroyShaderModule(device, meshIndirectVertexShader, nullptr);
 }
 
 void MetallicRougness::CleanResources()
 {
 	const VkDevice device = Engine::GetMainDevice();
-	vkDestroyDescriptorSetLayout(device, materialLayout, nullptr);
 	vkDestroyPipelineLayout(device, opaquePipeline.layout, nullptr); // same layout as the transparent pipeline
 	vkDestroyPipeline(device, opaquePipeline.pipeline, nullptr);
 	vkDestroyPipeline(device, transparentPipeline.pipeline, nullptr);
+	vkDestroyPipelineLayout(device, indirectPipeline.layout, nullptr);
+	vkDestroyPipeline(device, indirectPipeline.pipeline, nullptr);
+	if (meshletPipeline.pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(device, meshletPipeline.layout, nullptr);
+		vkDestroyPipeline(device, meshletPipeline.pipeline, nullptr);
+	}
 }
 
-MaterialInstance MetallicRougness::WriteMaterial(MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator)
+MaterialInstance MetallicRougness::WriteMaterial(MaterialPass pass, const MaterialConstants& constants)
 {
 	MaterialInstance matData;
 	matData.passType = pass;
 	if (pass == MaterialPass::Transparent) {
 		matData.pipeline = &transparentPipeline;
+		matData.indirectPipeline = nullptr;
 	}
 	else {
 		matData.pipeline = &opaquePipeline;
+		matData.indirectPipeline = &indirectPipeline;
 	}
 
-	matData.materialSet = descriptorAllocator.Allocate(materialLayout);
-
-
-	writer.Clear();
-	writer.WriteBuffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.WriteImage(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.WriteImage(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-	writer.UpdateSet(matData.materialSet);
+	matData.materialIndex = Engine::Get()->GetBindless().AddMaterial(constants);
 
 	return matData;
 }
@@ -13,7 +13,10 @@ struct MaterialPipeline {
 
 struct MaterialInstance {
 	MaterialPipeline* pipeline;
-	VkDescriptorSet materialSet;
+	// variant fed by gpu culling, null when the pass can't be drawn indirectly
+	MaterialPipeline* indirectPipeline;
+	// slot in the bindless material table
+	uint32_t materialIndex;
 	MaterialPass passType;
 };
 
@@ -24,29 +27,35 @@ struct Material {
 struct MetallicRougness {
 	MaterialPipeline opaquePipeline;
 	MaterialPipeline transparentPipeline;
+	MaterialPipeline indirectPipeline;
+	// task and mesh shader variant of the indirect pipeline, only built when the device supports mesh shaders
+	MaterialPipeline meshletPipeline{ VK_NULL_HANDLE, VK_NULL_HANDLE };
 
-	VkDescriptorSetLayout materialLayout;
-
+	// packed for the bindless material table, 80 bytes and std430 compatible
 	struct MaterialConstants {
 		glm::vec4 colorFactors;
-		glm::vec4 metalRoughFactors;
-		//padding, we need it anyway for uniform buffers
-		glm::vec4 extra[14];
-	};
-
-	struct MaterialResources {
-		AllocatedImage colorImage;
-		VkSampler colorSampler;
-		AllocatedImage metalRoughImage;
-		VkSampler metalRoughSampler;
-		VkBuffer dataBuffer;
-		uint32_t dataBufferOffset;
+		glm::vec3 emissiveFactors;
+		float alphaCutoff; // 0 unless the material is alpha masked
+		float metallicFactor;
+		float roughnessFactor;
+		float normalScale;
+		float occlusionStrength;
+		// bindless texture and sampler, see PackTexture
+		uint32_t colorTexture;
+		uint32_t metalRoughTexture;
+		uint32_t normalTexture;
+		uint32_t occlusionTexture;
+		uint32_t emissiveTexture;
+		// the shader side is std430, the array stride rounds up to the vec4
+		uint32_t padding[3];
 	};
+	static_assert(sizeof(MetallicRougness::MaterialConstants) == 80);
 
-	DescriptorWriter writer;
+	static uint32_t PackTexture(uint32_t texture, uint32_t sampler) { return texture | (sampler << 16); };
 
 	void BuildPipelines();
 	void CleanResources();
 
-	MaterialInstance WriteMaterial(MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+	// stores the constants in the bindless material table
+	MaterialInstance WriteMaterial(MaterialPass pass, const MaterialConstants& constants);
 };
@@ -6,4 +6,208 @@
 #include <glm/gtx/quaternion.hpp>
 #include <fastgltf/core.hpp>
 #include <fastgltf/glm_element_traits.hpp>
-#include <fastgltf/tools.hpp>
\ No newline at end of file
+#include <fastgltf/tools.hpp>
+#include <glm/common.hpp>
+#include <glm/gtc/packing.hpp>
+#include <meshoptimizer.h>
+
+// folds the lower hemisphere over the upper one, so the direction fits in two components
+static glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 p{ n.x, n.y };
+	if (n.z < 0.f) {
+		glm::vec2 sign{ p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f };
+		p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * sign;
+	}
+	return p;
+}
+
+void Util::PackVertices(std::span<Vertex> vertices, std::vector<PackedVertex>& packed, glm::vec3& positionOffset, glm::vec3& positionScale)
+{
+	packed.resize(vertices.size());
+	GetPackingRange(vertices, positionOffset, positionScale);
+	PackVertices(vertices, packed.data(), positionOffset, positionScale);
+}
+
+void Util::GetPackingRange(std::span<const Vertex> vertices, glm::vec3& positionOffset, glm::vec3& positionScale)
+{
+	if (vertices.empty()) {
+		positionOffset = glm::vec3(0.f);
+		positionScale = glm::vec3(1.f);
+		return;
+	}
+
+	glm::vec3 minPos = vertices[0].position;
+	glm::vec3 maxPos = vertices[0].position;
+	for (const Vertex& v : vertices) {
+		minPos = glm::min(minPos, v.position);
+		maxPos = glm::max(maxPos, v.position);
+	}
+	positionOffset = minPos;
+	positionScale = maxPos - minPos;
+}
+
+void Util::PackVertices(std::span<const Vertex> vertices, PackedVertex* packed, const glm::vec3& positionOffset, const glm::vec3& positionScale)
+{
+	glm::vec3 invScale = GetPackingInvScale(positionScale);
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const Vertex& v = vertices[i];
+		PackedVertex& p = packed[i];
+
+		PackPosition(p, v.position, positionOffset, invScale);
+		p.normal = PackNormal(v.normal);
+		p.uv = PackUv(glm::vec2(v.uv_x, v.uv_y));
+		p.color = PackColor(v.color);
+	}
+}
+
+glm::vec3 Util::GetPackingInvScale(const glm::vec3& positionScale)
+{
+	// flat axes would divide by zero, any scale decodes them back to the offset
+	return glm::vec3(1.f) / glm::max(positionScale, glm::vec3(1e-20f));
+}
+
+void Util::PackPosition(PackedVertex& packed, glm::vec3 position, const glm::vec3& positionOffset, const glm::vec3& invScale)
+{
+	position = glm::clamp((position - positionOffset) * invScale, 0.f, 1.f);
+	packed.position[0] = (uint16_t)std::round(position.x * 65535.f);
+	packed.position[1] = (uint16_t)std::round(position.y * 65535.f);
+	packed.position[2] = (uint16_t)std::round(position.z * 65535.f);
+	packed.padding = 0;
+}
+
+uint32_t Util::PackNormal(glm::vec3 normal)
+{
+	float length = glm::length(normal);
+	return glm::packSnorm2x16(OctahedralEncode(length > 0.f ? normal / length : glm::vec3(0.f, 0.f, 1.f)));
+}
+
+uint32_t Util::PackUv(glm::vec2 uv)
+{
+	return glm::packHalf2x16(uv);
+}
+
+uint32_t Util::PackColor(glm::vec4 color)
+{
+	return glm::packUnorm4x8(color);
+}
+
+SurfaceOptimizeResult Util::OptimizeSurface(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex)
+{
+	constexpr unsigned int CacheSize = 16;
+	// how much worse than the best order overdraw may make the cache, the default of meshoptimizer
+	constexpr float OverdrawThreshold = 1.05f;
+
+	for (uint32_t& index : indices) {
+		index -= firstVertex;
+	}
+
+	SurfaceOptimizeResult result;
+	result.acmrBefore = meshopt_analyzeVertexCache(indices.data(), indices.size(), vertices.size(), CacheSize, 0, 0).acmr;
+
+	meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), vertices.size());
+	meshopt_optimizeOverdraw(indices.data(), indices.data(), indices.size(), &vertices[0].position.x, vertices.size(), sizeof(Vertex), OverdrawThreshold);
+	meshopt_optimizeVertexFetch(vertices.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
+
+	result.acmrAfter = meshopt_analyzeVertexCache(indices.data(), indices.size(), vertices.size(), CacheSize, 0, 0).acmr;
+
+	for (uint32_t& index : indices) {
+		index += firstVertex;
+	}
+	return result;
+}
+
+void Util::BuildSurfaceLods(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex, float sphereRadius, std::vector<uint32_t>& lodIndices, std::vector<MeshLod>& lods)
+{
+	// past this error a level looks too different to be worth it, relative to the mesh extent
+	constexpr float MaxError = 0.05f;
+	// a level that removes less than this fraction is not kept, and ends the chain
+	constexpr float MinReduction = 0.85f;
+	constexpr size_t MinIndexCount = 3 * 64;
+
+	std::vector<uint32_t> source(indices.begin(), indices.end());
+	for (uint32_t& index : source) {
+		index -= firstVertex;
+	}
+
+	const float* positions = &vertices[0].position.x;
+	float meshScale = meshopt_simplifyScale(positions, vertices.size(), sizeof(Vertex));
+
+	std::vector<uint32_t> simplified(source.size());
+	size_t previousCount = source.size();
+	for (uint32_t lod = 1; lod < MeshDraw::MaxLods; lod++) {
+		size_t targetCount = (source.size() >> lod) / 3 * 3;
+		if (targetCount < MinIndexCount)
+			break;
+
+		// always from the full surface so the error is against what lod 0 looks like, borders stay
+		// locked so neighbouring surfaces don't open cracks
+		float error = 0.f;
+		size_t count = meshopt_simplify(simplified.data(), source.data(), source.size(), positions, vertices.size(), sizeof(Vertex),
+			targetCount, MaxError, meshopt_SimplifyLockBorder, &error);
+		if (count == 0 || count > previousCount * MinReduction)
+			break;
+
+		meshopt_optimizeVertexCache(simplified.data(), simplified.data(), count, vertices.size());
+
+		MeshLod newLod;
+		newLod.firstIndex = (uint32_t)lodIndices.size();
+		newLod.indexCount = (uint32_t)count;
+		newLod.error = sphereRadius > 0.f ? error * meshScale / sphereRadius : 0.f;
+		lods.push_back(newLod);
+
+		for (size_t i = 0; i < count; i++) {
+			lodIndices.push_back(simplified[i] + firstVertex);
+		}
+		previousCount = count;
+	}
+}
+
+void Util::BuildSurfaceMeshlets(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex, std::vector<GPUMeshlet>& meshlets, std::vector<uint32_t>& meshletData)
+{
+	// a bit of weight on the normal cone makes more meshlets cullable from behind
+	constexpr float ConeWeight = 0.25f;
+
+	std::vector<uint32_t> source(indices.begin(), indices.end());
+	for (uint32_t& index : source) {
+		index -= firstVertex;
+	}
+
+	const float* positions = &vertices[0].position.x;
+	size_t maxMeshlets = meshopt_buildMeshletsBound(source.size(), GPUMeshlet::MaxVertices, GPUMeshlet::MaxTriangles);
+	std::vector<meshopt_Meshlet> built(maxMeshlets);
+	std::vector<uint32_t> meshletVertices(maxMeshlets * GPUMeshlet::MaxVertices);
+	std::vector<uint8_t> meshletTriangles(maxMeshlets * GPUMeshlet::MaxTriangles * 3);
+	size_t count = meshopt_buildMeshlets(built.data(), meshletVertices.data(), meshletTriangles.data(), source.data(), source.size(),
+		positions, vertices.size(), sizeof(Vertex), GPUMeshlet::MaxVertices, GPUMeshlet::MaxTriangles, ConeWeight);
+
+	uint32_t index = 0;
+	for (size_t i = 0; i < count; i++) {
+		const meshopt_Meshlet& m = built[i];
+		const uint32_t* localVertices = &meshletVertices[m.vertex_offset];
+		const uint8_t* localTriangles = &meshletTriangles[m.triangle_offset];
+		meshopt_Bounds bounds = meshopt_computeMeshletBounds(localVertices, localTriangles, m.triangle_count, positions, vertices.size(), sizeof(Vertex));
+
+		GPUMeshlet meshlet;
+		meshlet.sphere = glm::vec4(bounds.center[0], bounds.center[1], bounds.center[2], bounds.radius);
+		meshlet.cone = glm::vec4(bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2], bounds.cone_cutoff);
+		meshlet.firstIndex = index;
+		meshlet.vertexOffset = (uint32_t)meshletData.size();
+		meshlet.triangleOffset = meshlet.vertexOffset + m.vertex_count;
+		meshlet.counts = m.vertex_count | (m.triangle_count << 16);
+		meshlets.push_back(meshlet);
+
+		for (uint32_t v = 0; v < m.vertex_count; v++) {
+			meshletData.push_back(localVertices[v] + firstVertex);
+		}
+		for (uint32_t t = 0; t < m.triangle_count; t++) {
+			const uint8_t* triangle = &localTriangles[t * 3];
+			meshletData.push_back(triangle[0] | (triangle[1] << 8) | (triangle[2] << 16));
+			indices[index++] = localVertices[triangle[0]] + firstVertex;
+			indices[index++] = localVertices[triangle[1]] + firstVertex;
+			indices[index++] = localVertices[triangle[2]] + firstVertex;
+		}
+	}
+}
@@ -1,13 +1,22 @@
 #pragma once
 #include "Materials.h"
+#include "IndexPool.h"
 
 #include <unordered_map>
 #include <filesystem>
 struct MeshBuffers {
 
-	AllocatedBuffer indexBuffer;
+	// in the shared index buffer of its type, 16 bit whenever every vertex can be addressed with it
+	IndexPool::Range indices;
+	// left out, with a 0 address, for a mesh without vertices
 	AllocatedBuffer vertexBuffer;
-	VkDeviceAddress vertexBufferAddress;
+	VkDeviceAddress vertexBufferAddress{ 0 };
+	// packed positions are decoded as offset + position * scale
+	glm::vec3 positionOffset{ 0.f };
+	glm::vec3 positionScale{ 1.f };
+	// meshlet descriptors followed by their vertex and triangle lists
+	AllocatedBuffer meshletBuffer;
+	VkDeviceAddress meshletBufferAddress{ 0 };
 };
 
 struct Bounds {
@@ -16,12 +25,78 @@ struct Bounds {
 	glm::vec3 extents;
 };
 
+// cpu copy of a surface, rasterized by the software occlusion pass
+struct OccluderMesh {
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+// one level of detail of a surface, an index range in the same buffers as the full one
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // simplification error relative to the bounding sphere radius
+};
+
+// a cluster of lod 0 triangles that the gpu culls on its own, std430 compatible
+struct GPUMeshlet
+{
+	static constexpr uint32_t MaxVertices = 64;
+	static constexpr uint32_t MaxTriangles = 124;
+
+	glm::vec4 sphere; // xyz for the local center, w for the radius
+	glm::vec4 cone; // xyz for the axis, w for the cutoff. backfacing when seen from inside the cone
+	uint32_t firstIndex; // the triangles are a contiguous range of the index buffer
+	// into the meshlet buffer in uints, read by the mesh shader path
+	uint32_t vertexOffset;
+	uint32_t triangleOffset; // one uint per triangle, three 8 bit local vertex indices
+	uint32_t counts; // vertex count in the low 16 bits, triangle count in the high 16 bits
+};
+
+// cpu side data of one mesh, handed to Engine::UploadMeshes. may point into a mapped file
+struct MeshUpload {
+	std::span<const uint32_t> indices;
+	std::span<const PackedVertex> vertices;
+	std::span<const GPUMeshlet> meshlets;
+	std::span<const uint32_t> meshletData;
+	// when set, called on a worker to write vertexCount vertices straight into the staging memory instead of copying vertices
+	std::function<void(PackedVertex* staging)> writeVertices;
+	size_t vertexCount{ 0 };
+
+	size_t GetVertexCount() const { return writeVertices ? vertexCount : vertices.size(); };
+};
+
 struct GeoSurface
 {
 	uint32_t startIndex;
 	uint32_t count;
 	Bounds bounds;
 	std::shared_ptr<Material> material;
+	std::shared_ptr<OccluderMesh> occluder;
+	uint32_t meshId; // entry in the gpu scene mesh table
+	// lod 0 is the full surface, each next one has about half the triangles
+	std::vector<MeshLod> lods;
+	// meshlets of lod 0 in the meshlet buffer of the mesh
+	uint32_t firstMeshlet{ 0 };
+	uint32_t meshletCount{ 0 };
+};
+
+// what a draw needs to know about a surface, kept in a table so draw packets can refer to it by index
+struct MeshDraw
+{
+	static constexpr uint32_t MaxLods = 5;
+
+	// the index buffer is the pool's one of this type, the lods are absolute ranges in it
+	VkIndexType indexType;
+	// where the mesh starts in the pool, meshlet index ranges are relative to it
+	uint32_t indexBase;
+	VkDeviceAddress vertexBuffer;
+	MeshLod lods[MaxLods];
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	Bounds bounds;
+	const OccluderMesh* occluder;
 };
 
 
@@ -30,4 +105,33 @@ struct MeshAsset
 	std::string name;
 	std::vector<GeoSurface> surfaces;
 	MeshBuffers meshBuffers;
-};
\ No newline at end of file
+};
+
+// average vertex shader invocations per triangle, for a 16 entry fifo cache
+struct SurfaceOptimizeResult {
+	float acmrBefore;
+	float acmrAfter;
+};
+
+namespace Util {
+	// quantizes the vertices against their bounds, the offset and scale undo the position quantization
+	void PackVertices(std::span<Vertex> vertices, std::vector<PackedVertex>& packed, glm::vec3& positionOffset, glm::vec3& positionScale);
+	// the two halves of it, so the packed vertices can be written straight into staging memory
+	void GetPackingRange(std::span<const Vertex> vertices, glm::vec3& positionOffset, glm::vec3& positionScale);
+	void PackVertices(std::span<const Vertex> vertices, PackedVertex* packed, const glm::vec3& positionOffset, const glm::vec3& positionScale);
+	// one attribute at a time, for vertices read from the file straight into the packed layout
+	glm::vec3 GetPackingInvScale(const glm::vec3& positionScale);
+	void PackPosition(PackedVertex& packed, glm::vec3 position, const glm::vec3& positionOffset, const glm::vec3& invScale);
+	uint32_t PackNormal(glm::vec3 normal);
+	uint32_t PackUv(glm::vec2 uv);
+	uint32_t PackColor(glm::vec4 color);
+	// reorders the triangles of one surface for the post transform cache and then for overdraw, and its
+	// vertices in the order they are first used. indices point into the mesh, vertices start at firstVertex
+	SurfaceOptimizeResult OptimizeSurface(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex);
+	// simplifies a surface into up to MeshDraw::MaxLods - 1 coarser index lists, written one after another into
+	// lodIndices. the lod ranges start at 0 in lodIndices, the error is relative to sphereRadius
+	void BuildSurfaceLods(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex, float sphereRadius, std::vector<uint32_t>& lodIndices, std::vector<MeshLod>& lods);
+	// splits a surface into meshlets and rewrites its indices so every meshlet is a contiguous range. firstIndex
+	// is relative to the start of indices and the offsets to the start of meshletData, the vertex lists point into the mesh
+	void BuildSurfaceMeshlets(std::span<uint32_t> indices, std::span<Vertex> vertices, uint32_t firstVertex, std::vector<GPUMeshlet>& meshlets, std::vector<uint32_t>& meshletData);
+}
@@ -0,0 +1,195 @@
+#include "MipGenerator.h"
+#include "Engine.h"
+#include "Pipelines.h"
+#include "Initializers.h"
+#include "Images.h"
+
+#include <algorithm>
+
+void MipGenerator::BuildPipelines()
+{
+	VkDevice device = Engine::Get()->GetDevice();
+	VkShaderModule mipShader = Util::LoadShader("generate_mips.comp.spv");
+
+	{
+		DescriptorLayoutBuilder builder;
+		builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MaxMipLevels);
+		_descriptorLayout = builder.Build(VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(PushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = Init::PipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &_descriptorLayout;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	layoutInfo.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_layout));
+
+	VkComputePipelineCreateInfo computePipelineInfo = { .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	computePipelineInfo.layout = _layout;
+	computePipelineInfo.stage = Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, mipShader);
+
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &_pipeline));
+
+	vkDestroyShaderModule(device, mipShader, nullptr);
+
+	// the first level is read with texelFetch, the filter never matters
+	VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &_sampler));
+
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, (float)MaxMipLevels },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
+	};
+	_descriptorAllocator.Init(64, sizes);
+}
+
+void MipGenerator::CleanResources()
+{
+	VkDevice device = Engine::GetMainDevice();
+	Reset();
+	_descriptorAllocator.DestroyPools();
+	vkDestroyPipeline(device, _pipeline, nullptr);
+	vkDestroyPipelineLayout(device, _layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, _descriptorLayout, nullptr);
+	vkDestroySampler(device, _sampler, nullptr);
+}
+
+bool MipGenerator::SupportsFormat(VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(Engine::Get()->GetPhysicalDevice(), format, &properties);
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+void MipGenerator::Record(VkCommandBuffer cmd, std::span<const AllocatedImage> images)
+{
+	Engine* engine = Engine::Get();
+	VkDevice device = engine->GetDevice();
+	if (images.empty())
+		return;
+
+	// one counter per image, then the scratch texels from level 5 down, which only chains longer than 6 levels need
+	std::vector<VkDeviceSize> scratchOffsets(images.size());
+	VkDeviceSize scratchSize = sizeof(uint32_t) * images.size();
+	for (size_t i = 0; i < images.size(); i++) {
+		scratchSize = (scratchSize + 15) & ~VkDeviceSize(15);
+		scratchOffsets[i] = scratchSize;
+		VkExtent3D levelSize = images[i].imageExtent;
+		uint32_t levelCount = Util::GetMipLevelCount(levelSize);
+		for (uint32_t level = 1; level < levelCount; level++) {
+			levelSize.width = std::max(levelSize.width / 2, 1u);
+			levelSize.height = std::max(levelSize.height / 2, 1u);
+			if (level >= 5)
+				scratchSize += sizeof(float) * 4 * levelSize.width * levelSize.height;
+		}
+	}
+	_scratchBuffer = engine->CreateBuffer(scratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VMA_MEMORY_USAGE_GPU_ONLY);
+	_hasScratch = true;
+	VkDeviceAddress scratchAddress = engine->GetBufferAddress(_scratchBuffer);
+	vkCmdFillBuffer(cmd, _scratchBuffer.buffer, 0, sizeof(uint32_t) * images.size(), 0);
+
+	// one barrier for the whole batch, the copies and the counter reset against the dispatches
+	std::vector<VkImageMemoryBarrier2> imageBarriers(images.size());
+	for (size_t i = 0; i < images.size(); i++) {
+		VkImageMemoryBarrier2& barrier = imageBarriers[i];
+		barrier = { .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.subresourceRange = Init::ImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+		barrier.image = images[i].image;
+	}
+	VkMemoryBarrier2 counterBarrier{ .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+	counterBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+	counterBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	counterBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.memoryBarrierCount = 1;
+	depInfo.pMemoryBarriers = &counterBarrier;
+	depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+	depInfo.pImageMemoryBarriers = imageBarriers.data();
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	DescriptorWriter writer;
+	for (size_t i = 0; i < images.size(); i++) {
+		const AllocatedImage& image = images[i];
+		uint32_t levelCount = std::min(Util::GetMipLevelCount(image.imageExtent), MaxMipLevels);
+		if (levelCount < 2)
+			continue;
+
+		VkDescriptorSet set = _descriptorAllocator.Allocate(_descriptorLayout);
+		writer.Clear();
+		for (uint32_t level = 0; level < levelCount; level++) {
+			VkImageViewCreateInfo viewInfo = Init::ImageViewCreateInfo(image.imageFormat, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+			viewInfo.subresourceRange.baseMipLevel = level;
+			viewInfo.subresourceRange.levelCount = 1;
+
+			VkImageView view;
+			VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &view));
+			_views.push_back(view);
+
+			if (level == 0)
+				writer.WriteImage(0, view, _sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+			writer.WriteImage(1, view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, level);
+		}
+		// the shader never touches the slots past the last level, but they still need something valid
+		for (uint32_t level = levelCount; level < MaxMipLevels; level++) {
+			writer.WriteImage(1, _views.back(), VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, level);
+		}
+		writer.UpdateSet(set);
+
+		uint32_t groupsX = (image.imageExtent.width + 31) / 32;
+		uint32_t groupsY = (image.imageExtent.height + 31) / 32;
+		PushConstants pushConstants;
+		pushConstants.scratch = scratchAddress + scratchOffsets[i];
+		pushConstants.counter = scratchAddress + sizeof(uint32_t) * i;
+		pushConstants.levelCount = levelCount;
+		pushConstants.groupCount = groupsX * groupsY;
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &set, 0, nullptr);
+		vkCmdPushConstants(cmd, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+		vkCmdDispatch(cmd, groupsX, groupsY, 1);
+	}
+
+	for (VkImageMemoryBarrier2& barrier : imageBarriers) {
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	depInfo.memoryBarrierCount = 0;
+	vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+void MipGenerator::Reset()
+{
+	VkDevice device = Engine::GetMainDevice();
+	for (VkImageView view : _views) {
+		vkDestroyImageView(device, view, nullptr);
+	}
+	_views.clear();
+	_descriptorAllocator.ClearPools();
+	if (_hasScratch) {
+		Engine::Get()->DestroyBuffer(_scratchBuffer);
+		_hasScratch = false;
+	}
+}
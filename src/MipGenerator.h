@@ -0,0 +1,40 @@
+#pragma once
+#include "Descriptors.h"
+
+// fills every mip level of a texture from the first one with a single compute dispatch.
+// all images of a batch are recorded into one command buffer, with one barrier before and one after
+class MipGenerator
+{
+public:
+	// as many storage image slots as the shader has
+	static constexpr uint32_t MaxMipLevels = 16;
+
+	void BuildPipelines();
+	void CleanResources();
+
+	// the compute path needs storage writes, formats without them fall back to blits
+	bool SupportsFormat(VkFormat format);
+
+	// the images need storage usage and all of their levels in transfer dst layout, they end up shader read only.
+	// the views, descriptors and scratch memory live until Reset, which may only run once the commands finished
+	void Record(VkCommandBuffer cmd, std::span<const AllocatedImage> images);
+	void Reset();
+
+private:
+	struct PushConstants {
+		VkDeviceAddress scratch;
+		VkDeviceAddress counter;
+		uint32_t levelCount;
+		uint32_t groupCount;
+	};
+
+	VkPipeline _pipeline;
+	VkPipelineLayout _layout;
+	VkDescriptorSetLayout _descriptorLayout;
+	VkSampler _sampler;
+	DescriptorAllocatorGrowable _descriptorAllocator;
+
+	std::vector<VkImageView> _views;
+	AllocatedBuffer _scratchBuffer;
+	bool _hasScratch{ false };
+};
@@ -119,6 +119,15 @@ void PipelineBuilder::SetShaders(VkShaderModule vertexShader, VkShaderModule fra
 
 }
 
+void PipelineBuilder::SetMeshShaders(VkShaderModule taskShader, VkShaderModule meshShader, VkShaderModule fragmentShader)
+{
+	// vertex input and input assembly are ignored once a mesh stage is present
+	shaderStages.clear();
+	shaderStages.push_back(Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_TASK_BIT_EXT, taskShader));
+	shaderStages.push_back(Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_MESH_BIT_EXT, meshShader));
+	shaderStages.push_back(Init::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
+}
+
 void PipelineBuilder::SetInputTopology(VkPrimitiveTopology topology)
 {
 	inputAssembly.topology = topology;
@@ -26,6 +26,7 @@ public:
 	VkPipeline BuildPipeline(VkDevice device);
 
 	void SetShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+	void SetMeshShaders(VkShaderModule taskShader, VkShaderModule meshShader, VkShaderModule fragmentShader);
 	void SetInputTopology(VkPrimitiveTopology topology);
 	void SetPolygonMode(VkPolygonMode mode);
 	void SetCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace);
@@ -1,12 +1,21 @@
 #include "Render.h"
 #include "Engine.h"
 #include "Images.h"
+#include "SoftwareOcclusion.h"
+#include "AssetCache.h"
+#include "TextureCompression.h"
 
 #include <glm/gtx/matrix_decompose.hpp>
 #include <fastgltf/core.hpp>
 #include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/tools.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <functional>
+
 VkFilter ExtractFilter(fastgltf::Filter filter)
 {
     switch (filter) {
@@ -60,19 +69,55 @@ void Node::RefreshWorldTransform(const glm::mat4& parentMatrix)
     }
 }
 
+MeshNode::~MeshNode()
+{
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+	for (uint32_t id : _objectIds) {
+		scene.FreeObject(id);
+	}
+}
+
 void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
 {
-	glm::mat4 nodeMatrix = topMatrix * GetWorldTransform();
+	glm::mat3x4 nodeTransform = ToAffine(topMatrix * GetWorldTransform());
+
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+	bool firstDraw = _objectIds.empty();
+	if (firstDraw) {
+		for (size_t i = 0; i < _mesh->surfaces.size(); i++) {
+			_objectIds.push_back(scene.AllocateObject());
+		}
+	}
+	if (firstDraw || nodeTransform != _uploadedTransform) {
+		_uploadedTransform = nodeTransform;
+		for (size_t i = 0; i < _mesh->surfaces.size(); i++) {
+			const GeoSurface& s = _mesh->surfaces[i];
+			GPUObjectData data{};
+			data.transform = nodeTransform;
+			data.sphereBounds = glm::vec4(s.bounds.origin, s.bounds.sphereRadius);
+			data.positionOffset = _mesh->meshBuffers.positionOffset;
+			data.positionScale = _mesh->meshBuffers.positionScale;
+			data.vertexBuffer = _mesh->meshBuffers.vertexBufferAddress;
+			data.firstIndex = s.startIndex;
+			data.indexCount = s.count;
+			data.materialIndex = s.material->data.materialIndex;
+			data.meshletBuffer = _mesh->meshBuffers.meshletBufferAddress;
+			data.firstMeshlet = s.firstMeshlet;
+			data.meshletCount = s.meshletCount;
+			scene.UpdateObject(_objectIds[i], data);
+			// what the cull pass draws stays the same for the life of the node
+			if (firstDraw)
+				scene.SetDraw(_objectIds[i], s.meshId, s.material->data.materialIndex);
+		}
+	}
 
-	for (auto& s : _mesh->surfaces) {
+	for (size_t i = 0; i < _mesh->surfaces.size(); i++) {
+		const GeoSurface& s = _mesh->surfaces[i];
 		RenderObject def;
-		def.indexCount = s.count;
-		def.firstIndex = s.startIndex;
-		def.indexBuffer =_mesh->meshBuffers.indexBuffer.buffer;
-		def.material = &s.material->data;
-        def.bounds = s.bounds;
-		def.transform = nodeMatrix;
-		def.vertexBufferAddress = _mesh->meshBuffers.vertexBufferAddress;
+		def.objectId = _objectIds[i];
+		def.meshId = s.meshId;
+		def.materialId = s.material->data.materialIndex;
+		def.lod = 0;
 
         if (s.material->data.passType == MaterialPass::Transparent)
             ctx.transparentSurfaces.push_back(def);
@@ -83,25 +128,325 @@ void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
 	Node::Draw(topMatrix, ctx);
 }
 
-std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::Load(std::string_view filePath)
+// ktx2 and dds images come through their extensions, the plain image is the fallback for viewers without them.
+// basis payloads transcode to rgba8 on devices without bc, dds files hold blocks as they are
+static std::optional<size_t> GetTextureImage(const fastgltf::Texture& texture)
+{
+    if (texture.basisuImageIndex.has_value())
+        return texture.basisuImageIndex.value();
+    if (texture.ddsImageIndex.has_value() && (Engine::Get()->IsTextureCompressionBCSupported() || !texture.imageIndex.has_value()))
+        return texture.ddsImageIndex.value();
+    if (texture.imageIndex.has_value())
+        return texture.imageIndex.value();
+    return {};
+}
+
+// cpu side geometry of a mesh while it is being loaded
+struct MeshData {
+    std::vector<uint32_t> indices;
+    // left empty when the vertices are read straight into the packed layout, which is what the
+    // count, the position range and the key of the attributes are kept for
+    std::vector<Vertex> vertices;
+    size_t vertexCount{ 0 };
+    glm::vec3 minPos{ FLT_MAX };
+    glm::vec3 maxPos{ -FLT_MAX };
+    uint64_t vertexKey{ 0 };
+};
+
+// images are shared by their encoded bytes and what the load turns them into, the cooker picks its
+// block format by what the materials read from the image. zero when there are no bytes to key by
+static uint64_t GetImageKey(std::span<const uint8_t> bytes, bool compressed, TextureChannels channels)
+{
+    if (bytes.empty())
+        return 0;
+    uint32_t variant = compressed ? 1 + (uint32_t)channels : 0;
+    uint64_t key = Cooked::HashBytes(Cooked::HashSeed, bytes.data(), bytes.size());
+    return Cooked::HashBytes(key, &variant, sizeof(uint32_t));
+}
+
+// the packed vertices and the meshlet offsets follow from these, so they don't need hashing themselves
+static uint64_t GetMeshKey(const MeshData& data, std::span<const GPUMeshlet> meshlets, std::span<const uint32_t> meshletData)
+{
+    uint64_t key = Cooked::HashBytes(Cooked::HashSeed, data.indices.data(), data.indices.size() * sizeof(uint32_t));
+    key = Cooked::HashBytes(key, data.vertices.data(), data.vertices.size() * sizeof(Vertex));
+    key = Cooked::HashBytes(key, &data.vertexKey, sizeof(uint64_t));
+    key = Cooked::HashBytes(key, meshlets.data(), meshlets.size_bytes());
+    return Cooked::HashBytes(key, meshletData.data(), meshletData.size_bytes());
+}
+
+// raw bytes and stride of a plain accessor of the given component type, null when it needs
+// fastgltf's general path because it is sparse, normalized or stored differently
+static const std::byte* GetAccessorBytes(const fastgltf::Asset& asset, const fastgltf::Accessor& accessor, fastgltf::ComponentType componentType, size_t& stride)
+{
+    if (accessor.componentType != componentType || accessor.normalized || accessor.sparse.has_value() || !accessor.bufferViewIndex.has_value())
+        return nullptr;
+
+    const fastgltf::BufferView& bufferView = asset.bufferViews[*accessor.bufferViewIndex];
+    const std::byte* bufferData = fastgltf::DefaultBufferDataAdapter{}(asset.buffers[bufferView.bufferIndex]);
+    if (!bufferData)
+        return nullptr;
+    stride = bufferView.byteStride.value_or(fastgltf::getElementByteSize(accessor.type, accessor.componentType));
+    return bufferData + bufferView.byteOffset + accessor.byteOffset;
+}
+
+// one tight loop per index width, offset to the first vertex of the surface
+static void ReadIndices(const fastgltf::Asset& asset, const fastgltf::Accessor& accessor, uint32_t firstVertex, uint32_t* indices)
+{
+    size_t stride;
+    if (const std::byte* src = GetAccessorBytes(asset, accessor, fastgltf::ComponentType::UnsignedShort, stride)) {
+        for (size_t i = 0; i < accessor.count; i++) {
+            uint16_t index;
+            memcpy(&index, src + i * stride, sizeof(uint16_t));
+            indices[i] = index + firstVertex;
+        }
+    }
+    else if (const std::byte* src = GetAccessorBytes(asset, accessor, fastgltf::ComponentType::UnsignedInt, stride)) {
+        for (size_t i = 0; i < accessor.count; i++) {
+            uint32_t index;
+            memcpy(&index, src + i * stride, sizeof(uint32_t));
+            indices[i] = index + firstVertex;
+        }
+    }
+    else if (const std::byte* src = GetAccessorBytes(asset, accessor, fastgltf::ComponentType::UnsignedByte, stride)) {
+        for (size_t i = 0; i < accessor.count; i++) {
+            indices[i] = (uint8_t)src[i * stride] + firstVertex;
+        }
+    }
+    else {
+        size_t i = 0;
+        fastgltf::iterateAccessor<std::uint32_t>(asset, accessor,
+            [&](std::uint32_t index) {
+                indices[i++] = index + firstVertex;
+            });
+    }
+}
+
+// float attributes are read straight from the buffer in a loop the compiler can unroll and vectorize,
+// with write inlined into it. anything else goes through fastgltf's converting iterator
+template<typename T, typename Write>
+static void ReadAttribute(const fastgltf::Asset& asset, const fastgltf::Accessor& accessor, Write&& write)
+{
+    size_t stride;
+    const std::byte* src = fastgltf::getNumComponents(accessor.type) * sizeof(float) == sizeof(T)
+        ? GetAccessorBytes(asset, accessor, fastgltf::ComponentType::Float, stride) : nullptr;
+    if (src) {
+        for (size_t i = 0; i < accessor.count; i++) {
+            T value;
+            memcpy(&value, src + i * stride, sizeof(T));
+            write(value, i);
+        }
+    }
+    else {
+        fastgltf::iterateAccessorWithIndex<T>(asset, accessor, write);
+    }
+}
+
+// folds the values of an accessor into key, for the meshes that never hold their vertices
+template<typename T>
+static void HashAttribute(const fastgltf::Asset& asset, const fastgltf::Accessor& accessor, uint64_t& key)
+{
+    ReadAttribute<T>(asset, accessor, [&](T v, size_t) {
+        key = Cooked::HashBytes(key, &v, sizeof(T));
+        });
+}
+
+// every primitive of a mesh read from its accessors straight into the packed layout, one after another.
+// what a primitive lacks gets the same defaults as the Vertex path
+static void ReadPackedVertices(const fastgltf::Asset& asset, const fastgltf::Mesh& mesh, const glm::vec3& positionOffset, const glm::vec3& positionScale, PackedVertex* packed)
+{
+    glm::vec3 invScale = Util::GetPackingInvScale(positionScale);
+    PackedVertex defaultVertex{};
+    defaultVertex.normal = Util::PackNormal(glm::vec3{ 1, 0, 0 });
+    defaultVertex.uv = Util::PackUv(glm::vec2{ 0.f });
+    defaultVertex.color = Util::PackColor(glm::vec4{ 1.f });
+
+    for (auto&& p : mesh.primitives) {
+        const fastgltf::Accessor& posAccessor = asset.accessors[p.findAttribute("POSITION")->second];
+        PackedVertex* surfaceVertices = packed;
+        std::fill(surfaceVertices, surfaceVertices + posAccessor.count, defaultVertex);
+        packed += posAccessor.count;
+
+        ReadAttribute<glm::vec3>(asset, posAccessor,
+            [&](glm::vec3 v, size_t index) {
+                Util::PackPosition(surfaceVertices[index], v, positionOffset, invScale);
+            });
+
+        auto normals = p.findAttribute("NORMAL");
+        if (normals != p.attributes.end()) {
+            ReadAttribute<glm::vec3>(asset, asset.accessors[(*normals).second],
+                [&](glm::vec3 v, size_t index) {
+                    surfaceVertices[index].normal = Util::PackNormal(v);
+                });
+        }
+        auto uv = p.findAttribute("TEXCOORD_0");
+        if (uv != p.attributes.end()) {
+            ReadAttribute<glm::vec2>(asset, asset.accessors[(*uv).second],
+                [&](glm::vec2 v, size_t index) {
+                    surfaceVertices[index].uv = Util::PackUv(v);
+                });
+        }
+        auto colors = p.findAttribute("COLOR_0");
+        if (colors != p.attributes.end()) {
+            ReadAttribute<glm::vec4>(asset, asset.accessors[(*colors).second],
+                [&](glm::vec4 v, size_t index) {
+                    surfaceVertices[index].color = Util::PackColor(v);
+                });
+        }
+    }
+}
+
+// the vertices a surface owns inside its mesh
+struct SurfaceRange {
+    uint32_t mesh;
+    uint32_t surface;
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+};
+
+// a surface placed in the world by a node that never moves
+struct StaticInstance {
+    uint32_t range; // into the surface ranges
+    glm::mat4 transform;
+    glm::vec3 center; // world space bounding sphere
+    float radius;
+    uint32_t triangles;
+};
+
+glm::mat4 GetLocalMatrix(const fastgltf::Node& node)
+{
+    glm::mat4 local{ 1.f };
+    std::visit(fastgltf::visitor{ [&](const fastgltf::Node::TransformMatrix& matrix) {
+                                      memcpy(&local, matrix.data(), sizeof(matrix));
+                                  },
+                   [&](const fastgltf::TRS& transform) {
+                       glm::vec3 tl(transform.translation[0], transform.translation[1],
+                           transform.translation[2]);
+                       glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1],
+                           transform.rotation[2]);
+                       glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+                       glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
+                       glm::mat4 rm = glm::toMat4(rot);
+                       glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+
+                       local = tm * rm * sm;
+                   } },
+        node.transform);
+    return local;
+}
+
+// splits instances of one material along the longest axis of their centers until every chunk is small enough
+// to be culled on its own, either by triangle count or by its extent
+void SplitStaticChunk(std::vector<StaticInstance*> instances, float maxRadius, std::vector<std::vector<StaticInstance*>>& chunks)
+{
+    constexpr uint32_t MaxChunkTriangles = 16384;
+
+    uint32_t triangles = 0;
+    glm::vec3 minBounds{ FLT_MAX }, maxBounds{ -FLT_MAX };
+    glm::vec3 minCenter{ FLT_MAX }, maxCenter{ -FLT_MAX };
+    for (StaticInstance* instance : instances) {
+        triangles += instance->triangles;
+        minBounds = glm::min(minBounds, instance->center - instance->radius);
+        maxBounds = glm::max(maxBounds, instance->center + instance->radius);
+        minCenter = glm::min(minCenter, instance->center);
+        maxCenter = glm::max(maxCenter, instance->center);
+    }
+
+    glm::vec3 centerExtent = maxCenter - minCenter;
+    float radius = glm::length(maxBounds - minBounds) / 2.f;
+    bool fits = triangles <= MaxChunkTriangles && radius <= maxRadius;
+    if (instances.size() == 1 || fits || glm::length(centerExtent) == 0.f) {
+        chunks.push_back(std::move(instances));
+        return;
+    }
+
+    int axis = centerExtent.x > centerExtent.y ? (centerExtent.x > centerExtent.z ? 0 : 2) : (centerExtent.y > centerExtent.z ? 1 : 2);
+    size_t middle = instances.size() / 2;
+    std::nth_element(instances.begin(), instances.begin() + middle, instances.end(), [axis](StaticInstance* a, StaticInstance* b) {
+        return a->center[axis] < b->center[axis];
+        });
+
+    SplitStaticChunk(std::vector<StaticInstance*>(instances.begin(), instances.begin() + middle), maxRadius, chunks);
+    SplitStaticChunk(std::vector<StaticInstance*>(instances.begin() + middle, instances.end()), maxRadius, chunks);
+}
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::Load(std::string_view filePath, const GLTFLoadOptions& options)
+{
+    return LoadFile(filePath, options, [](const std::shared_ptr<LoadedGLTF>& scene) { scene->Publish(); });
+}
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::LoadFile(std::string_view filePath, const GLTFLoadOptions& options, const PublishFunction& publish)
 {
     fmt::println("Loading GLTF: {}", filePath);
     Engine* engine = Engine::Get();
+    JobSystem& jobs = engine->GetJobSystem();
+
+    auto phaseStart = std::chrono::system_clock::now();
+    // milliseconds since the previous call, for the timing breakdown at the end
+    auto lapTime = [&]() {
+        auto now = std::chrono::system_clock::now();
+        float elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - phaseStart).count() / 1000.f;
+        phaseStart = now;
+        return elapsed;
+    };
+    // the serial path runs the exact same jobs in index order, for comparing and debugging
+    auto forEach = [&](uint32_t count, const std::function<void(uint32_t)>& function) {
+        if (options.parallel) {
+            jobs.ParallelFor(count, function);
+        }
+        else {
+            for (uint32_t i = 0; i < count; i++) {
+                function(i);
+            }
+        }
+    };
+    uint64_t contentHash = Cooked::HashSeed;
     std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
     LoadedGLTF& file = *scene.get();
 
-    fastgltf::Parser parser{};
+    std::filesystem::path path = filePath;
+    // the parser and every accessor read the file in place, the pages are released after the upload.
+    // copy on write, because the parser zeroes its padding behind the end of the data
+    MappedFile source;
+    bool mapped = source.Open(path, true);
+    const size_t sourceSize = source.GetSize();
+
+    // keyed by the source bytes, so a hit never gets as far as the gltf parser
+    std::unique_ptr<CookedWriter> cooker;
+    std::filesystem::path cachePath;
+    uint64_t sourceKey = 0;
+    // cooked images are bc blocks
+    if (options.useCache && engine->IsTextureCompressionBCSupported()) {
+        if (mapped) {
+            sourceKey = Cooked::GetSourceKey(source, options);
+            cachePath = Cooked::GetCachePath(path);
+            auto cooked = LoadCooked(cachePath, sourceKey, options);
+            if (cooked.has_value()) {
+                fmt::println("Loaded cooked {} in {:.1f} ms", cachePath.string(), lapTime());
+                publish(*cooked);
+                return cooked;
+            }
+            if (options.cook)
+                cooker = std::make_unique<CookedWriter>();
+            else
+                fmt::println("No cooked copy of {}, --cook {} writes one", filePath, filePath);
+        }
+    }
+
+    fastgltf::Parser parser(fastgltf::Extensions::KHR_texture_basisu | fastgltf::Extensions::MSFT_texture_dds);
 
-    constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
+    // without LoadGLBBuffers the binary chunk stays a view into the data buffer instead of being copied out
+    constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadExternalBuffers;
     // fastgltf::Options::LoadExternalImages;
 
+    // the parser wants some padding after the data, when the last page has no room for it
+    // fromByteView falls back to a copy
     fastgltf::GltfDataBuffer data;
-    data.loadFromFile(filePath);
+    if (!mapped || !data.fromByteView(const_cast<uint8_t*>(source.GetData()), source.GetSize(), source.GetCapacity()))
+        data.loadFromFile(filePath);
 
     fastgltf::Asset gltf;
 
-    std::filesystem::path path = filePath;
-
     auto type = fastgltf::determineGltfFileType(&data);
     if (type == fastgltf::GltfType::glTF)
     {
@@ -130,194 +475,746 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::Load(std::string_view fil
         fmt::println("Failed to determine glTF container");
         return {};
     }
-    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 } };
-
-    file._descriptorPool.Init(gltf.materials.size(), sizes);
+    float parseTime = lapTime();
+    BindlessResources& bindless = engine->GetBindless();
 
     for (fastgltf::Sampler& sampler : gltf.samplers) {
-
-        VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr };
-        sampl.maxLod = VK_LOD_CLAMP_NONE;
-        sampl.minLod = 0;
-
-        sampl.magFilter = ExtractFilter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
-        sampl.minFilter = ExtractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
-
-        sampl.mipmapMode = ExtractMipmapMode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
-
-        VkSampler newSampler;
-        vkCreateSampler(engine->GetDevice(), &sampl, nullptr, &newSampler);
-
-        file._samplers.push_back(newSampler);
+        Cooked::Sampler filters;
+        filters.magFilter = ExtractFilter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
+        filters.minFilter = ExtractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+        filters.mipmapMode = ExtractMipmapMode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+        file.AddSampler(filters);
+        if (cooker)
+            cooker->samplers.push_back(filters);
     }
     std::vector<std::shared_ptr<MeshAsset>> meshes;
     std::vector<Node::Ptr> nodes;
-    std::vector<AllocatedImage> images;
     std::vector<std::shared_ptr<Material>> materials;
 
-    for (fastgltf::Image& image : gltf.images)
-    {
-        std::optional<AllocatedImage> img = Util::LoadImage(gltf, image);
+    // the cooker compresses every image by what the materials read from it, images used for more
+    // than one purpose keep all their channels
+    std::vector<TextureChannels> imageChannels(gltf.images.size(), TextureChannels::Color);
+    if (cooker) {
+        std::vector<uint32_t> imageUses(gltf.images.size(), 0);
+        auto markTexture = [&](size_t textureIndex, TextureChannels channels) {
+            std::optional<size_t> image = GetTextureImage(gltf.textures[textureIndex]);
+            if (image.has_value())
+                imageUses[image.value()] |= 1u << (uint32_t)channels;
+        };
+        for (fastgltf::Material& mat : gltf.materials) {
+            if (mat.pbrData.baseColorTexture.has_value())
+                markTexture(mat.pbrData.baseColorTexture->textureIndex, TextureChannels::Color);
+            if (mat.pbrData.metallicRoughnessTexture.has_value())
+                markTexture(mat.pbrData.metallicRoughnessTexture->textureIndex, TextureChannels::MetalRoughness);
+            if (mat.normalTexture.has_value())
+                markTexture(mat.normalTexture->textureIndex, TextureChannels::Color);
+            if (mat.occlusionTexture.has_value())
+                markTexture(mat.occlusionTexture->textureIndex, TextureChannels::Occlusion);
+            if (mat.emissiveTexture.has_value())
+                markTexture(mat.emissiveTexture->textureIndex, TextureChannels::Color);
+        }
+        for (size_t i = 0; i < imageUses.size(); i++) {
+            if (imageUses[i] == 1u << (uint32_t)TextureChannels::Occlusion)
+                imageChannels[i] = TextureChannels::Occlusion;
+            else if (imageUses[i] == 1u << (uint32_t)TextureChannels::MetalRoughness)
+                imageChannels[i] = TextureChannels::MetalRoughness;
+        }
+    }
 
-        if (img.has_value()) {
-            images.push_back(*img);
-            file._images[image.name.c_str()] = *img;
+    // images another scene already loaded are shared, slot and all. the rest start out white and take
+    // over their slot when their wave lands, so the materials and the geometry don't wait for the images
+    AssetRegistry& registry = engine->GetAssetRegistry();
+    std::vector<uint64_t> imageKeys(gltf.images.size(), 0);
+    // rgba8 bytes of the first level, what the image waves are sized by
+    std::vector<size_t> imageBytes(gltf.images.size(), 0);
+    forEach((uint32_t)gltf.images.size(), [&](uint32_t i) {
+        std::optional<EncodedImage> encoded = Util::ReadImageHeader(gltf, gltf.images[i]);
+        if (encoded.has_value()) {
+            imageKeys[i] = GetImageKey(encoded->bytes, cooker != nullptr, imageChannels[i]);
+            imageBytes[i] = Util::GetImageByteSize(VK_FORMAT_R8G8B8A8_UNORM, encoded->size);
         }
-        else 
-        {
-            // we failed to load, so lets give the slot a default white texture to not
-            // completely break loading
-            images.push_back(engine->GetErrorImage());
-            fmt::println("glTF failed to load texture: {}", image.name);
+        });
+    std::vector<bool> imageShared(gltf.images.size(), false);
+    uint32_t sharedImageCount = 0;
+    uint32_t sharedMeshCount = 0;
+    size_t sharedBytes = 0;
+    for (size_t i = 0; i < gltf.images.size(); i++) {
+        std::shared_ptr<AssetRegistry::Image> image = registry.FindImage(imageKeys[i]);
+        if (image) {
+            imageShared[i] = true;
+            sharedImageCount++;
+            sharedBytes += image->byteSize;
+        }
+        else {
+            image = registry.AddImage(imageKeys[i], bindless.AddTexture(engine->GetWhiteImage().imageView));
         }
+        file._textureIndices.push_back(image->index);
+        file._sharedImages.push_back(std::move(image));
     }
-    
-    file._materialDataBuffer = engine->CreateBuffer(sizeof(MetallicRougness::MaterialConstants) * gltf.materials.size(),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    unsigned int dataIndex = 0;
-    MetallicRougness::MaterialConstants* sceneMaterialConstants = (MetallicRougness::MaterialConstants*)file._materialDataBuffer.info.pMappedData;
+
+
+    // texture and sampler of a gltf texture, packed for the material table
+    auto packTexture = [&](size_t textureIndex) {
+        std::optional<size_t> imageIndex = GetTextureImage(gltf.textures[textureIndex]);
+        fastgltf::Texture& texture = gltf.textures[textureIndex];
+        uint32_t image = imageIndex.has_value() ? file._textureIndices[imageIndex.value()] : 0;
+        uint32_t sampler = texture.samplerIndex.has_value() ? file._samplerIndices[texture.samplerIndex.value()] : 0;
+        return MetallicRougness::PackTexture(image, sampler);
+    };
+    // the same with file indices, for the cooked material table
+    auto packFileTexture = [&](size_t textureIndex) {
+        std::optional<size_t> imageIndex = GetTextureImage(gltf.textures[textureIndex]);
+        fastgltf::Texture& texture = gltf.textures[textureIndex];
+        uint32_t image = imageIndex.has_value() ? (uint32_t)imageIndex.value() + 1 : 0;
+        uint32_t sampler = texture.samplerIndex.has_value() ? (uint32_t)texture.samplerIndex.value() + 1 : 0;
+        return MetallicRougness::PackTexture(image, sampler);
+    };
 
     for (fastgltf::Material& mat : gltf.materials) {
         std::shared_ptr<Material> newMat = std::make_shared<Material>();
         materials.push_back(newMat);
         file._materials[mat.name.c_str()] = newMat;
 
-        MetallicRougness::MaterialConstants constants;
+        MetallicRougness::MaterialConstants constants{};
         constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
         constants.colorFactors.y = mat.pbrData.baseColorFactor[1];
         constants.colorFactors.z = mat.pbrData.baseColorFactor[2];
         constants.colorFactors.w = mat.pbrData.baseColorFactor[3];
 
-        constants.metalRoughFactors.x = mat.pbrData.metallicFactor;
-        constants.metalRoughFactors.y = mat.pbrData.roughnessFactor;
-        // write material parameters to buffer
-        sceneMaterialConstants[dataIndex] = constants;
+        constants.emissiveFactors.x = mat.emissiveFactor[0];
+        constants.emissiveFactors.y = mat.emissiveFactor[1];
+        constants.emissiveFactors.z = mat.emissiveFactor[2];
+        constants.alphaCutoff = mat.alphaMode == fastgltf::AlphaMode::Mask ? (float)mat.alphaCutoff : 0.f;
+
+        constants.metallicFactor = mat.pbrData.metallicFactor;
+        constants.roughnessFactor = mat.pbrData.roughnessFactor;
+        constants.normalScale = 1.f;
+        constants.occlusionStrength = 0.f;
 
         MaterialPass passType = MaterialPass::MainColor;
         if (mat.alphaMode == fastgltf::AlphaMode::Blend) {
             passType = MaterialPass::Transparent;
         }
 
-        MetallicRougness::MaterialResources materialResources;
-        // default the material textures
-        materialResources.colorImage = engine->GetWhiteImage();
-        materialResources.colorSampler = engine->GetSamplerLinear();
-        materialResources.metalRoughImage = engine->GetWhiteImage();
-        materialResources.metalRoughSampler = engine->GetSamplerLinear();
-
-        // set the uniform buffer for the material data
-        materialResources.dataBuffer = file._materialDataBuffer.buffer;
-        materialResources.dataBufferOffset = dataIndex * sizeof(MetallicRougness::MaterialConstants);
-        // grab textures from gltf file
-        if (mat.pbrData.baseColorTexture.has_value()) {
-            size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
-            size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
-
-            materialResources.colorImage = images[img];
-            materialResources.colorSampler = file._samplers[sampler];
+        // grab textures from gltf file, anything missing stays on slot 0, white with the linear sampler
+        if (mat.pbrData.baseColorTexture.has_value())
+            constants.colorTexture = packTexture(mat.pbrData.baseColorTexture->textureIndex);
+        if (mat.pbrData.metallicRoughnessTexture.has_value())
+            constants.metalRoughTexture = packTexture(mat.pbrData.metallicRoughnessTexture->textureIndex);
+        if (mat.normalTexture.has_value()) {
+            constants.normalTexture = packTexture(mat.normalTexture->textureIndex);
+            constants.normalScale = mat.normalTexture->scale;
+        }
+        if (mat.occlusionTexture.has_value()) {
+            constants.occlusionTexture = packTexture(mat.occlusionTexture->textureIndex);
+            constants.occlusionStrength = mat.occlusionTexture->strength;
+        }
+        if (mat.emissiveTexture.has_value())
+            constants.emissiveTexture = packTexture(mat.emissiveTexture->textureIndex);
+
+        if (cooker) {
+            Cooked::Material cookedMaterial{};
+            cookedMaterial.name = cooker->AddString(mat.name);
+            cookedMaterial.constants = constants;
+            cookedMaterial.passType = passType;
+            if (mat.pbrData.baseColorTexture.has_value())
+                cookedMaterial.constants.colorTexture = packFileTexture(mat.pbrData.baseColorTexture->textureIndex);
+            if (mat.pbrData.metallicRoughnessTexture.has_value())
+                cookedMaterial.constants.metalRoughTexture = packFileTexture(mat.pbrData.metallicRoughnessTexture->textureIndex);
+            if (mat.normalTexture.has_value())
+                cookedMaterial.constants.normalTexture = packFileTexture(mat.normalTexture->textureIndex);
+            if (mat.occlusionTexture.has_value())
+                cookedMaterial.constants.occlusionTexture = packFileTexture(mat.occlusionTexture->textureIndex);
+            if (mat.emissiveTexture.has_value())
+                cookedMaterial.constants.emissiveTexture = packFileTexture(mat.emissiveTexture->textureIndex);
+            cooker->materials.push_back(cookedMaterial);
         }
-        // build material
-        newMat->data = engine->GetMetalMaterial().WriteMaterial(passType, materialResources, file._descriptorPool);
 
-        dataIndex++;
+        // build material
+        file.WriteMaterial(*newMat, passType, constants);
     }
 
-    std::vector<uint32_t> indices;
-    std::vector<Vertex> vertices;
+    file._materialMemory = gltf.materials.size() * sizeof(MetallicRougness::MaterialConstants);
+    fmt::println("Material table: {} materials, {} bytes", gltf.materials.size(), file._materialMemory);
+
+    // every mesh is read before any is uploaded, so the surfaces can be optimized in parallel
+    // nothing rewrites the vertices when every pass that does is off, they then go from the accessors
+    // straight into the packed layout without a Vertex array in between
+    const bool directVertices = !options.optimizeMeshes && !options.generateLods && !options.buildMeshlets && !options.mergeStaticGeometry;
+    std::vector<MeshData> meshData(gltf.meshes.size());
+    std::vector<SurfaceRange> surfaceRanges;
 
     for (fastgltf::Mesh& mesh : gltf.meshes) {
         std::shared_ptr<MeshAsset> newMesh = std::make_shared<MeshAsset>();
         meshes.push_back(newMesh);
         file._meshes[mesh.name.c_str()] = newMesh;
         newMesh->name = mesh.name;
+    }
+
+    // accessor conversion and bounds only touch their own mesh, the ranges are joined in mesh order after
+    std::vector<std::vector<SurfaceRange>> meshSurfaceRanges(gltf.meshes.size());
+    forEach((uint32_t)gltf.meshes.size(), [&](uint32_t meshIndex) {
+        fastgltf::Mesh& mesh = gltf.meshes[meshIndex];
+        std::shared_ptr<MeshAsset>& newMesh = meshes[meshIndex];
+
+        MeshData& data = meshData[meshIndex];
+        std::vector<uint32_t>& indices = data.indices;
+        std::vector<Vertex>& vertices = data.vertices;
 
-        indices.clear();
-        vertices.clear();
+        // sized once, every attribute is then written in place
+        size_t indexCount = 0;
+        size_t vertexCount = 0;
+        for (auto&& p : mesh.primitives) {
+            indexCount += gltf.accessors[p.indicesAccessor.value()].count;
+            vertexCount += gltf.accessors[p.findAttribute("POSITION")->second].count;
+        }
+        indices.reserve(indexCount);
+        if (!directVertices)
+            vertices.reserve(vertexCount);
 
         for (auto&& p : mesh.primitives) {
             GeoSurface newSurface;
             newSurface.startIndex = (uint32_t)indices.size();
             newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
 
-            size_t initialVtx = vertices.size();
+            size_t initialVtx = data.vertexCount;
+            fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
+            data.vertexCount += posAccessor.count;
 
             {
                 fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
-                indices.reserve(indices.size() + indexaccessor.count);
+                indices.resize(indices.size() + indexaccessor.count);
+                ReadIndices(gltf, indexaccessor, (uint32_t)initialVtx, indices.data() + newSurface.startIndex);
+            }
 
-                fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor,
-                    [&](std::uint32_t idx) {
-                        indices.push_back(idx + initialVtx);
+            // the bounds come out of the same pass as the positions
+            glm::vec3 minPos{ FLT_MAX };
+            glm::vec3 maxPos{ -FLT_MAX };
+            auto normals = p.findAttribute("NORMAL");
+            auto uv = p.findAttribute("TEXCOORD_0");
+            auto colors = p.findAttribute("COLOR_0");
+            if (directVertices) {
+                // only hashed here, the upload reads them again into staging
+                ReadAttribute<glm::vec3>(gltf, posAccessor,
+                    [&](glm::vec3 v, size_t) {
+                        data.vertexKey = Cooked::HashBytes(data.vertexKey, &v, sizeof(glm::vec3));
+                        minPos = glm::min(minPos, v);
+                        maxPos = glm::max(maxPos, v);
                     });
+                uint32_t attributes = (normals != p.attributes.end() ? 1 : 0) | (uv != p.attributes.end() ? 2 : 0) | (colors != p.attributes.end() ? 4 : 0);
+                data.vertexKey = Cooked::HashBytes(data.vertexKey, &attributes, sizeof(uint32_t));
+                if (normals != p.attributes.end())
+                    HashAttribute<glm::vec3>(gltf, gltf.accessors[(*normals).second], data.vertexKey);
+                if (uv != p.attributes.end())
+                    HashAttribute<glm::vec2>(gltf, gltf.accessors[(*uv).second], data.vertexKey);
+                if (colors != p.attributes.end())
+                    HashAttribute<glm::vec4>(gltf, gltf.accessors[(*colors).second], data.vertexKey);
             }
-
-            {
-                fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
-                vertices.resize(vertices.size() + posAccessor.count);
-                typedef glm::vec3 vec;
-                fastgltf::iterateAccessorWithIndex <glm::vec3> (gltf, posAccessor,
+            else {
+                Vertex defaultVertex;
+                defaultVertex.position = glm::vec3{ 0.f };
+                defaultVertex.normal = { 1, 0, 0 };
+                defaultVertex.color = glm::vec4{ 1.f };
+                defaultVertex.uv_x = 0;
+                defaultVertex.uv_y = 0;
+                vertices.resize(vertices.size() + posAccessor.count, defaultVertex);
+
+                Vertex* surfaceVertices = vertices.data() + initialVtx;
+                ReadAttribute<glm::vec3>(gltf, posAccessor,
                     [&](glm::vec3 v, size_t index) {
-                        Vertex newvtx;
-                        newvtx.position = v;
-                        newvtx.normal = { 1, 0, 0 };
-                        newvtx.color = glm::vec4{ 1.f };
-                        newvtx.uv_x = 0;
-                        newvtx.uv_y = 0;
-                        vertices[initialVtx + index] = newvtx;
+                        surfaceVertices[index].position = v;
+                        minPos = glm::min(minPos, v);
+                        maxPos = glm::max(maxPos, v);
                     });
-            }
 
-            auto normals = p.findAttribute("NORMAL");
-            if (normals != p.attributes.end()) {
+                if (normals != p.attributes.end()) {
 
-                fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second],
-                    [&](glm::vec3 v, size_t index) {
-                        vertices[initialVtx + index].normal = v;
-                    });
-            }
+                    ReadAttribute<glm::vec3>(gltf, gltf.accessors[(*normals).second],
+                        [&](glm::vec3 v, size_t index) {
+                            surfaceVertices[index].normal = v;
+                        });
+                }
 
-            auto uv = p.findAttribute("TEXCOORD_0");
-            if (uv != p.attributes.end()) {
+                if (uv != p.attributes.end()) {
 
-                fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second],
-                    [&](glm::vec2 v, size_t index) {
-                        vertices[initialVtx + index].uv_x = v.x;
-                        vertices[initialVtx + index].uv_y = v.y;
-                    });
-            }
+                    ReadAttribute<glm::vec2>(gltf, gltf.accessors[(*uv).second],
+                        [&](glm::vec2 v, size_t index) {
+                            surfaceVertices[index].uv_x = v.x;
+                            surfaceVertices[index].uv_y = v.y;
+                        });
+                }
 
-            auto colors = p.findAttribute("COLOR_0");
-            if (colors != p.attributes.end()) {
+                if (colors != p.attributes.end()) {
 
-                fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second],
-                    [&](glm::vec4 v, size_t index) {
-                        vertices[initialVtx + index].color = v;
-                    });
+                    ReadAttribute<glm::vec4>(gltf, gltf.accessors[(*colors).second],
+                        [&](glm::vec4 v, size_t index) {
+                            surfaceVertices[index].color = v;
+                        });
+                }
+            }
+            if (posAccessor.count == 0) {
+                minPos = glm::vec3{ 0.f };
+                maxPos = glm::vec3{ 0.f };
+            }
+            else {
+                data.minPos = glm::min(data.minPos, minPos);
+                data.maxPos = glm::max(data.maxPos, maxPos);
             }
             newSurface.material = p.materialIndex.has_value() ? materials[p.materialIndex.value()] : materials[0];
 
-            glm::vec3 minPos = vertices[initialVtx].position;
-            glm::vec3 maxPos = vertices[initialVtx].position;
-            for (int i = initialVtx; i < vertices.size(); i++) {
-                minPos = glm::min(minPos, vertices[i].position);
-                maxPos = glm::max(maxPos, vertices[i].position);
-            }
             newSurface.bounds.origin = (maxPos + minPos) / 2.f;
             newSurface.bounds.extents = (maxPos - minPos) / 2.f;
             newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
 
+            meshSurfaceRanges[meshIndex].push_back(SurfaceRange{ meshIndex, (uint32_t)newMesh->surfaces.size(), (uint32_t)initialVtx, (uint32_t)posAccessor.count });
             newMesh->surfaces.push_back(newSurface);
         }
+        });
+    for (uint32_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+        // nothing to draw and no buffer to upload, left without surfaces like the meshes merged away
+        if (meshData[meshIndex].vertexCount == 0) {
+            auto named = file._meshes.find(meshes[meshIndex]->name);
+            if (named != file._meshes.end() && named->second == meshes[meshIndex])
+                file._meshes.erase(named);
+            meshes[meshIndex]->surfaces.clear();
+            meshData[meshIndex] = MeshData{};
+            continue;
+        }
+        surfaceRanges.insert(surfaceRanges.end(), meshSurfaceRanges[meshIndex].begin(), meshSurfaceRanges[meshIndex].end());
+    }
+
+    // static nodes are baked into world space chunks per material, meshes that only they used are dropped
+    std::vector<bool> mergedNodes(gltf.nodes.size(), false);
+    size_t firstMergedMesh = meshes.size();
+    if (options.mergeStaticGeometry) {
+        // a fraction of the scene, so chunks still get culled when most of the scene is off screen
+        constexpr float MaxChunkSceneFraction = 1.f / 8.f;
+
+        // whatever an animation moves, and everything below it, stays a node of its own
+        std::vector<bool> dynamicNodes(gltf.nodes.size(), false);
+        for (fastgltf::Animation& animation : gltf.animations) {
+            for (fastgltf::AnimationChannel& channel : animation.channels) {
+                dynamicNodes[channel.nodeIndex] = true;
+            }
+        }
+        std::vector<bool> childNodes(gltf.nodes.size(), false);
+        for (fastgltf::Node& node : gltf.nodes) {
+            for (size_t child : node.children) {
+                childNodes[child] = true;
+            }
+        }
+
+        std::vector<glm::mat4> worldMatrices(gltf.nodes.size());
+        std::function<void(size_t, const glm::mat4&, bool)> visitNode = [&](size_t nodeIndex, const glm::mat4& parentMatrix, bool dynamic) {
+            worldMatrices[nodeIndex] = parentMatrix * GetLocalMatrix(gltf.nodes[nodeIndex]);
+            dynamic = dynamic || dynamicNodes[nodeIndex];
+            dynamicNodes[nodeIndex] = dynamic;
+            for (size_t child : gltf.nodes[nodeIndex].children) {
+                visitNode(child, worldMatrices[nodeIndex], dynamic);
+            }
+        };
+        for (size_t nodeIndex = 0; nodeIndex < gltf.nodes.size(); nodeIndex++) {
+            if (!childNodes[nodeIndex])
+                visitNode(nodeIndex, glm::mat4{ 1.f }, false);
+        }
+
+        std::vector<std::vector<uint32_t>> meshRanges(meshes.size());
+        for (uint32_t i = 0; i < surfaceRanges.size(); i++) {
+            meshRanges[surfaceRanges[i].mesh].push_back(i);
+        }
+
+        std::vector<bool> meshUsed(meshes.size(), false);
+        std::vector<StaticInstance> instances;
+        glm::vec3 sceneMin{ FLT_MAX }, sceneMax{ -FLT_MAX };
+        for (size_t nodeIndex = 0; nodeIndex < gltf.nodes.size(); nodeIndex++) {
+            if (!gltf.nodes[nodeIndex].meshIndex.has_value())
+                continue;
+            size_t meshIndex = *gltf.nodes[nodeIndex].meshIndex;
+            // transparent surfaces are sorted per object, merging them would break the blend order
+            bool transparent = std::any_of(meshes[meshIndex]->surfaces.begin(), meshes[meshIndex]->surfaces.end(), [](const GeoSurface& surface) {
+                return surface.material->data.passType == MaterialPass::Transparent;
+                });
+            if (dynamicNodes[nodeIndex] || transparent) {
+                meshUsed[meshIndex] = true;
+                continue;
+            }
+
+            mergedNodes[nodeIndex] = true;
+            const glm::mat4& transform = worldMatrices[nodeIndex];
+            float scale = std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+            for (uint32_t range : meshRanges[meshIndex]) {
+                const GeoSurface& surface = meshes[meshIndex]->surfaces[surfaceRanges[range].surface];
+                StaticInstance instance{ range, transform, glm::vec3(transform * glm::vec4(surface.bounds.origin, 1.f)), surface.bounds.sphereRadius * scale, surface.count / 3 };
+                sceneMin = glm::min(sceneMin, instance.center - instance.radius);
+                sceneMax = glm::max(sceneMax, instance.center + instance.radius);
+                instances.push_back(instance);
+            }
+        }
+
+        // draw order stays the order materials first show up in
+        std::vector<std::vector<StaticInstance*>> groups;
+        std::unordered_map<Material*, size_t> groupIndices;
+        for (StaticInstance& instance : instances) {
+            const SurfaceRange& range = surfaceRanges[instance.range];
+            Material* material = meshes[range.mesh]->surfaces[range.surface].material.get();
+            auto [group, inserted] = groupIndices.try_emplace(material, groups.size());
+            if (inserted)
+                groups.emplace_back();
+            groups[group->second].push_back(&instance);
+        }
+
+        float maxChunkRadius = glm::length(sceneMax - sceneMin) / 2.f * MaxChunkSceneFraction;
+        std::vector<std::vector<StaticInstance*>> chunks;
+        for (std::vector<StaticInstance*>& group : groups) {
+            SplitStaticChunk(std::move(group), maxChunkRadius, chunks);
+        }
+
+        std::vector<SurfaceRange> chunkRanges;
+        for (std::vector<StaticInstance*>& chunk : chunks) {
+            uint32_t chunkVertices = 0;
+            for (StaticInstance* instance : chunk) {
+                chunkVertices += surfaceRanges[instance->range].vertexCount;
+            }
+
+            // a new mesh whenever 16 bit indices would stop being enough
+            if (meshes.size() == firstMergedMesh || meshData.back().vertices.size() + chunkVertices > 65536) {
+                std::shared_ptr<MeshAsset> mergedMesh = std::make_shared<MeshAsset>();
+                mergedMesh->name = fmt::format("static_chunks_{}", meshes.size() - firstMergedMesh);
+                file._meshes[mergedMesh->name] = mergedMesh;
+                meshes.push_back(mergedMesh);
+                meshData.emplace_back();
+            }
+            MeshData& target = meshData.back();
+            MeshAsset& mergedMesh = *meshes.back();
+
+            const SurfaceRange& firstRange = surfaceRanges[chunk[0]->range];
+            GeoSurface chunkSurface;
+            chunkSurface.startIndex = (uint32_t)target.indices.size();
+            chunkSurface.material = meshes[firstRange.mesh]->surfaces[firstRange.surface].material;
+            uint32_t firstVertex = (uint32_t)target.vertices.size();
+
+            for (StaticInstance* instance : chunk) {
+                const SurfaceRange& range = surfaceRanges[instance->range];
+                const MeshData& source = meshData[range.mesh];
+                const GeoSurface& surface = meshes[range.mesh]->surfaces[range.surface];
+                glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance->transform)));
+                // a mirroring transform turns the triangles around
+                bool flip = glm::determinant(glm::mat3(instance->transform)) < 0.f;
+
+                uint32_t base = (uint32_t)target.vertices.size();
+                for (uint32_t v = 0; v < range.vertexCount; v++) {
+                    Vertex vertex = source.vertices[range.firstVertex + v];
+                    vertex.position = glm::vec3(instance->transform * glm::vec4(vertex.position, 1.f));
+                    vertex.normal = glm::normalize(normalMatrix * vertex.normal);
+                    target.vertices.push_back(vertex);
+                }
+                for (uint32_t i = 0; i < surface.count; i += 3) {
+                    const uint32_t* triangle = &source.indices[surface.startIndex + i];
+                    target.indices.push_back(triangle[0] - range.firstVertex + base);
+                    target.indices.push_back(triangle[flip ? 2 : 1] - range.firstVertex + base);
+                    target.indices.push_back(triangle[flip ? 1 : 2] - range.firstVertex + base);
+                }
+            }
+            chunkSurface.count = (uint32_t)target.indices.size() - chunkSurface.startIndex;
+
+            glm::vec3 minPos = target.vertices[firstVertex].position;
+            glm::vec3 maxPos = target.vertices[firstVertex].position;
+            for (size_t i = firstVertex; i < target.vertices.size(); i++) {
+                minPos = glm::min(minPos, target.vertices[i].position);
+                maxPos = glm::max(maxPos, target.vertices[i].position);
+            }
+            chunkSurface.bounds.origin = (maxPos + minPos) / 2.f;
+            chunkSurface.bounds.extents = (maxPos - minPos) / 2.f;
+            chunkSurface.bounds.sphereRadius = glm::length(chunkSurface.bounds.extents);
+
+            chunkRanges.push_back(SurfaceRange{ (uint32_t)meshes.size() - 1, (uint32_t)mergedMesh.surfaces.size(), firstVertex, (uint32_t)target.vertices.size() - firstVertex });
+            mergedMesh.surfaces.push_back(chunkSurface);
+        }
+
+        // the chunks replace every surface of the meshes that only static nodes used
+        std::vector<SurfaceRange> keptRanges;
+        for (const SurfaceRange& range : surfaceRanges) {
+            if (meshUsed[range.mesh])
+                keptRanges.push_back(range);
+        }
+        keptRanges.insert(keptRanges.end(), chunkRanges.begin(), chunkRanges.end());
+        surfaceRanges = std::move(keptRanges);
+
+        for (size_t meshIndex = 0; meshIndex < firstMergedMesh; meshIndex++) {
+            if (meshUsed[meshIndex])
+                continue;
+            auto named = file._meshes.find(meshes[meshIndex]->name);
+            if (named != file._meshes.end() && named->second == meshes[meshIndex])
+                file._meshes.erase(named);
+            meshes[meshIndex]->surfaces.clear();
+            meshData[meshIndex] = MeshData{};
+        }
+
+        fmt::println("Static merge: {} surfaces into {} chunks", instances.size(), chunks.size());
+    }
+
+    // surfaces own disjoint index and vertex ranges of their mesh, so each one is a separate job
+    std::vector<SurfaceOptimizeResult> optimizeResults(surfaceRanges.size(), SurfaceOptimizeResult{ 0.f, 0.f });
+    std::vector<std::vector<uint32_t>> lodIndices(surfaceRanges.size());
+    std::vector<std::vector<GPUMeshlet>> meshlets(surfaceRanges.size());
+    std::vector<std::vector<uint32_t>> meshletData(surfaceRanges.size());
+    forEach((uint32_t)surfaceRanges.size(), [&](uint32_t i) {
+        const SurfaceRange& range = surfaceRanges[i];
+        MeshData& data = meshData[range.mesh];
+        GeoSurface& surface = meshes[range.mesh]->surfaces[range.surface];
+
+        if (options.optimizeMeshes) {
+            std::span<uint32_t> surfaceIndices(data.indices.data() + surface.startIndex, surface.count);
+            std::span<Vertex> surfaceVertices(data.vertices.data() + range.firstVertex, range.vertexCount);
+            optimizeResults[i] = Util::OptimizeSurface(surfaceIndices, surfaceVertices, range.firstVertex);
+        }
+
+        if (SoftwareOcclusion::IsOccluderCandidate(surface)) {
+            std::vector<glm::vec3> positions(range.vertexCount);
+            if (directVertices) {
+                // without merging, the surfaces of a mesh are its primitives in order
+                fastgltf::Primitive& primitive = gltf.meshes[range.mesh].primitives[range.surface];
+                ReadAttribute<glm::vec3>(gltf, gltf.accessors[primitive.findAttribute("POSITION")->second],
+                    [&](glm::vec3 v, size_t index) {
+                        positions[index] = v;
+                    });
+            }
+            else {
+                for (uint32_t v = 0; v < range.vertexCount; v++) {
+                    positions[v] = data.vertices[range.firstVertex + v].position;
+                }
+            }
+            surface.occluder = SoftwareOcclusion::ExtractOccluder(data.indices, std::move(positions), surface, range.firstVertex);
+        }
+
+        // after the cache optimization, so the meshlets keep its order as far as they can
+        if (options.buildMeshlets) {
+            std::span<uint32_t> surfaceIndices(data.indices.data() + surface.startIndex, surface.count);
+            std::span<Vertex> surfaceVertices(data.vertices.data() + range.firstVertex, range.vertexCount);
+            Util::BuildSurfaceMeshlets(surfaceIndices, surfaceVertices, range.firstVertex, meshlets[i], meshletData[i]);
+        }
 
-        newMesh->meshBuffers = engine->UploadMesh(indices, vertices);
+        surface.lods.push_back(MeshLod{ surface.startIndex, surface.count, 0.f });
+        if (options.generateLods) {
+            std::span<uint32_t> surfaceIndices(data.indices.data() + surface.startIndex, surface.count);
+            std::span<Vertex> surfaceVertices(data.vertices.data() + range.firstVertex, range.vertexCount);
+            Util::BuildSurfaceLods(surfaceIndices, surfaceVertices, range.firstVertex, surface.bounds.sphereRadius, lodIndices[i], surface.lods);
+        }
+        });
+
+    // the lods go behind all full surfaces of their mesh
+    size_t lodCount = 0;
+    for (size_t i = 0; i < surfaceRanges.size(); i++) {
+        std::vector<uint32_t>& indices = meshData[surfaceRanges[i].mesh].indices;
+        GeoSurface& surface = meshes[surfaceRanges[i].mesh]->surfaces[surfaceRanges[i].surface];
+        for (size_t lod = 1; lod < surface.lods.size(); lod++) {
+            surface.lods[lod].firstIndex += (uint32_t)indices.size();
+        }
+        indices.insert(indices.end(), lodIndices[i].begin(), lodIndices[i].end());
+        lodCount += surface.lods.size() - 1;
+    }
+    if (options.generateLods)
+        fmt::println("Lods: {} levels for {} surfaces", lodCount, surfaceRanges.size());
+
+    // the meshlets of every surface go into one buffer per mesh, descriptors first and then the vertex and triangle lists
+    std::vector<std::vector<GPUMeshlet>> meshMeshlets(meshes.size());
+    std::vector<std::vector<uint32_t>> meshMeshletData(meshes.size());
+    size_t meshletCount = 0;
+    for (size_t i = 0; i < surfaceRanges.size(); i++) {
+        std::vector<GPUMeshlet>& target = meshMeshlets[surfaceRanges[i].mesh];
+        std::vector<uint32_t>& targetData = meshMeshletData[surfaceRanges[i].mesh];
+        GeoSurface& surface = meshes[surfaceRanges[i].mesh]->surfaces[surfaceRanges[i].surface];
+        surface.firstMeshlet = (uint32_t)target.size();
+        surface.meshletCount = (uint32_t)meshlets[i].size();
+        for (GPUMeshlet& meshlet : meshlets[i]) {
+            meshlet.firstIndex += surface.startIndex;
+            meshlet.vertexOffset += (uint32_t)targetData.size();
+            meshlet.triangleOffset += (uint32_t)targetData.size();
+            target.push_back(meshlet);
+        }
+        targetData.insert(targetData.end(), meshletData[i].begin(), meshletData[i].end());
+        meshletCount += meshlets[i].size();
+    }
+    if (options.buildMeshlets)
+        fmt::println("Meshlets: {} for {} surfaces", meshletCount, surfaceRanges.size());
+
+    if (options.optimizeMeshes) {
+        // weighted by triangles, so the big surfaces count the most
+        double acmrBefore = 0.0, acmrAfter = 0.0, triangles = 0.0;
+        for (size_t i = 0; i < surfaceRanges.size(); i++) {
+            double surfaceTriangles = meshes[surfaceRanges[i].mesh]->surfaces[surfaceRanges[i].surface].count / 3;
+            acmrBefore += optimizeResults[i].acmrBefore * surfaceTriangles;
+            acmrAfter += optimizeResults[i].acmrAfter * surfaceTriangles;
+            triangles += surfaceTriangles;
+        }
+        if (triangles > 0.0)
+            fmt::println("Mesh optimization: acmr {:.3f} -> {:.3f}", acmrBefore / triangles, acmrAfter / triangles);
     }
 
+    // the gpu only ever sees the packed layout. it is written straight into the staging memory by the
+    // upload, unless the cooker or the content hash need a copy of their own
+    const bool keepPackedVertices = cooker || options.hashContents;
+    std::vector<std::vector<PackedVertex>> packedVertices(meshes.size());
+    std::vector<glm::vec3> positionOffsets(meshes.size());
+    std::vector<glm::vec3> positionScales(meshes.size());
+    std::vector<uint64_t> meshKeys(meshes.size(), 0);
+    forEach((uint32_t)meshes.size(), [&](uint32_t meshIndex) {
+        // merged away into static chunks
+        if (meshes[meshIndex]->surfaces.empty())
+            return;
+
+        MeshData& data = meshData[meshIndex];
+        meshKeys[meshIndex] = GetMeshKey(data, meshMeshlets[meshIndex], meshMeshletData[meshIndex]);
+        if (directVertices) {
+            // the same range GetPackingRange finds, out of the pass that read the positions
+            positionOffsets[meshIndex] = data.vertexCount != 0 ? data.minPos : glm::vec3(0.f);
+            positionScales[meshIndex] = data.vertexCount != 0 ? data.maxPos - data.minPos : glm::vec3(1.f);
+        }
+        else {
+            // the static merge appended to the vertices without counting them
+            data.vertexCount = data.vertices.size();
+            Util::GetPackingRange(data.vertices, positionOffsets[meshIndex], positionScales[meshIndex]);
+        }
+        if (keepPackedVertices) {
+            packedVertices[meshIndex].resize(data.vertexCount);
+            if (directVertices)
+                ReadPackedVertices(gltf, gltf.meshes[meshIndex], positionOffsets[meshIndex], positionScales[meshIndex], packedVertices[meshIndex].data());
+            else
+                Util::PackVertices(data.vertices, packedVertices[meshIndex].data(), positionOffsets[meshIndex], positionScales[meshIndex]);
+            // only the packed copy is needed from here on
+            std::vector<Vertex>().swap(data.vertices);
+        }
+        // the lists sit behind the descriptors, the offsets were relative to the start of the lists
+        std::vector<GPUMeshlet>& newMeshlets = meshMeshlets[meshIndex];
+        uint32_t listsOffset = (uint32_t)(newMeshlets.size() * sizeof(GPUMeshlet) / sizeof(uint32_t));
+        for (GPUMeshlet& meshlet : newMeshlets) {
+            meshlet.vertexOffset += listsOffset;
+            meshlet.triangleOffset += listsOffset;
+        }
+        });
+    float meshTime = lapTime();
+
+    std::vector<MeshUpload> uploads;
+    std::vector<size_t> uploadMeshes;
+    std::vector<size_t> vertexCounts(meshes.size());
+    for (size_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+        if (meshes[meshIndex]->surfaces.empty())
+            continue;
+        // the same geometry is already on the gpu, in this scene or another one
+        if (std::shared_ptr<AssetRegistry::Mesh> shared = registry.FindMesh(meshKeys[meshIndex])) {
+            meshes[meshIndex]->meshBuffers = shared->buffers;
+            vertexCounts[meshIndex] = meshData[meshIndex].vertexCount;
+            sharedMeshCount++;
+            sharedBytes += shared->byteSize;
+            file._sharedMeshes.push_back(std::move(shared));
+            continue;
+        }
+        MeshUpload upload{ meshData[meshIndex].indices, packedVertices[meshIndex], meshMeshlets[meshIndex], meshMeshletData[meshIndex] };
+        if (!keepPackedVertices) {
+            upload.vertexCount = meshData[meshIndex].vertexCount;
+            upload.writeVertices = [&, meshIndex](PackedVertex* staging) {
+                if (directVertices)
+                    ReadPackedVertices(gltf, gltf.meshes[meshIndex], positionOffsets[meshIndex], positionScales[meshIndex], staging);
+                else
+                    Util::PackVertices(meshData[meshIndex].vertices, staging, positionOffsets[meshIndex], positionScales[meshIndex]);
+            };
+        }
+        uploads.push_back(std::move(upload));
+        uploadMeshes.push_back(meshIndex);
+    }
+    std::vector<MeshBuffers> uploadedMeshes = engine->UploadMeshes(uploads);
+    for (size_t i = 0; i < uploadedMeshes.size(); i++) {
+        MeshBuffers& buffers = meshes[uploadMeshes[i]]->meshBuffers;
+        buffers = uploadedMeshes[i];
+        buffers.positionOffset = positionOffsets[uploadMeshes[i]];
+        buffers.positionScale = positionScales[uploadMeshes[i]];
+        file._sharedMeshes.push_back(registry.AddMesh(meshKeys[uploadMeshes[i]], buffers));
+    }
+    for (size_t i = 0; i < uploads.size(); i++) {
+        vertexCounts[uploadMeshes[i]] = uploads[i].GetVertexCount();
+    }
+    uploads.clear();
+    for (MeshData& data : meshData) {
+        std::vector<Vertex>().swap(data.vertices);
+    }
+
+    size_t vertexMemory = 0;
+    size_t indexMemory = 0;
+    size_t fullIndexMemory = 0;
+
+    std::unordered_map<Material*, uint32_t> materialIndices;
+    for (size_t i = 0; i < materials.size(); i++) {
+        materialIndices[materials[i].get()] = (uint32_t)i;
+    }
+
+    for (size_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+        std::shared_ptr<MeshAsset>& newMesh = meshes[meshIndex];
+        std::vector<uint32_t>& indices = meshData[meshIndex].indices;
+        if (cooker) {
+            Cooked::Mesh cookedMesh{};
+            cookedMesh.name = cooker->AddString(newMesh->name);
+            cookedMesh.firstSurface = (uint32_t)cooker->surfaces.size();
+            cookedMesh.surfaceCount = (uint32_t)newMesh->surfaces.size();
+            if (!newMesh->surfaces.empty()) {
+                cookedMesh.positionOffset = positionOffsets[meshIndex];
+                cookedMesh.positionScale = positionScales[meshIndex];
+                cookedMesh.indices = cooker->AddData(std::span<const uint32_t>(indices));
+                cookedMesh.vertices = cooker->AddData(std::span<const PackedVertex>(packedVertices[meshIndex]));
+                cookedMesh.meshlets = cooker->AddData(std::span<const GPUMeshlet>(meshMeshlets[meshIndex]));
+                cookedMesh.meshletData = cooker->AddData(std::span<const uint32_t>(meshMeshletData[meshIndex]));
+            }
+            cookedMesh.contentKey = meshKeys[meshIndex];
+            cooker->meshes.push_back(cookedMesh);
+
+            for (GeoSurface& surface : newMesh->surfaces) {
+                Cooked::Surface cookedSurface{};
+                cookedSurface.startIndex = surface.startIndex;
+                cookedSurface.count = surface.count;
+                cookedSurface.bounds = surface.bounds;
+                cookedSurface.material = materialIndices[surface.material.get()];
+                cookedSurface.firstLod = (uint32_t)cooker->lods.size();
+                cookedSurface.lodCount = (uint32_t)surface.lods.size();
+                cookedSurface.firstMeshlet = surface.firstMeshlet;
+                cookedSurface.meshletCount = surface.meshletCount;
+                if (surface.occluder) {
+                    cookedSurface.occluderPositions = cooker->AddData(std::span<const glm::vec3>(surface.occluder->positions));
+                    cookedSurface.occluderIndices = cooker->AddData(std::span<const uint32_t>(surface.occluder->indices));
+                }
+                cooker->lods.insert(cooker->lods.end(), surface.lods.begin(), surface.lods.end());
+                cooker->surfaces.push_back(cookedSurface);
+            }
+        }
+        if (newMesh->surfaces.empty())
+            continue;
+
+        vertexMemory += vertexCounts[meshIndex] * sizeof(PackedVertex);
+        indexMemory += indices.size() * (newMesh->meshBuffers.indices.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+        fullIndexMemory += indices.size() * sizeof(uint32_t);
+        if (options.hashContents) {
+            contentHash = Cooked::HashBytes(contentHash, indices.data(), indices.size() * sizeof(uint32_t));
+            contentHash = Cooked::HashBytes(contentHash, packedVertices[meshIndex].data(), packedVertices[meshIndex].size() * sizeof(PackedVertex));
+            contentHash = Cooked::HashBytes(contentHash, meshMeshlets[meshIndex].data(), meshMeshlets[meshIndex].size() * sizeof(GPUMeshlet));
+            contentHash = Cooked::HashBytes(contentHash, meshMeshletData[meshIndex].data(), meshMeshletData[meshIndex].size() * sizeof(uint32_t));
+        }
+
+        file._unpublishedMeshes.push_back(newMesh);
+        if (options.hashContents) {
+            for (GeoSurface& surface : newMesh->surfaces) {
+                contentHash = Cooked::HashBytes(contentHash, surface.lods.data(), surface.lods.size() * sizeof(MeshLod));
+                contentHash = Cooked::HashBytes(contentHash, &surface.bounds, sizeof(Bounds));
+            }
+        }
+    }
+    float uploadTime = lapTime();
+
+    fmt::println("Vertex data: {} bytes, {} unpacked", vertexMemory, vertexMemory / sizeof(PackedVertex) * sizeof(Vertex));
+    fmt::println("Index data: {} bytes, {} with 32 bit indices", indexMemory, fullIndexMemory);
+
     for (fastgltf::Node& node : gltf.nodes) {
         std::shared_ptr<Node> newNode;
 
-        if (node.meshIndex.has_value()) {
+        // merged nodes keep their place in the hierarchy, their geometry is drawn by the chunks
+        if (node.meshIndex.has_value() && !mergedNodes[nodes.size()]) {
             newNode = std::make_shared<MeshNode>();
             static_cast<MeshNode*>(newNode.get())->SetMesh(meshes[*node.meshIndex]);
         }
@@ -325,26 +1222,23 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::Load(std::string_view fil
             newNode = std::make_shared<Node>();
         }
 
+        if (cooker) {
+            Cooked::Node cookedNode{};
+            cookedNode.name = cooker->AddString(node.name);
+            cookedNode.transform = GetLocalMatrix(node);
+            cookedNode.mesh = node.meshIndex.has_value() && !mergedNodes[nodes.size()] ? (uint32_t)*node.meshIndex : UINT32_MAX;
+            cookedNode.firstChild = (uint32_t)cooker->children.size();
+            cookedNode.childCount = (uint32_t)node.children.size();
+            for (size_t child : node.children) {
+                cooker->children.push_back((uint32_t)child);
+            }
+            cooker->nodes.push_back(cookedNode);
+        }
+
         nodes.push_back(newNode);
         file._nodes[node.name.c_str()];
 
-        std::visit(fastgltf::visitor{ [&](fastgltf::Node::TransformMatrix matrix) {
-                                          memcpy(&newNode->GetLocalTransform(), matrix.data(), sizeof(matrix));
-                                      },
-                       [&](fastgltf::TRS transform) {
-                           glm::vec3 tl(transform.translation[0], transform.translation[1],
-                               transform.translation[2]);
-                           glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1],
-                               transform.rotation[2]);
-                           glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
-
-                           glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
-                           glm::mat4 rm = glm::toMat4(rot);
-                           glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
-
-                           newNode->SetLocalTransform( tm * rm * sm);
-                       } },
-            node.transform);
+        newNode->GetLocalTransform() = GetLocalMatrix(node);
     }
 
     for (int i = 0; i < gltf.nodes.size(); i++) {
@@ -357,15 +1251,385 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::Load(std::string_view fil
         }
     }
 
+    // the chunks are already in world space
+    for (size_t meshIndex = firstMergedMesh; meshIndex < meshes.size(); meshIndex++) {
+        std::shared_ptr<MeshNode> chunkNode = std::make_shared<MeshNode>();
+        chunkNode->SetMesh(meshes[meshIndex]);
+        chunkNode->GetLocalTransform() = glm::mat4{ 1.f };
+        nodes.push_back(chunkNode);
+        if (cooker)
+            cooker->nodes.push_back(Cooked::Node{ {}, glm::mat4{ 1.f }, (uint32_t)meshIndex, 0, 0 });
+    }
+
+    file.FindTopNodes(nodes);
+    // drawable from here on, with white textures until the images below land
+    publish(scene);
+
+    // jpeg and png are only probed here and decode straight into the staging memory during the upload,
+    // unless the cooker or the content hash need a copy of the pixels
+    const bool keepPixels = cooker || options.hashContents;
+    // decoded on the workers in waves of about one upload batch of pixels, so each wave goes to the gpu
+    // in one submit and only a wave is held in memory at once. the tables are filled in file order afterwards
+    std::vector<size_t> waveStarts;
+    size_t waveBytes = 0;
+    for (size_t i = 0; i < gltf.images.size(); i++) {
+        size_t bytes = imageShared[i] && !keepPixels ? 0 : imageBytes[i];
+        if (waveStarts.empty() || waveBytes + bytes > Engine::UploadBatchSize) {
+            waveStarts.push_back(i);
+            waveBytes = 0;
+        }
+        waveBytes += bytes;
+    }
+    waveStarts.push_back(gltf.images.size());
+
+    size_t textureMemory = 0;
+    size_t fullTextureMemory = 0;
+    for (size_t wave = 0; wave + 1 < waveStarts.size(); wave++) {
+        size_t waveStart = waveStarts[wave];
+        uint32_t waveCount = (uint32_t)(waveStarts[wave + 1] - waveStart);
+        std::vector<std::optional<EncodedImage>> encoded(waveCount);
+        std::vector<std::optional<DecodedImage>> decoded(waveCount);
+        forEach(waveCount, [&](uint32_t i) {
+            if (imageShared[waveStart + i] && !keepPixels)
+                return;
+            if (!keepPixels) {
+                encoded[i] = Util::ReadImageHeader(gltf, gltf.images[waveStart + i]);
+                if (encoded[i].has_value() && encoded[i]->CanDecodeInto())
+                    return;
+                encoded[i].reset();
+            }
+            decoded[i] = Util::DecodeImage(gltf, gltf.images[waveStart + i]);
+            // cooked files carry the whole chain in block formats, so this load already uses the same
+            // textures as the next
+            if (cooker && decoded[i].has_value()) {
+                Util::GenerateMipChain(*decoded[i]);
+                Util::CompressImage(*decoded[i], imageChannels[waveStart + i]);
+            }
+            });
+
+        std::vector<ImageUpload> uploads;
+        for (uint32_t i = 0; i < waveCount; i++) {
+            if (encoded[i].has_value()) {
+                const EncodedImage& image = *encoded[i];
+                const std::string_view name = gltf.images[waveStart + i].name;
+                uploads.push_back(ImageUpload{ image.size, 1, {}, [&image, name](uint8_t* staging) {
+                    // the header was fine but the data wasn't, the slot is already taken so it gets flagged in magenta
+                    if (!Util::DecodeImageInto(image, staging)) {
+                        std::fill_n((uint32_t*)staging, (size_t)image.size.width * image.size.height, glm::packUnorm4x8(glm::vec4(1, 0, 1, 1)));
+                        fmt::println("glTF failed to decode texture: {}", name);
+                    }
+                    } });
+                continue;
+            }
+            std::optional<DecodedImage>& image = decoded[i];
+            if (!image.has_value())
+                continue;
+            if (options.hashContents) {
+                contentHash = Cooked::HashBytes(contentHash, &image->size, sizeof(VkExtent3D));
+                contentHash = Cooked::HashBytes(contentHash, &image->format, sizeof(VkFormat));
+                contentHash = Cooked::HashBytes(contentHash, image->pixels.data(), image->pixels.size());
+            }
+            // already on the gpu, only decoded for the cooker or the hash
+            if (imageShared[waveStart + i])
+                continue;
+            uploads.push_back(ImageUpload{ image->size, image->mipLevels, image->pixels, {}, image->format, image->swizzle });
+        }
+        std::vector<size_t> uploadBytes;
+        for (const ImageUpload& upload : uploads) {
+            // rgba8 images get their chain on the gpu
+            VkFormat format = upload.format != VK_FORMAT_UNDEFINED ? upload.format : VK_FORMAT_R8G8B8A8_UNORM;
+            uint32_t mipLevels = Util::IsBlockCompressed(format) ? upload.mipLevels : Util::GetMipLevelCount(upload.size);
+            uploadBytes.push_back(Util::GetImageByteSize(format, upload.size, mipLevels));
+            textureMemory += uploadBytes.back();
+            fullTextureMemory += Util::GetImageByteSize(VK_FORMAT_R8G8B8A8_UNORM, upload.size, Util::GetMipLevelCount(upload.size));
+        }
+        std::vector<AllocatedImage> uploaded = engine->CreateImages(uploads, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+
+        size_t nextUpload = 0;
+        for (uint32_t i = 0; i < waveCount; i++) {
+            fastgltf::Image& image = gltf.images[waveStart + i];
+            if (cooker) {
+                Cooked::Image cookedImage{};
+                cookedImage.name = cooker->AddString(image.name);
+                if (decoded[i].has_value()) {
+                    cookedImage.size = decoded[i]->size;
+                    cookedImage.mipLevels = decoded[i]->mipLevels;
+                    cookedImage.format = decoded[i]->format;
+                    cookedImage.swizzle = decoded[i]->swizzle;
+                    cookedImage.pixels = cooker->AddData(std::span<const uint8_t>(decoded[i]->pixels));
+                    cookedImage.contentKey = imageKeys[waveStart + i];
+                }
+                cooker->images.push_back(cookedImage);
+            }
+            if (imageShared[waveStart + i])
+                continue;
+            AssetRegistry::Image& shared = *file._sharedImages[waveStart + i];
+            if (encoded[i].has_value() || decoded[i].has_value()) {
+                shared.image = uploaded[nextUpload];
+                shared.byteSize = uploadBytes[nextUpload++];
+            }
+            else
+            {
+                // we failed to load, so lets give the slot a default white texture to not
+                // completely break loading
+                shared.image = engine->GetErrorImage();
+                fmt::println("glTF failed to load texture: {}", image.name);
+            }
+            bindless.SetTexture(shared.index, shared.image.imageView);
+        }
+    }
+    // every accessor and image has been read, the gltf buffers now point at nothing
+    source.Close();
+    float imageTime = lapTime();
+    if (!gltf.images.empty())
+        fmt::println("Texture data: {} bytes, {} as rgba8", textureMemory, fullTextureMemory);
+    if (sharedImageCount != 0 || sharedMeshCount != 0)
+        fmt::println("Shared with loaded scenes: {} images, {} meshes, {} bytes", sharedImageCount, sharedMeshCount, sharedBytes);
+    file._contentHash = contentHash;
+
+    fmt::println("Load time ({}): parse {:.1f} ms, meshes {:.1f} ms, mesh upload {:.1f} ms, images {:.1f} ms", options.parallel ? "parallel" : "serial",
+        parseTime, meshTime, uploadTime, imageTime);
+    fmt::println("Peak resident memory: {} MB for a {} MB file", GetPeakResidentMemory() / (1024 * 1024), sourceSize / (1024 * 1024));
+
+    if (cooker) {
+        cooker->fileNodeCount = (uint32_t)gltf.nodes.size();
+        cooker->Write(cachePath, sourceKey);
+    }
+
+    return scene;
+}
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::LoadCooked(const std::filesystem::path& cachePath, uint64_t sourceKey, const GLTFLoadOptions& options)
+{
+    // shared with the texture streamer, which reads the detailed levels from the mapping later on
+    std::shared_ptr<CookedReader> reader = std::make_shared<CookedReader>();
+    if (!reader->Open(cachePath, sourceKey))
+        return {};
+
+    Engine* engine = Engine::Get();
+    std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
+    LoadedGLTF& file = *scene.get();
+
+    for (const Cooked::Sampler& sampler : reader->GetSamplers()) {
+        file.AddSampler(sampler);
+    }
+
+    // the pixels go from the mapping straight into the staging buffers, unless another scene already
+    // has the image. streamed images start out with the levels from their base level down, the
+    // streamer adds the rest when something needs them
+    AssetRegistry& registry = engine->GetAssetRegistry();
+    std::span<const Cooked::Image> cookedImages = reader->GetImages();
+    std::vector<std::shared_ptr<AssetRegistry::Image>> sharedImages(cookedImages.size());
+    std::vector<ImageUpload> imageUploads;
+    std::vector<uint32_t> baseLevels;
+    for (size_t i = 0; i < cookedImages.size(); i++) {
+        const Cooked::Image& image = cookedImages[i];
+        if (image.mipLevels == 0)
+            continue;
+        sharedImages[i] = registry.FindImage(image.contentKey);
+        if (sharedImages[i])
+            continue;
+        std::span<const uint8_t> pixels = reader->GetData<uint8_t>(image.pixels);
+        uint32_t baseLevel = options.streamTextures ? TextureStreamer::GetBaseLevel(image.size, image.mipLevels) : 0;
+        VkExtent3D levelSize{ std::max(image.size.width >> baseLevel, 1u), std::max(image.size.height >> baseLevel, 1u), 1 };
+        imageUploads.push_back(ImageUpload{ levelSize, image.mipLevels - baseLevel, pixels.subspan(Util::GetImageByteSize(image.format, image.size, baseLevel)),
+            {}, image.format, image.swizzle });
+        baseLevels.push_back(baseLevel);
+    }
+    std::vector<AllocatedImage> uploadedImages = engine->CreateImages(imageUploads, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+    size_t nextImage = 0;
+    for (size_t i = 0; i < cookedImages.size(); i++) {
+        const Cooked::Image& image = cookedImages[i];
+        std::shared_ptr<AssetRegistry::Image>& shared = sharedImages[i];
+        if (!shared) {
+            AllocatedImage newImage = engine->GetErrorImage();
+            uint32_t baseLevel = 0;
+            if (image.mipLevels != 0) {
+                baseLevel = baseLevels[nextImage];
+                newImage = uploadedImages[nextImage++];
+            }
+            shared = registry.AddImage(image.mipLevels != 0 ? image.contentKey : 0, engine->GetBindless().AddTexture(newImage.imageView));
+            shared->image = newImage;
+            if (image.mipLevels != 0) {
+                VkExtent3D levelSize{ std::max(image.size.width >> baseLevel, 1u), std::max(image.size.height >> baseLevel, 1u), 1 };
+                shared->byteSize = Util::GetImageByteSize(image.format, levelSize, image.mipLevels - baseLevel);
+            }
+
+            // small images are resident in full already, and a full table hands out the default slot
+            if (baseLevel != 0 && shared->index != 0) {
+                shared->streamedTexture = engine->GetTextureStreamer().AddTexture(reader, reader->GetData<uint8_t>(image.pixels), image.size,
+                    image.mipLevels, image.format, image.swizzle, newImage, baseLevel, shared->index);
+            }
+        }
+        file._textureIndices.push_back(shared->index);
+        file._sharedImages.push_back(std::move(shared));
+    }
+
+    // file indices back to bindless slots
+    auto remapTexture = [&](uint32_t packed) {
+        uint32_t image = packed & 0xffff;
+        uint32_t sampler = packed >> 16;
+        return MetallicRougness::PackTexture(image != 0 ? file._textureIndices[image - 1] : 0, sampler != 0 ? file._samplerIndices[sampler - 1] : 0);
+    };
+    std::vector<std::shared_ptr<Material>> materials;
+    for (const Cooked::Material& material : reader->GetMaterials()) {
+        std::shared_ptr<Material> newMat = std::make_shared<Material>();
+        materials.push_back(newMat);
+        file._materials[std::string(reader->GetString(material.name))] = newMat;
+
+        MetallicRougness::MaterialConstants constants = material.constants;
+        constants.colorTexture = remapTexture(constants.colorTexture);
+        constants.metalRoughTexture = remapTexture(constants.metalRoughTexture);
+        constants.normalTexture = remapTexture(constants.normalTexture);
+        constants.occlusionTexture = remapTexture(constants.occlusionTexture);
+        constants.emissiveTexture = remapTexture(constants.emissiveTexture);
+        file.WriteMaterial(*newMat, material.passType, constants);
+    }
+    file._materialMemory = materials.size() * sizeof(MetallicRougness::MaterialConstants);
+
+    std::span<const Cooked::Surface> cookedSurfaces = reader->GetSurfaces();
+    std::span<const MeshLod> cookedLods = reader->GetLods();
+    std::vector<std::shared_ptr<MeshAsset>> meshes;
+    std::vector<MeshUpload> meshUploads;
+    std::vector<size_t> uploadMeshes;
+    for (const Cooked::Mesh& mesh : reader->GetMeshes()) {
+        std::shared_ptr<MeshAsset> newMesh = std::make_shared<MeshAsset>();
+        meshes.push_back(newMesh);
+        newMesh->name = reader->GetString(mesh.name);
+        // merged away into static chunks
+        if (mesh.surfaceCount == 0)
+            continue;
+        file._meshes[newMesh->name] = newMesh;
+
+        for (const Cooked::Surface& surface : cookedSurfaces.subspan(mesh.firstSurface, mesh.surfaceCount)) {
+            GeoSurface newSurface;
+            newSurface.startIndex = surface.startIndex;
+            newSurface.count = surface.count;
+            newSurface.bounds = surface.bounds;
+            newSurface.material = materials[surface.material];
+            newSurface.lods.assign(cookedLods.begin() + surface.firstLod, cookedLods.begin() + surface.firstLod + surface.lodCount);
+            newSurface.firstMeshlet = surface.firstMeshlet;
+            newSurface.meshletCount = surface.meshletCount;
+            if (surface.occluderPositions.size != 0) {
+                std::span<const glm::vec3> positions = reader->GetData<glm::vec3>(surface.occluderPositions);
+                std::span<const uint32_t> indices = reader->GetData<uint32_t>(surface.occluderIndices);
+                newSurface.occluder = std::make_shared<OccluderMesh>();
+                newSurface.occluder->positions.assign(positions.begin(), positions.end());
+                newSurface.occluder->indices.assign(indices.begin(), indices.end());
+            }
+            newMesh->surfaces.push_back(newSurface);
+        }
+        if (std::shared_ptr<AssetRegistry::Mesh> shared = registry.FindMesh(mesh.contentKey)) {
+            newMesh->meshBuffers = shared->buffers;
+            file._sharedMeshes.push_back(std::move(shared));
+            file._unpublishedMeshes.push_back(newMesh);
+            continue;
+        }
+        newMesh->meshBuffers.positionOffset = mesh.positionOffset;
+        newMesh->meshBuffers.positionScale = mesh.positionScale;
+
+        meshUploads.push_back(MeshUpload{ reader->GetData<uint32_t>(mesh.indices), reader->GetData<PackedVertex>(mesh.vertices),
+            reader->GetData<GPUMeshlet>(mesh.meshlets), reader->GetData<uint32_t>(mesh.meshletData) });
+        uploadMeshes.push_back(meshes.size() - 1);
+    }
+    std::vector<MeshBuffers> uploadedMeshes = engine->UploadMeshes(meshUploads);
+    for (size_t i = 0; i < uploadedMeshes.size(); i++) {
+        MeshAsset& mesh = *meshes[uploadMeshes[i]];
+        glm::vec3 positionOffset = mesh.meshBuffers.positionOffset;
+        glm::vec3 positionScale = mesh.meshBuffers.positionScale;
+        mesh.meshBuffers = uploadedMeshes[i];
+        mesh.meshBuffers.positionOffset = positionOffset;
+        mesh.meshBuffers.positionScale = positionScale;
+        file._sharedMeshes.push_back(registry.AddMesh(reader->GetMeshes()[uploadMeshes[i]].contentKey, mesh.meshBuffers));
+        file._unpublishedMeshes.push_back(meshes[uploadMeshes[i]]);
+    }
+
+    std::span<const Cooked::Node> cookedNodes = reader->GetNodes();
+    std::span<const uint32_t> cookedChildren = reader->GetChildren();
+    std::vector<Node::Ptr> nodes;
+    for (size_t nodeIndex = 0; nodeIndex < cookedNodes.size(); nodeIndex++) {
+        const Cooked::Node& node = cookedNodes[nodeIndex];
+        std::shared_ptr<Node> newNode;
+        if (node.mesh != UINT32_MAX) {
+            newNode = std::make_shared<MeshNode>();
+            static_cast<MeshNode*>(newNode.get())->SetMesh(meshes[node.mesh]);
+        }
+        else {
+            newNode = std::make_shared<Node>();
+        }
+        newNode->GetLocalTransform() = node.transform;
+        nodes.push_back(newNode);
+        if (nodeIndex < reader->GetHeader().fileNodeCount)
+            file._nodes[std::string(reader->GetString(node.name))];
+    }
+    for (size_t nodeIndex = 0; nodeIndex < cookedNodes.size(); nodeIndex++) {
+        const Cooked::Node& node = cookedNodes[nodeIndex];
+        for (uint32_t child : cookedChildren.subspan(node.firstChild, node.childCount)) {
+            nodes[nodeIndex]->AddChild(nodes[child]);
+            nodes[child]->SetParent(nodes[nodeIndex]);
+        }
+    }
+    file.FindTopNodes(nodes);
+
+    return scene;
+}
+
+void LoadedGLTF::AddSampler(const Cooked::Sampler& filters)
+{
+    _sharedSamplers.push_back(Engine::Get()->GetAssetRegistry().GetSampler(filters));
+    _samplerIndices.push_back(_sharedSamplers.back()->index);
+}
+
+void LoadedGLTF::WriteMaterial(Material& material, MaterialPass passType, const MetallicRougness::MaterialConstants& constants)
+{
+    Engine* engine = Engine::Get();
+    material.data = engine->GetMetalMaterial().WriteMaterial(passType, constants);
+    _materialIndices.push_back(material.data.materialIndex);
+    _unpublishedMaterials.push_back(&material.data);
+}
+
+void LoadedGLTF::Publish()
+{
+    GPUScene& scene = Engine::Get()->GetGPUScene();
+    for (MaterialInstance* material : _unpublishedMaterials) {
+        scene.SetMaterial(material->materialIndex, material);
+    }
+    for (std::shared_ptr<MeshAsset>& mesh : _unpublishedMeshes) {
+        AddMeshDraws(*mesh);
+    }
+    _unpublishedMaterials.clear();
+    _unpublishedMeshes.clear();
+}
+
+void LoadedGLTF::AddMeshDraws(MeshAsset& mesh)
+{
+    for (GeoSurface& surface : mesh.surfaces) {
+        MeshDraw meshDraw;
+        meshDraw.indexType = mesh.meshBuffers.indices.indexType;
+        meshDraw.indexBase = mesh.meshBuffers.indices.firstIndex;
+        meshDraw.vertexBuffer = mesh.meshBuffers.vertexBufferAddress;
+        meshDraw.lodCount = (uint32_t)surface.lods.size();
+        meshDraw.meshletCount = surface.meshletCount;
+        for (uint32_t lod = 0; lod < meshDraw.lodCount; lod++) {
+            meshDraw.lods[lod] = surface.lods[lod];
+            meshDraw.lods[lod].firstIndex += meshDraw.indexBase;
+        }
+        meshDraw.bounds = surface.bounds;
+        meshDraw.occluder = surface.occluder.get();
+        surface.meshId = Engine::Get()->GetGPUScene().AddMesh(meshDraw);
+        _meshIds.push_back(surface.meshId);
+    }
+}
+
+void LoadedGLTF::FindTopNodes(const std::vector<Node::Ptr>& nodes)
+{
     // find the top nodes, with no parents
     for (auto& node : nodes) {
         if (node->GetParent() == nullptr) {
-            file._topNodes.push_back(node);
+            _topNodes.push_back(node);
             node->RefreshWorldTransform(glm::mat4{1.f});
         }
     }
-
-    return scene;
 }
 
 void LoadedGLTF::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
@@ -380,26 +1644,19 @@ void LoadedGLTF::ClearAll()
 {
     Engine* engine = Engine::Get();
 
-    _descriptorPool.DestroyPools();
-    engine->DestroyBuffer(_materialDataBuffer);
-
-    for (auto& [k, v] : _meshes) {
-
-        engine->DestroyBuffer(v->meshBuffers.indexBuffer);
-        engine->DestroyBuffer(v->meshBuffers.vertexBuffer);
+    BindlessResources& bindless = engine->GetBindless();
+    for (uint32_t index : _materialIndices) {
+        bindless.RemoveMaterial(index);
     }
 
-    for (auto& [k, v] : _images) {
-
-        if (v.image == Engine::Get()->GetErrorImage().image) {
-            //dont destroy the default images
-            continue;
-        }
-        engine->DestroyImage(v);
+    GPUScene& scene = engine->GetGPUScene();
+    for (uint32_t id : _meshIds) {
+        scene.RemoveMesh(id);
     }
 
-    for (auto& sampler : _samplers) {
-        vkDestroySampler(engine->GetDevice(), sampler, nullptr);
-    }
+    // images, meshes and samplers no other scene holds go with the last handle
+    _sharedImages.clear();
+    _sharedMeshes.clear();
+    _sharedSamplers.clear();
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "Mesh.h"
+#include "AssetRegistry.h"
 struct SceneData 
 {
 	glm::mat4 view;
@@ -11,16 +12,21 @@ struct SceneData
 };
 
 
+// compact draw packet, everything else is looked up in the gpu scene tables
 struct RenderObject 
 {
-	uint32_t indexCount;
-	uint32_t firstIndex;
-	VkBuffer indexBuffer;
-
-	MaterialInstance* material;
-    Bounds bounds;
-	glm::mat4 transform;
-	VkDeviceAddress vertexBufferAddress;
+	uint32_t objectId; // transform and bounds, also the slot in the gpu scene buffer
+	uint32_t meshId;
+	uint32_t materialId; // bindless material slot
+	uint32_t lod;
+};
+
+// consecutive objects of the same surface and material, drawn with one call
+struct InstancedDraw
+{
+	const RenderObject* object;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
 };
 
 struct DrawContext 
@@ -74,34 +80,92 @@ private:
 class MeshNode : public Node 
 {
 public:
+    ~MeshNode();
     std::shared_ptr<MeshAsset> GetMesh() { return _mesh; };
     void SetMesh(const std::shared_ptr<MeshAsset> mesh) { _mesh = mesh; };
     virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx) override;
 
 private:
     std::shared_ptr<MeshAsset> _mesh;
+    // gpu scene slots per surface, only rewritten when the transform changes
+    std::vector<uint32_t> _objectIds;
+    glm::mat3x4 _uploadedTransform;
+
+};
 
+struct GLTFLoadOptions
+{
+    // vertex cache, overdraw and vertex fetch reordering of every surface, turn off to debug the file as exported
+    bool optimizeMeshes{ true };
+    // simplified index lists for distant objects, appended to the index buffer of the mesh
+    bool generateLods{ true };
+    // clusters of lod 0 for per meshlet culling, they reorder the triangles of every surface
+    bool buildMeshlets{ true };
+    // bakes nodes no animation moves into world space chunks per material, fewer objects to draw
+    // but the nodes can't be moved afterwards
+    bool mergeStaticGeometry{ false };
+    // image decode, accessor conversion and the surface jobs on the job system, the result is the same either way
+    bool parallel{ true };
+    // hashes the decoded images and mesh data into GetContentHash, to check one load against another
+    bool hashContents{ false };
+    // reads the cooked copy from the cache directory when it matches the file and these options
+    bool useCache{ true };
+    // writes the cooked copy after a full import. block compressing every mip is far too slow for a
+    // normal load, so this is left to --cook and a miss uploads the images as rgba8 instead
+    bool cook{ false };
+    // cooked scenes upload the small mip levels only and leave the rest to the texture streamer
+    bool streamTextures{ true };
 };
 
 class LoadedGLTF : public IRenderable
 {
 public:
-    static std::optional<std::shared_ptr<LoadedGLTF>> Load(std::string_view filePath);
+    // called with the scene once its geometry is on the gpu, the images may still be loading
+    typedef std::function<void(const std::shared_ptr<LoadedGLTF>&)> PublishFunction;
+
+    // blocks until everything is loaded, SceneLoader does the same on a thread of its own
+    static std::optional<std::shared_ptr<LoadedGLTF>> Load(std::string_view filePath, const GLTFLoadOptions& options = {});
+    // publish gets the scene before its images are uploaded, and has to get Publish onto the render thread
+    static std::optional<std::shared_ptr<LoadedGLTF>> LoadFile(std::string_view filePath, const GLTFLoadOptions& options, const PublishFunction& publish);
+    // registers the materials and surfaces with the gpu scene, which only the render thread may touch
+    void Publish();
     virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx);
     ~LoadedGLTF() { ClearAll(); };
+    // bytes this scene takes up in the bindless material table
+    size_t GetMaterialMemory() { return _materialMemory; };
+    // zero unless loaded with hashContents
+    uint64_t GetContentHash() { return _contentHash; };
 private:
+    static std::optional<std::shared_ptr<LoadedGLTF>> LoadCooked(const std::filesystem::path& cachePath, uint64_t sourceKey, const GLTFLoadOptions& options);
+    void AddSampler(const Cooked::Sampler& filters);
+    void WriteMaterial(Material& material, MaterialPass passType, const MetallicRougness::MaterialConstants& constants);
+    // registers every surface in the gpu scene mesh table, after the buffers are uploaded
+    void AddMeshDraws(MeshAsset& mesh);
+    void FindTopNodes(const std::vector<Node::Ptr>& nodes);
+
     void ClearAll();
-    std::vector<VkSampler> _samplers;
-    DescriptorAllocatorGrowable _descriptorPool;
+    // slots in the bindless tables, per gltf image, sampler and material
+    std::vector<uint32_t> _textureIndices;
+    std::vector<uint32_t> _samplerIndices;
+    std::vector<uint32_t> _materialIndices;
+    // the gpu copies, shared with every other scene that loaded the same content.
+    // per gltf image and sampler, and per mesh with geometry
+    std::vector<std::shared_ptr<AssetRegistry::Image>> _sharedImages;
+    std::vector<std::shared_ptr<AssetRegistry::Sampler>> _sharedSamplers;
+    std::vector<std::shared_ptr<AssetRegistry::Mesh>> _sharedMeshes;
+    // entries in the gpu scene mesh table, per surface
+    std::vector<uint32_t> _meshIds;
+    // loaded but not in the gpu scene yet, Publish adds them
+    std::vector<MaterialInstance*> _unpublishedMaterials;
+    std::vector<std::shared_ptr<MeshAsset>> _unpublishedMeshes;
+    size_t _materialMemory{ 0 };
+    uint64_t _contentHash{ 0 };
 
     std::unordered_map<std::string, std::shared_ptr<MeshAsset>> _meshes;
     std::unordered_map<std::string, Node::Ptr> _nodes;
-    std::unordered_map<std::string, AllocatedImage> _images;
     std::unordered_map<std::string, std::shared_ptr<Material>> _materials;
 
     // nodes that dont have a parent, for iterating through the file in tree order
 
     std::vector<Node::Ptr> _topNodes;
-
-    AllocatedBuffer _materialDataBuffer;
 };
\ No newline at end of file
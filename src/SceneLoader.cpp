@@ -0,0 +1,111 @@
+#include "SceneLoader.h"
+
+void SceneLoader::Init()
+{
+	_stop = false;
+	_worker = std::thread([this]() { WorkerLoop(); });
+}
+
+void SceneLoader::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+	if (_worker.joinable())
+		_worker.join();
+
+	// scenes that never got handed over are released here, on the render thread like every other
+	_queue.clear();
+	_renderTasks.clear();
+	_pendingCount = 0;
+}
+
+std::shared_ptr<SceneLoad> SceneLoader::LoadAsync(std::string_view filePath, const GLTFLoadOptions& options, LoadedGLTF::PublishFunction onDrawable)
+{
+	std::shared_ptr<SceneLoad> load = std::make_shared<SceneLoad>();
+	load->_path = filePath;
+	load->_options = options;
+	load->_onDrawable = std::move(onDrawable);
+
+	_pendingCount++;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(load);
+	}
+	_wake.notify_one();
+	return load;
+}
+
+void SceneLoader::Poll()
+{
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		tasks.swap(_renderTasks);
+	}
+	for (std::function<void()>& task : tasks) {
+		task();
+	}
+}
+
+void SceneLoader::Finish()
+{
+	while (_pendingCount != 0) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_handedOver.wait(lock, [this]() { return !_renderTasks.empty(); });
+		}
+		Poll();
+	}
+}
+
+void SceneLoader::RunOnRenderThread(std::function<void()>&& function)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_renderTasks.push_back(std::move(function));
+	}
+	_handedOver.notify_all();
+}
+
+void SceneLoader::WorkerLoop()
+{
+	while (true) {
+		std::shared_ptr<SceneLoad> load;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || !_queue.empty(); });
+			if (_stop)
+				return;
+			load = _queue.front();
+			_queue.pop_front();
+		}
+
+		load->_state = SceneLoad::State::Loading;
+		auto file = LoadedGLTF::LoadFile(load->_path, load->_options, [this, load](const std::shared_ptr<LoadedGLTF>& scene) {
+			RunOnRenderThread([load, scene]() {
+				scene->Publish();
+				load->_scene = scene;
+				load->_state = SceneLoad::State::Drawable;
+				if (load->_onDrawable)
+					load->_onDrawable(scene);
+				});
+			});
+
+		// this may be the last reference, a scene has to be released on the render thread
+		std::shared_ptr<LoadedGLTF> scene = file.has_value() ? *file : nullptr;
+		file.reset();
+		RunOnRenderThread([this, load, scene = std::move(scene)]() {
+			if (scene) {
+				load->_state = SceneLoad::State::Done;
+			}
+			else {
+				load->_state = SceneLoad::State::Failed;
+				fmt::println("Failed to load scene {}", load->_path);
+			}
+			_pendingCount--;
+			});
+	}
+}
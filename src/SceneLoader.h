@@ -0,0 +1,65 @@
+#pragma once
+#include "Render.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// a scene on its way in, shared by the caller and the loader thread
+class SceneLoad
+{
+public:
+	enum class State { Queued, Loading, Drawable, Done, Failed };
+
+	State GetState() { return _state; };
+	// drawable scenes have all their geometry, images may still be arriving
+	bool IsDrawable() { State state = _state; return state == State::Drawable || state == State::Done; };
+	bool IsFinished() { State state = _state; return state == State::Done || state == State::Failed; };
+	// null until the scene is drawable, only for the render thread
+	std::shared_ptr<LoadedGLTF> GetScene() { return _scene; };
+	const std::string& GetPath() { return _path; };
+
+private:
+	friend class SceneLoader;
+
+	std::string _path;
+	GLTFLoadOptions _options;
+	LoadedGLTF::PublishFunction _onDrawable;
+	std::atomic<State> _state{ State::Queued };
+	std::shared_ptr<LoadedGLTF> _scene;
+};
+
+// loads gltf files on a thread of its own while the render loop keeps going. the gpu scene belongs
+// to the render thread, so the loader hands every scene over through Poll once its geometry is uploaded
+class SceneLoader
+{
+public:
+	void Init();
+	// waits for the load in progress, queued ones are dropped
+	void Shutdown();
+
+	// files load one after another, so they don't fight over the workers and the upload path.
+	// onDrawable runs on the render thread as soon as the scene can be drawn
+	std::shared_ptr<SceneLoad> LoadAsync(std::string_view filePath, const GLTFLoadOptions& options = {}, LoadedGLTF::PublishFunction onDrawable = {});
+	// runs what the loader handed over, once per frame on the render thread after the frame's fence wait,
+	// so the bindless writes it queues reach the set of the frame about to be recorded
+	void Poll();
+	// blocks the render thread until every queued load is done
+	void Finish();
+	uint32_t GetPendingCount() { return _pendingCount; };
+
+private:
+	void WorkerLoop();
+	void RunOnRenderThread(std::function<void()>&& function);
+
+	std::thread _worker;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _handedOver;
+	std::deque<std::shared_ptr<SceneLoad>> _queue;
+	std::vector<std::function<void()>> _renderTasks;
+	// queued or loading, until the render thread saw the result
+	std::atomic<uint32_t> _pendingCount{ 0 };
+	bool _stop{ false };
+};
@@ -0,0 +1,237 @@
+#include "SoftwareOcclusion.h"
+#include "Engine.h"
+
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+constexpr uint32_t BandCount = 8;
+constexpr uint32_t BandHeight = SoftwareOcclusion::Height / BandCount;
+constexpr float MinClipW = 0.001f;
+
+bool SoftwareOcclusion::IsOccluderCandidate(const GeoSurface& surface)
+{
+	return surface.bounds.sphereRadius >= OccluderMinRadius && surface.count / 3 <= OccluderMaxTriangles;
+}
+
+std::shared_ptr<OccluderMesh> SoftwareOcclusion::ExtractOccluder(std::span<const uint32_t> indices, std::vector<glm::vec3> positions, const GeoSurface& surface, size_t firstVertex)
+{
+	std::shared_ptr<OccluderMesh> occluder = std::make_shared<OccluderMesh>();
+	occluder->positions = std::move(positions);
+
+	occluder->indices.reserve(surface.count);
+	for (uint32_t i = surface.startIndex; i < surface.startIndex + surface.count; i++) {
+		occluder->indices.push_back(indices[i] - (uint32_t)firstVertex);
+	}
+
+	return occluder;
+}
+
+uint32_t SoftwareOcclusion::Cull(DrawContext& ctx, const glm::mat4& viewproj)
+{
+	auto start = std::chrono::system_clock::now();
+	JobSystem& jobs = Engine::Get()->GetJobSystem();
+	GPUScene& scene = Engine::Get()->GetGPUScene();
+
+	std::vector<const RenderObject*> occluders;
+	for (const RenderObject& r : ctx.opaqueSurfaces) {
+		if (scene.GetMesh(r.meshId).occluder)
+			occluders.push_back(&r);
+	}
+
+	_triangles.resize(occluders.size());
+	jobs.ParallelFor((uint32_t)occluders.size(), [&](uint32_t i) {
+		SetupOccluder(*occluders[i], viewproj, scene, _triangles[i]);
+		});
+
+	// bands own separate rows, so the workers never write the same texel
+	jobs.ParallelFor(BandCount, [&](uint32_t band) {
+		RasterizeBand(band);
+		});
+
+	std::vector<uint8_t> occluded(ctx.opaqueSurfaces.size());
+	constexpr uint32_t testChunk = 256;
+	jobs.ParallelFor((uint32_t)(ctx.opaqueSurfaces.size() + testChunk - 1) / testChunk, [&](uint32_t chunk) {
+		size_t end = std::min<size_t>((chunk + 1) * testChunk, ctx.opaqueSurfaces.size());
+		for (size_t i = chunk * testChunk; i < end; i++) {
+			occluded[i] = IsOccluded(ctx.opaqueSurfaces[i], viewproj, scene);
+		}
+		});
+
+	// compact in place so the draw order stays the same
+	size_t kept = 0;
+	for (size_t i = 0; i < ctx.opaqueSurfaces.size(); i++) {
+		if (!occluded[i]) {
+			if (kept != i)
+				ctx.opaqueSurfaces[kept] = ctx.opaqueSurfaces[i];
+			kept++;
+		}
+	}
+	uint32_t removed = (uint32_t)(ctx.opaqueSurfaces.size() - kept);
+	ctx.opaqueSurfaces.resize(kept);
+
+	auto end = std::chrono::system_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+	_cost = elapsed.count() / 1000.f;
+	return removed;
+}
+
+void SoftwareOcclusion::SetupOccluder(const RenderObject& r, const glm::mat4& viewproj, GPUScene& scene, std::vector<ScreenTriangle>& triangles)
+{
+	triangles.clear();
+
+	const OccluderMesh& mesh = *scene.GetMesh(r.meshId).occluder;
+	glm::mat4 matrix = viewproj * ToMatrix(scene.GetObject(r.objectId).transform);
+
+	std::vector<glm::vec4> clip(mesh.positions.size());
+	for (size_t i = 0; i < mesh.positions.size(); i++) {
+		clip[i] = matrix * glm::vec4(mesh.positions[i], 1.f);
+	}
+
+	const glm::vec2 screenScale{ Width * 0.5f, Height * 0.5f };
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const glm::vec4& a = clip[mesh.indices[i]];
+		const glm::vec4& b = clip[mesh.indices[i + 1]];
+		const glm::vec4& c = clip[mesh.indices[i + 2]];
+
+		// dropping a triangle only loses occlusion, so anything crossing the camera plane is skipped instead of clipped
+		if (a.w < MinClipW || b.w < MinClipW || c.w < MinClipW)
+			continue;
+
+		ScreenTriangle tri;
+		tri.v0 = (glm::vec2(a) / a.w + 1.f) * screenScale;
+		tri.v1 = (glm::vec2(b) / b.w + 1.f) * screenScale;
+		tri.v2 = (glm::vec2(c) / c.w + 1.f) * screenScale;
+		tri.depth = std::min(std::min(a.z / a.w, b.z / b.w), c.z / c.w);
+
+		// both sides are rasterized, only the winding used by the edge functions needs to agree
+		float area = (tri.v1.x - tri.v0.x) * (tri.v2.y - tri.v0.y) - (tri.v1.y - tri.v0.y) * (tri.v2.x - tri.v0.x);
+		if (area == 0.f)
+			continue;
+		if (area < 0.f)
+			std::swap(tri.v1, tri.v2);
+
+		triangles.push_back(tri);
+	}
+}
+
+void SoftwareOcclusion::RasterizeBand(uint32_t band)
+{
+	int bandMinY = band * BandHeight;
+	int bandMaxY = bandMinY + BandHeight;
+
+	std::fill(_depth.begin() + bandMinY * Width, _depth.begin() + bandMaxY * Width, 0.f);
+
+	for (const std::vector<ScreenTriangle>& triangles : _triangles) {
+		for (const ScreenTriangle& tri : triangles) {
+			RasterizeTriangle(tri, bandMinY, bandMaxY);
+		}
+	}
+}
+
+void SoftwareOcclusion::RasterizeTriangle(const ScreenTriangle& tri, int bandMinY, int bandMaxY)
+{
+	int minX = std::max((int)std::floor(std::min(std::min(tri.v0.x, tri.v1.x), tri.v2.x)), 0);
+	int maxX = std::min((int)std::ceil(std::max(std::max(tri.v0.x, tri.v1.x), tri.v2.x)), (int)Width);
+	int minY = std::max((int)std::floor(std::min(std::min(tri.v0.y, tri.v1.y), tri.v2.y)), bandMinY);
+	int maxY = std::min((int)std::ceil(std::max(std::max(tri.v0.y, tri.v1.y), tri.v2.y)), bandMaxY);
+	if (minX >= maxX || minY >= maxY)
+		return;
+
+	// edge functions in the form a * x + b * y + c, positive inside
+	auto edge = [](const glm::vec2& p0, const glm::vec2& p1) {
+		return glm::vec3(p0.y - p1.y, p1.x - p0.x, p0.x * p1.y - p0.y * p1.x);
+	};
+	glm::vec3 e0 = edge(tri.v1, tri.v2);
+	glm::vec3 e1 = edge(tri.v2, tri.v0);
+	glm::vec3 e2 = edge(tri.v0, tri.v1);
+
+	// rows are 4 texel aligned so the simd loop never runs past the end
+	minX &= ~3;
+
+#ifdef OCCLUSION_SSE
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 depth = _mm_set1_ps(tri.depth);
+	const __m128 a0 = _mm_set1_ps(e0.x), a1 = _mm_set1_ps(e1.x), a2 = _mm_set1_ps(e2.x);
+
+	for (int y = minY; y < maxY; y++) {
+		float py = y + 0.5f;
+		__m128 row0 = _mm_set1_ps(e0.y * py + e0.z);
+		__m128 row1 = _mm_set1_ps(e1.y * py + e1.z);
+		__m128 row2 = _mm_set1_ps(e2.y * py + e2.z);
+		float* depthRow = &_depth[y * Width];
+
+		for (int x = minX; x < maxX; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+			__m128 w0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+			__m128 w1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+			__m128 w2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			__m128 current = _mm_loadu_ps(depthRow + x);
+			__m128 closer = _mm_max_ps(current, depth);
+			_mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, current)));
+		}
+	}
+#else
+	for (int y = minY; y < maxY; y++) {
+		float py = y + 0.5f;
+		float* depthRow = &_depth[y * Width];
+		for (int x = minX; x < maxX; x++) {
+			float px = x + 0.5f;
+			if (e0.x * px + e0.y * py + e0.z >= 0.f && e1.x * px + e1.y * py + e1.z >= 0.f && e2.x * px + e2.y * py + e2.z >= 0.f)
+				depthRow[x] = std::max(depthRow[x], tri.depth);
+		}
+	}
+#endif
+}
+
+bool SoftwareOcclusion::IsOccluded(const RenderObject& r, const glm::mat4& viewproj, GPUScene& scene)
+{
+	const MeshDraw& mesh = scene.GetMesh(r.meshId);
+	if (mesh.occluder)
+		return false;
+
+	glm::mat4 matrix = viewproj * ToMatrix(scene.GetObject(r.objectId).transform);
+
+	glm::vec2 minScreen{ (float)Width, (float)Height };
+	glm::vec2 maxScreen{ 0.f, 0.f };
+	float nearestDepth = 0.f;
+
+	for (int c = 0; c < 8; c++) {
+		glm::vec3 corner{ (c & 1) ? 1.f : -1.f, (c & 2) ? 1.f : -1.f, (c & 4) ? 1.f : -1.f };
+		glm::vec4 v = matrix * glm::vec4(mesh.bounds.origin + corner * mesh.bounds.extents, 1.f);
+		if (v.w < MinClipW)
+			return false;
+
+		glm::vec2 screen = (glm::vec2(v) / v.w + 1.f) * glm::vec2(Width * 0.5f, Height * 0.5f);
+		minScreen = glm::min(minScreen, screen);
+		maxScreen = glm::max(maxScreen, screen);
+		nearestDepth = std::max(nearestDepth, v.z / v.w);
+	}
+
+	int minX = std::max((int)std::floor(minScreen.x), 0);
+	int maxX = std::min((int)std::ceil(maxScreen.x), (int)Width);
+	int minY = std::max((int)std::floor(minScreen.y), 0);
+	int maxY = std::min((int)std::ceil(maxScreen.y), (int)Height);
+
+	// off screen is left to frustum culling
+	if (minX >= maxX || minY >= maxY)
+		return false;
+
+	// hidden only if every texel under the rectangle has an occluder in front of the object
+	for (int y = minY; y < maxY; y++) {
+		const float* depthRow = &_depth[y * Width];
+		for (int x = minX; x < maxX; x++) {
+			if (depthRow[x] <= nearestDepth)
+				return false;
+		}
+	}
+	return true;
+}
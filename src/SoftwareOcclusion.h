@@ -0,0 +1,40 @@
+#pragma once
+#include "Render.h"
+#include "GPUScene.h"
+
+// low resolution cpu depth buffer, filled with the large occluders of a frame and used to reject
+// opaque objects before they are recorded. cheaper than the gpu passes on software rasterizers
+class SoftwareOcclusion
+{
+public:
+	static constexpr uint32_t Width = 256;
+	static constexpr uint32_t Height = 128;
+
+	// load time heuristic, big enough to hide things but cheap enough to rasterize every frame
+	static constexpr float OccluderMinRadius = 4.f;
+	static constexpr uint32_t OccluderMaxTriangles = 4096;
+
+	static bool IsOccluderCandidate(const GeoSurface& surface);
+	// takes the positions of a surface and copies its indices, made relative to the first vertex
+	static std::shared_ptr<OccluderMesh> ExtractOccluder(std::span<const uint32_t> indices, std::vector<glm::vec3> positions, const GeoSurface& surface, size_t firstVertex);
+
+	// rasterizes the occluders of the context, then removes the opaque objects they hide. returns the removed count
+	uint32_t Cull(DrawContext& ctx, const glm::mat4& viewproj);
+	float GetCost() { return _cost; };
+
+private:
+	struct ScreenTriangle {
+		glm::vec2 v0, v1, v2;
+		float depth;
+	};
+
+	void SetupOccluder(const RenderObject& r, const glm::mat4& viewproj, GPUScene& scene, std::vector<ScreenTriangle>& triangles);
+	void RasterizeBand(uint32_t band);
+	void RasterizeTriangle(const ScreenTriangle& tri, int bandMinY, int bandMaxY);
+	bool IsOccluded(const RenderObject& r, const glm::mat4& viewproj, GPUScene& scene);
+
+	// reverse z, each texel holds the closest occluder depth, where every triangle is flattened to its farthest vertex
+	std::vector<float> _depth = std::vector<float>(Width * Height);
+	std::vector<std::vector<ScreenTriangle>> _triangles;
+	float _cost{ 0.f };
+};
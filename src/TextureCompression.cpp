@@ -0,0 +1,274 @@
+#include "TextureCompression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// interpolation weights of the 4 bit indices, out of 64
+static const uint32_t BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// blocks are filled from the lowest bit of the first byte up
+struct BitWriter {
+	uint8_t* bytes;
+	uint32_t bit{ 0 };
+
+	void Write(uint32_t value, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; i++, bit++) {
+			if ((value >> i) & 1)
+				bytes[bit / 8] |= (uint8_t)(1 << (bit % 8));
+		}
+	}
+};
+
+// mode 6 keeps 7 bits per channel, the lowest bit of all four comes from the shared p bit
+struct BC7Endpoint {
+	uint8_t channels[4];
+	uint32_t pBit;
+
+	uint32_t Expand(int channel) const { return (uint32_t)channels[channel] << 1 | pBit; };
+};
+
+static BC7Endpoint QuantizeEndpoint(const glm::vec4& color)
+{
+	BC7Endpoint best{};
+	float bestError = FLT_MAX;
+	for (uint32_t pBit = 0; pBit < 2; pBit++) {
+		BC7Endpoint endpoint{};
+		endpoint.pBit = pBit;
+		float error = 0.f;
+		for (int c = 0; c < 4; c++) {
+			float value = std::clamp(color[c], 0.f, 255.f);
+			int quantized = std::clamp((int)std::round((value - pBit) / 2.f), 0, 127);
+			endpoint.channels[c] = (uint8_t)quantized;
+			float difference = (float)(quantized << 1 | pBit) - value;
+			error += difference * difference;
+		}
+		if (error < bestError) {
+			bestError = error;
+			best = endpoint;
+		}
+	}
+	return best;
+}
+
+// closest of the 16 interpolated colors for every texel, returns the summed squared error
+static uint32_t FindBC7Indices(const uint8_t texels[64], const BC7Endpoint& e0, const BC7Endpoint& e1, uint8_t indices[16])
+{
+	uint32_t palette[16][4];
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			palette[i][c] = ((64 - BC7Weights[i]) * e0.Expand(c) + BC7Weights[i] * e1.Expand(c) + 32) >> 6;
+		}
+	}
+
+	uint32_t totalError = 0;
+	for (int t = 0; t < 16; t++) {
+		uint32_t bestError = UINT32_MAX;
+		for (int i = 0; i < 16; i++) {
+			uint32_t error = 0;
+			for (int c = 0; c < 4; c++) {
+				int difference = (int)palette[i][c] - texels[t * 4 + c];
+				error += difference * difference;
+			}
+			if (error < bestError) {
+				bestError = error;
+				indices[t] = (uint8_t)i;
+			}
+		}
+		totalError += bestError;
+	}
+	return totalError;
+}
+
+void Util::EncodeBC7(const uint8_t texels[64], uint8_t block[16])
+{
+	glm::vec4 colors[16];
+	glm::vec4 mean{ 0.f };
+	for (int t = 0; t < 16; t++) {
+		colors[t] = glm::vec4(texels[t * 4], texels[t * 4 + 1], texels[t * 4 + 2], texels[t * 4 + 3]);
+		mean += colors[t];
+	}
+	mean /= 16.f;
+
+	glm::mat4 covariance{ 0.f };
+	for (int t = 0; t < 16; t++) {
+		glm::vec4 d = colors[t] - mean;
+		covariance += glm::outerProduct(d, d);
+	}
+
+	// power iteration, starting from the channel that varies the most
+	int widest = 0;
+	for (int c = 1; c < 4; c++) {
+		if (covariance[c][c] > covariance[widest][widest])
+			widest = c;
+	}
+	glm::vec4 axis = covariance[widest];
+	for (int i = 0; i < 8; i++) {
+		axis = covariance * axis;
+		float largest = std::max(std::max(std::abs(axis.x), std::abs(axis.y)), std::max(std::abs(axis.z), std::abs(axis.w)));
+		if (largest == 0.f)
+			break;
+		axis /= largest;
+	}
+
+	float minT = 0.f;
+	float maxT = 0.f;
+	float axisLength = glm::length(axis);
+	if (axisLength > 0.f) {
+		axis /= axisLength;
+		minT = FLT_MAX;
+		maxT = -FLT_MAX;
+		for (int t = 0; t < 16; t++) {
+			float projected = glm::dot(colors[t] - mean, axis);
+			minT = std::min(minT, projected);
+			maxT = std::max(maxT, projected);
+		}
+	}
+
+	BC7Endpoint e0 = QuantizeEndpoint(mean + axis * minT);
+	BC7Endpoint e1 = QuantizeEndpoint(mean + axis * maxT);
+	uint8_t indices[16];
+	uint32_t error = FindBC7Indices(texels, e0, e1, indices);
+
+	// one least squares pass over the endpoints with the indices held fixed
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	glm::vec4 ax{ 0.f }, bx{ 0.f };
+	for (int t = 0; t < 16; t++) {
+		float b = BC7Weights[indices[t]] / 64.f;
+		float a = 1.f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		ax += a * colors[t];
+		bx += b * colors[t];
+	}
+	float determinant = aa * bb - ab * ab;
+	if (determinant > 1e-6f) {
+		BC7Endpoint refined0 = QuantizeEndpoint((ax * bb - bx * ab) / determinant);
+		BC7Endpoint refined1 = QuantizeEndpoint((bx * aa - ax * ab) / determinant);
+		uint8_t refinedIndices[16];
+		if (FindBC7Indices(texels, refined0, refined1, refinedIndices) < error) {
+			e0 = refined0;
+			e1 = refined1;
+			memcpy(indices, refinedIndices, sizeof(indices));
+		}
+	}
+
+	// the first index is stored with one bit less, so it has to be in the lower half.
+	// the weights are symmetric, swapping the endpoints and flipping the indices gives the same colors
+	if (indices[0] & 8) {
+		std::swap(e0, e1);
+		for (uint8_t& index : indices) {
+			index = 15 - index;
+		}
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer{ block };
+	writer.Write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writer.Write(e0.channels[c], 7);
+		writer.Write(e1.channels[c], 7);
+	}
+	writer.Write(e0.pBit, 1);
+	writer.Write(e1.pBit, 1);
+	writer.Write(indices[0], 3);
+	for (int t = 1; t < 16; t++) {
+		writer.Write(indices[t], 4);
+	}
+}
+
+void Util::EncodeBC4(const uint8_t values[16], uint8_t block[8])
+{
+	uint32_t maxValue = *std::max_element(values, values + 16);
+	uint32_t minValue = *std::min_element(values, values + 16);
+	block[0] = (uint8_t)maxValue;
+	block[1] = (uint8_t)minValue;
+
+	// with the larger endpoint first the block uses eight values, six of them between the endpoints.
+	// a flat block leaves every index at zero
+	uint64_t bits = 0;
+	if (maxValue != minValue) {
+		uint32_t palette[8] = { maxValue, minValue };
+		for (uint32_t i = 2; i < 8; i++) {
+			palette[i] = ((8 - i) * maxValue + (i - 1) * minValue + 3) / 7;
+		}
+		for (int t = 0; t < 16; t++) {
+			uint64_t best = 0;
+			uint32_t bestError = UINT32_MAX;
+			for (uint32_t i = 0; i < 8; i++) {
+				uint32_t error = (uint32_t)std::abs((int)palette[i] - (int)values[t]);
+				if (error < bestError) {
+					bestError = error;
+					best = i;
+				}
+			}
+			bits |= best << (3 * t);
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		block[2 + i] = (uint8_t)(bits >> (8 * i));
+	}
+}
+
+void Util::CompressImage(DecodedImage& image, TextureChannels channels)
+{
+	if (image.format != VK_FORMAT_R8G8B8A8_UNORM)
+		return;
+
+	VkFormat format = VK_FORMAT_BC7_UNORM_BLOCK;
+	if (channels == TextureChannels::Occlusion)
+		format = VK_FORMAT_BC4_UNORM_BLOCK;
+	else if (channels == TextureChannels::MetalRoughness)
+		format = VK_FORMAT_BC5_UNORM_BLOCK;
+
+	std::vector<uint8_t> blocks(GetImageByteSize(format, image.size, image.mipLevels));
+	uint8_t* block = blocks.data();
+	const uint8_t* level = image.pixels.data();
+	uint32_t width = image.size.width;
+	uint32_t height = image.size.height;
+	for (uint32_t mip = 0; mip < image.mipLevels; mip++) {
+		for (uint32_t blockY = 0; blockY < (height + 3) / 4; blockY++) {
+			for (uint32_t blockX = 0; blockX < (width + 3) / 4; blockX++) {
+				// blocks hanging over the edge repeat the last row and column
+				uint8_t texels[64];
+				for (uint32_t y = 0; y < 4; y++) {
+					for (uint32_t x = 0; x < 4; x++) {
+						uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+						uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+						memcpy(texels + (y * 4 + x) * 4, level + ((size_t)sourceY * width + sourceX) * 4, 4);
+					}
+				}
+
+				if (channels == TextureChannels::Color) {
+					EncodeBC7(texels, block);
+					block += 16;
+					continue;
+				}
+
+				// occlusion lives in red, roughness in green and metalness in blue
+				uint32_t firstChannel = channels == TextureChannels::Occlusion ? 0 : 1;
+				uint32_t channelCount = channels == TextureChannels::Occlusion ? 1 : 2;
+				for (uint32_t c = 0; c < channelCount; c++) {
+					uint8_t values[16];
+					for (int t = 0; t < 16; t++) {
+						values[t] = texels[t * 4 + firstChannel + c];
+					}
+					EncodeBC4(values, block);
+					block += 8;
+				}
+			}
+		}
+
+		level += (size_t)width * height * 4;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	image.pixels = std::move(blocks);
+	image.format = format;
+	if (channels == TextureChannels::MetalRoughness)
+		image.swizzle = VkComponentMapping{ VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_ONE };
+}
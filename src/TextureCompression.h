@@ -0,0 +1,19 @@
+#pragma once
+#include "Images.h"
+
+// what the cooker knows a texture holds, it decides the block format
+enum class TextureChannels {
+	Color, // bc7, every channel
+	Occlusion, // bc4 from red
+	MetalRoughness, // bc5 from green and blue, swizzled back in the view
+};
+
+namespace Util
+{
+	// replaces the rgba8 chain of the image with blocks, level by level. slow, meant for the cooker only
+	void CompressImage(DecodedImage& image, TextureChannels channels);
+	// 16 rgba8 texels in, one 16 byte block out. bc7 mode 6 with the endpoints fitted along the principal axis
+	void EncodeBC7(const uint8_t texels[64], uint8_t block[16]);
+	// 16 single channel values in, one 8 byte block out
+	void EncodeBC4(const uint8_t values[16], uint8_t block[8]);
+};
@@ -0,0 +1,341 @@
+#include "TextureStreamer.h"
+#include "Engine.h"
+#include "AssetCache.h"
+#include "Images.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+void TextureStreamer::Init()
+{
+	_stop = false;
+	_worker = std::thread([this]() { WorkerLoop(); });
+}
+
+void TextureStreamer::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+	if (_worker.joinable())
+		_worker.join();
+
+	// read but never copied, the gpu never saw these
+	Engine* engine = Engine::Get();
+	for (StreamRequest& request : _completed) {
+		engine->DestroyBuffer(request.staging);
+	}
+	_completed.clear();
+	_requests.clear();
+	for (auto& [id, texture] : _textures) {
+		engine->DestroyImage(texture.image);
+	}
+	_textures.clear();
+}
+
+uint32_t TextureStreamer::AddTexture(std::shared_ptr<CookedReader> source, std::span<const uint8_t> pixels, VkExtent3D size, uint32_t mipLevels,
+	VkFormat format, VkComponentMapping swizzle, const AllocatedImage& image, uint32_t baseLevel, uint32_t bindlessSlot)
+{
+	std::lock_guard<std::mutex> textureLock(_textureMutex);
+	uint32_t id = _nextId++;
+	StreamedTexture& texture = _textures[id];
+	texture.source = std::move(source);
+	texture.pixels = pixels;
+	texture.size = size;
+	texture.mipLevels = mipLevels;
+	texture.format = format;
+	texture.swizzle = swizzle;
+	texture.bindlessSlot = bindlessSlot;
+	texture.image = image;
+	texture.baseLevel = baseLevel;
+	texture.residentLevel = baseLevel;
+	texture.targetLevel = baseLevel;
+	_residentBytes += GetLevelBytes(texture, baseLevel);
+
+	// a full bindless table hands out the default slot, no material leads to this texture then and it never streams
+	if (bindlessSlot == 0)
+		return id;
+	if (bindlessSlot >= _slotTextures.size())
+		_slotTextures.resize(bindlessSlot + 1, UINT32_MAX);
+	_slotTextures[bindlessSlot] = id;
+	return id;
+}
+
+void TextureStreamer::RemoveTexture(uint32_t id)
+{
+	std::lock_guard<std::mutex> textureLock(_textureMutex);
+	auto it = _textures.find(id);
+	if (it == _textures.end())
+		return;
+
+	// a request still in flight keeps the mapping alive, its result is dropped in Upload
+	StreamedTexture& texture = it->second;
+	if (texture.pending)
+		_pendingCount--;
+	_residentBytes -= GetLevelBytes(texture, texture.residentLevel);
+	if (texture.bindlessSlot < _slotTextures.size() && _slotTextures[texture.bindlessSlot] == id)
+		_slotTextures[texture.bindlessSlot] = UINT32_MAX;
+	Engine::Get()->DestroyImage(texture.image);
+	_textures.erase(it);
+}
+
+uint32_t TextureStreamer::GetBaseLevel(VkExtent3D size, uint32_t mipLevels)
+{
+	uint32_t level = 0;
+	while (level + 1 < mipLevels) {
+		VkExtent3D levelSize = GetLevelSize(size, level);
+		if (std::max(levelSize.width, levelSize.height) <= BaseLevelSize)
+			break;
+		level++;
+	}
+	return level;
+}
+
+VkExtent3D TextureStreamer::GetLevelSize(VkExtent3D size, uint32_t level)
+{
+	return VkExtent3D{ std::max(size.width >> level, 1u), std::max(size.height >> level, 1u), 1 };
+}
+
+size_t TextureStreamer::GetLevelBytes(const StreamedTexture& texture, uint32_t firstLevel)
+{
+	return Util::GetImageByteSize(texture.format, texture.size, texture.mipLevels) - Util::GetImageByteSize(texture.format, texture.size, firstLevel);
+}
+
+void TextureStreamer::Update(const DrawContext& context, const glm::vec3& cameraPosition, float projectionScale)
+{
+	std::lock_guard<std::mutex> textureLock(_textureMutex);
+	if (_textures.empty())
+		return;
+
+	Engine* engine = Engine::Get();
+	GPUScene& scene = engine->GetGPUScene();
+	BindlessResources& bindless = engine->GetBindless();
+
+	// the finest level any object asks for, textures nobody draws stay at their base level
+	std::unordered_map<uint32_t, uint32_t> wanted;
+	wanted.reserve(_textures.size());
+	for (auto& [id, texture] : _textures) {
+		wanted[id] = texture.baseLevel;
+	}
+
+	auto requestLevels = [&](const std::vector<RenderObject>& objects) {
+		for (const RenderObject& r : objects) {
+			const MeshDraw& mesh = scene.GetMesh(r.meshId);
+			const glm::mat3x4& transform = scene.GetObject(r.objectId).transform;
+
+			float scale = 0.f;
+			for (int axis = 0; axis < 3; axis++) {
+				scale = std::max(scale, glm::length(glm::vec3(transform[0][axis], transform[1][axis], transform[2][axis])));
+			}
+			float radius = mesh.bounds.sphereRadius * scale;
+			float distance = glm::length(TransformPoint(transform, mesh.bounds.origin) - cameraPosition);
+			// assumes the texture is stretched over the object once, inside the sphere everything is at full detail
+			float pixels = distance > radius ? 2.f * radius / distance * projectionScale : FLT_MAX;
+
+			const MetallicRougness::MaterialConstants& constants = bindless.GetMaterial(r.materialId);
+			for (uint32_t packed : { constants.colorTexture, constants.metalRoughTexture, constants.normalTexture, constants.occlusionTexture, constants.emissiveTexture }) {
+				uint32_t slot = packed & 0xffff;
+				if (slot >= _slotTextures.size() || _slotTextures[slot] == UINT32_MAX)
+					continue;
+				uint32_t id = _slotTextures[slot];
+				const StreamedTexture& texture = _textures[id];
+
+				float largest = (float)std::max(texture.size.width, texture.size.height);
+				uint32_t level = 0;
+				if (pixels < largest)
+					level = (uint32_t)std::floor(std::log2(largest / std::max(pixels, 1.f)));
+				uint32_t& current = wanted[id];
+				current = std::min(current, std::min(level, texture.baseLevel));
+			}
+		}
+	};
+	requestLevels(context.opaqueSurfaces);
+	requestLevels(context.transparentSurfaces);
+
+	// one level per texture and round, so a tight budget spreads over every texture instead of
+	// going to the first ones in full
+	size_t used = 0;
+	std::unordered_map<uint32_t, uint32_t> granted;
+	granted.reserve(_textures.size());
+	for (auto& [id, texture] : _textures) {
+		granted[id] = texture.baseLevel;
+		used += GetLevelBytes(texture, texture.baseLevel);
+	}
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto& [id, texture] : _textures) {
+			uint32_t& level = granted[id];
+			if (level <= wanted[id])
+				continue;
+			size_t levelBytes = Util::GetImageByteSize(texture.format, GetLevelSize(texture.size, level - 1));
+			if (used + levelBytes > _budget)
+				continue;
+			used += levelBytes;
+			level--;
+			changed = true;
+		}
+	}
+
+	std::vector<StreamRequest> requests;
+	for (auto& [id, texture] : _textures) {
+		texture.targetLevel = granted[id];
+		if (texture.pending || texture.targetLevel >= texture.residentLevel)
+			continue;
+
+		StreamRequest request;
+		request.id = id;
+		request.level = texture.targetLevel;
+		request.residentLevel = texture.residentLevel;
+		request.source = texture.source;
+		request.pixels = texture.pixels;
+		request.size = texture.size;
+		request.format = texture.format;
+		requests.push_back(std::move(request));
+		texture.pending = true;
+		_pendingCount++;
+	}
+
+	if (requests.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (StreamRequest& request : requests) {
+			_requests.push_back(std::move(request));
+		}
+	}
+	_wake.notify_one();
+}
+
+void TextureStreamer::WorkerLoop()
+{
+	Engine* engine = Engine::Get();
+	while (true) {
+		StreamRequest request;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || !_requests.empty(); });
+			if (_stop)
+				return;
+			request = std::move(_requests.front());
+			_requests.pop_front();
+		}
+
+		// touching the mapping here is what pages the levels in, the render thread only records the copy
+		size_t offset = Util::GetImageByteSize(request.format, request.size, request.level);
+		size_t size = Util::GetImageByteSize(request.format, request.size, request.residentLevel) - offset;
+		request.staging = engine->CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+		memcpy(request.staging.info.pMappedData, request.pixels.data() + offset, size);
+		request.source.reset();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_completed.push_back(std::move(request));
+	}
+}
+
+void TextureStreamer::Upload(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue)
+{
+	Engine* engine = Engine::Get();
+
+	std::deque<StreamRequest> completed;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		completed.swap(_completed);
+	}
+
+	std::lock_guard<std::mutex> textureLock(_textureMutex);
+	size_t uploaded = 0;
+	while (!completed.empty()) {
+		StreamRequest& request = completed.front();
+		auto it = _textures.find(request.id);
+		if (it == _textures.end()) {
+			engine->DestroyBuffer(request.staging);
+			completed.pop_front();
+			continue;
+		}
+
+		// the rest waits for the next frame, at least one goes through however large it is
+		size_t size = request.staging.info.size;
+		if (uploaded != 0 && uploaded + size > MaxUploadPerFrame)
+			break;
+		uploaded += size;
+
+		StreamedTexture& texture = it->second;
+		Resize(cmd, texture, request.level, &request.staging, frameDeletionQueue);
+		texture.pending = false;
+		_pendingCount--;
+
+		AllocatedBuffer staging = request.staging;
+		frameDeletionQueue.Push([=]() { Engine::Get()->DestroyBuffer(staging); });
+		completed.pop_front();
+	}
+	if (!completed.empty()) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_completed.insert(_completed.begin(), std::make_move_iterator(completed.begin()), std::make_move_iterator(completed.end()));
+	}
+
+	// levels nothing needs stay cached until the budget runs out, turning the camera back finds them still there
+	if (_residentBytes <= _budget)
+		return;
+	for (auto& [id, texture] : _textures) {
+		if (!texture.pending && texture.targetLevel > texture.residentLevel)
+			Resize(cmd, texture, texture.targetLevel, nullptr, frameDeletionQueue);
+	}
+}
+
+void TextureStreamer::Resize(VkCommandBuffer cmd, StreamedTexture& texture, uint32_t level, const AllocatedBuffer* staging, DeletionQueue& frameDeletionQueue)
+{
+	Engine* engine = Engine::Get();
+	AllocatedImage newImage = engine->CreateImage(GetLevelSize(texture.size, level), texture.format,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, texture.mipLevels - level, texture.swizzle);
+
+	Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	Util::TransitionImage(cmd, texture.image.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	// the levels both images have move over on the gpu
+	std::vector<VkImageCopy> imageCopies;
+	for (uint32_t mip = std::max(level, texture.residentLevel); mip < texture.mipLevels; mip++) {
+		VkImageCopy copy{};
+		copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - texture.residentLevel, 0, 1 };
+		copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - level, 0, 1 };
+		copy.extent = GetLevelSize(texture.size, mip);
+		imageCopies.push_back(copy);
+	}
+	vkCmdCopyImage(cmd, texture.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		(uint32_t)imageCopies.size(), imageCopies.data());
+
+	// the new ones come from the staging buffer, which starts at the first of them
+	if (staging != nullptr) {
+		std::vector<VkBufferImageCopy> bufferCopies;
+		VkDeviceSize bufferOffset = 0;
+		for (uint32_t mip = level; mip < texture.residentLevel; mip++) {
+			VkBufferImageCopy copy{};
+			copy.bufferOffset = bufferOffset;
+			copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - level, 0, 1 };
+			copy.imageExtent = GetLevelSize(texture.size, mip);
+			bufferCopies.push_back(copy);
+			bufferOffset += Util::GetImageByteSize(texture.format, copy.imageExtent);
+		}
+		vkCmdCopyBufferToImage(cmd, staging->buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			(uint32_t)bufferCopies.size(), bufferCopies.data());
+	}
+
+	Util::TransitionImage(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// this frame still samples the old image, the slot only moves over in each frame's copy of the
+	// bindless set once that frame's fence has passed
+	Util::TransitionImage(cmd, texture.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	engine->GetBindless().SetTexture(texture.bindlessSlot, newImage.imageView);
+
+	// destroyed once this frame's fence passed, a copy of the set still pointing at it is rewritten before it is bound again
+	AllocatedImage oldImage = texture.image;
+	frameDeletionQueue.Push([=]() { Engine::Get()->DestroyImage(oldImage); });
+
+	_residentBytes -= GetLevelBytes(texture, texture.residentLevel);
+	_residentBytes += GetLevelBytes(texture, level);
+	texture.image = newImage;
+	texture.residentLevel = level;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "Render.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct DeletionQueue;
+class CookedReader;
+
+// keeps the detailed mip levels of cooked textures on the gpu only while something on screen needs them.
+// a texture's image holds the levels from its resident one down, growing or shrinking means a new image
+// that takes over the old levels with a copy, so sampling never sees a level that hasn't arrived yet
+class TextureStreamer
+{
+public:
+	// levels up to this size are uploaded at import and never dropped
+	static constexpr uint32_t BaseLevelSize = 128;
+	// bytes copied into textures per frame, more waits for the next one
+	static constexpr size_t MaxUploadPerFrame = 32 * 1024 * 1024;
+
+	void Init();
+	void Shutdown();
+
+	// the pixels hold the whole chain and stay readable through the reader, the image the levels from baseLevel
+	uint32_t AddTexture(std::shared_ptr<CookedReader> source, std::span<const uint8_t> pixels, VkExtent3D size, uint32_t mipLevels,
+		VkFormat format, VkComponentMapping swizzle, const AllocatedImage& image, uint32_t baseLevel, uint32_t bindlessSlot);
+	// destroys the image right away, the gpu must be done with it
+	void RemoveTexture(uint32_t id);
+	// the first level at or below BaseLevelSize
+	static uint32_t GetBaseLevel(VkExtent3D size, uint32_t mipLevels);
+
+	// picks the level every texture needs from the projected size of the objects using it, then fits
+	// the choice into the budget, coarse levels of every texture first
+	void Update(const DrawContext& context, const glm::vec3& cameraPosition, float projectionScale);
+	// swaps in the levels the worker finished reading and shrinks textures while over budget, must run outside of rendering
+	void Upload(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue);
+
+	void SetBudget(size_t bytes) { _budget = bytes; };
+	size_t GetBudget() { return _budget; };
+	size_t GetResidentBytes() { return _residentBytes; };
+	uint32_t GetPendingCount() { return _pendingCount; };
+
+private:
+	struct StreamedTexture {
+		std::shared_ptr<CookedReader> source;
+		std::span<const uint8_t> pixels;
+		VkExtent3D size;
+		uint32_t mipLevels;
+		VkFormat format;
+		VkComponentMapping swizzle;
+		uint32_t bindlessSlot;
+
+		AllocatedImage image;
+		uint32_t baseLevel;
+		uint32_t residentLevel;
+		// what the budget allows, the image moves towards it
+		uint32_t targetLevel;
+		bool pending{ false };
+	};
+
+	// levels [level, residentLevel) of a texture, read on the worker into a staging buffer
+	struct StreamRequest {
+		uint32_t id;
+		uint32_t level;
+		uint32_t residentLevel;
+		std::shared_ptr<CookedReader> source;
+		std::span<const uint8_t> pixels;
+		VkExtent3D size;
+		VkFormat format;
+		AllocatedBuffer staging;
+	};
+
+	void WorkerLoop();
+	// moves the texture to a new image holding the levels from level down, the missing ones come from the staging buffer
+	void Resize(VkCommandBuffer cmd, StreamedTexture& texture, uint32_t level, const AllocatedBuffer* staging, DeletionQueue& frameDeletionQueue);
+	static VkExtent3D GetLevelSize(VkExtent3D size, uint32_t level);
+	// bytes of the levels from firstLevel to the end of the chain
+	static size_t GetLevelBytes(const StreamedTexture& texture, uint32_t firstLevel);
+
+	// scenes loading in the background add their textures from the loader thread
+	std::mutex _textureMutex;
+	std::unordered_map<uint32_t, StreamedTexture> _textures;
+	uint32_t _nextId{ 0 };
+	// texture per bindless slot, so materials lead to their textures
+	std::vector<uint32_t> _slotTextures;
+
+	size_t _budget{ 512ull * 1024 * 1024 };
+	std::atomic<size_t> _residentBytes{ 0 };
+	std::atomic<uint32_t> _pendingCount{ 0 };
+
+	std::thread _worker;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::deque<StreamRequest> _requests;
+	std::deque<StreamRequest> _completed;
+	bool _stop{ false };
+};
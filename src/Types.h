@@ -16,6 +16,7 @@
 #include <fmt/core.h>
 
 #include <glm/mat4x4.hpp>
+#include <glm/mat3x4.hpp>
 #include <glm/vec4.hpp>
 
 #ifdef DEBUG
@@ -31,6 +32,9 @@
 #define VK_CHECK(x) x
 #endif
 
+// frames the cpu records ahead of the gpu, each one has its own copy of whatever the gpu reads while it is pending
+constexpr uint32_t FRAME_OVERLAP = 2;
+
 struct AllocatedImage 
 {
     VkImage image;
@@ -55,11 +59,56 @@ struct Vertex {
     glm::vec4 color;
 };
 
+// what the vertex shaders read, 20 bytes against 48 for Vertex. positions are unorm16 inside the mesh
+// bounds, normals octahedral snorm16, uvs half floats and the color rgba8
+struct PackedVertex {
+    uint16_t position[3];
+    uint16_t padding;
+    uint32_t normal;
+    uint32_t uv;
+    uint32_t color;
+};
+
 struct DrawPushConstants {
-    glm::mat4 worldMatrix;
+    VkDeviceAddress objectBuffer;
+    VkDeviceAddress instanceBuffer;
+};
+
+struct IndirectPushConstants {
+    VkDeviceAddress objectBuffer;
+};
+
+// task and mesh shader path, the task shader culls the meshlets listed by the cull pass
+struct MeshletPushConstants {
+    VkDeviceAddress cullData;
+    VkDeviceAddress sceneBuffer;
+    VkDeviceAddress drawListBuffer;
+    VkDeviceAddress clusterWorkBuffer;
+    VkDeviceAddress countBuffer;
+};
+
+// per object data kept in the gpu scene buffer and read by the culling and vertex shaders, std430 layout
+struct GPUObjectData {
+    glm::mat3x4 transform; // first three rows of the affine model matrix
+    glm::vec4 sphereBounds; // xyz for the local origin, w for the radius
+    // undoes the position quantization of the vertex buffer
+    glm::vec3 positionOffset;
+    uint32_t firstIndex;
+    glm::vec3 positionScale;
+    uint32_t indexCount;
     VkDeviceAddress vertexBuffer;
+    uint32_t materialIndex;
+    uint32_t meshletCount;
+    VkDeviceAddress meshletBuffer;
+    uint32_t firstMeshlet;
+    uint32_t padding;
 };
 
+// affine matrices drop the constant last row, a point is transformed by dotting it with each stored row
+inline glm::mat3x4 ToAffine(const glm::mat4& matrix) { return glm::mat3x4(glm::transpose(matrix)); }
+inline glm::mat4 ToMatrix(const glm::mat3x4& affine) { return glm::transpose(glm::mat4(affine[0], affine[1], affine[2], glm::vec4(0.f, 0.f, 0.f, 1.f))); }
+inline glm::vec3 TransformPoint(const glm::mat3x4& affine, const glm::vec3& point) { return glm::vec4(point, 1.f) * affine; }
+
 struct ComputePushConstants {
     glm::vec4 data1;
     glm::vec4 data2;